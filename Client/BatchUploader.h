@@ -0,0 +1,215 @@
+﻿#pragma once
+
+#include "OrsApiClient.h"
+
+namespace ors_api_client
+{
+    // path of the bulk score endpoint, takes an array of {uuid, user_name, score, board}
+    constexpr char SCORES_PATH[] = "/scores";
+
+    // buffers score submissions and uploads them in batches through the bulk endpoint
+    // the server only keeps the best score of each uuid on a board, so only the best pending score is sent
+    // a batch is sent when max_batch_size uuids are pending or the oldest submission is flush_interval old
+    // a batch that failed or was turned away is merged back and sent again after the Retry-After of the response,
+    // or after flush_interval without one. A batch the server rejected as invalid is dropped
+    class BatchUploader
+    {
+    public:
+
+        BatchUploader(std::string_view url, std::size_t max_batch_size = 64, std::chrono::milliseconds flush_interval = std::chrono::milliseconds(1000))
+            : url(std::string(url) + SCORES_PATH)
+            , maxBatchSize(max_batch_size)
+            , flushInterval(flush_interval)
+        {
+            // the pool has to outlive a static uploader that flushes in its destructor
+            ConnectionPool::Instance();
+            flushThread = std::thread([this] { Run(); });
+        }
+        BatchUploader(const BatchUploader&) = delete;
+        BatchUploader& operator=(const BatchUploader&) = delete;
+
+        // uploads what is still pending
+        ~BatchUploader() {
+            {
+                std::lock_guard lock(mutex);
+                running = false;
+            }
+            condition.notify_one();
+            flushThread.join();
+        }
+
+        void Submit(std::string_view uuid, std::string_view user_name, int score, std::string_view board) {
+            {
+                std::lock_guard lock(mutex);
+                if (pending.empty()) {
+                    oldestSubmission = std::chrono::steady_clock::now();
+                }
+
+                // keep only the best score per uuid and board
+                auto [it, inserted] = pending.try_emplace(PendingKey(board, uuid), std::string(user_name), score);
+                if (!inserted && it->second.score < score) {
+                    it->second.userName = user_name;
+                    it->second.score    = score;
+                }
+                if (pending.size() < maxBatchSize) {
+                    return;
+                }
+                flushRequested = true;
+            }
+            condition.notify_one();
+        }
+
+        // upload pending scores now, without waiting for the thresholds
+        // a back off after a failed upload is still waited out
+        void Flush() {
+            {
+                std::lock_guard lock(mutex);
+                flushRequested = true;
+            }
+            condition.notify_one();
+        }
+
+        // uploads that got no response or were answered with an error, retried or not
+        std::uint64_t GetFailedUploads() const {
+            std::lock_guard lock(mutex);
+            return failedUploads;
+        }
+
+        // scores given up on: rejected by the server, or failed while the uploader was shutting down
+        std::uint64_t GetDroppedScores() const {
+            std::lock_guard lock(mutex);
+            return droppedScores;
+        }
+
+    private:
+
+        // board and uuid
+        using PendingKey = std::pair<std::string, std::string>;
+
+        struct PendingScore
+        {
+            PendingScore(std::string user_name, int score) : userName(std::move(user_name)), score(score) {}
+
+            std::string userName;
+            int         score;
+        };
+
+        void Run() {
+            std::unique_lock lock(mutex);
+            while (true) {
+                if (pending.empty()) {
+                    condition.wait(lock, [this] { return !running || !pending.empty(); });
+                }
+                else if (running && std::chrono::steady_clock::now() < retryAt) {
+                    // the last upload failed, back off even if a flush is requested
+                    condition.wait_until(lock, retryAt, [this] { return !running; });
+                    continue;
+                }
+                else {
+                    condition.wait_until(lock, oldestSubmission + flushInterval, [this] { return !running || flushRequested; });
+                }
+                if (pending.empty()) {
+                    flushRequested = false;
+                    if (!running) {
+                        break;
+                    }
+                    continue;
+                }
+                // flush when requested, when the oldest submission is due or when shutting down
+                if (!flushRequested && running && std::chrono::steady_clock::now() < oldestSubmission + flushInterval) {
+                    continue;
+                }
+
+                std::map<PendingKey, PendingScore> batch;
+                batch.swap(pending);
+                flushRequested = false;
+
+                // upload without holding the lock so that Submit does not wait on the network
+                lock.unlock();
+                auto result = Upload(batch);
+                lock.lock();
+
+                if (result == UploadResult::OK) {
+                    continue;
+                }
+                ++failedUploads;
+                // there is no one left to retry for once the destructor waits
+                if (result == UploadResult::REJECTED || !running) {
+                    droppedScores += batch.size();
+                    continue;
+                }
+
+                // merge the batch back, a better score submitted meanwhile wins
+                pending.merge(batch);
+                for (auto& [key, failed_score] : batch) {
+                    auto& pending_score = pending.at(key);
+                    if (pending_score.score < failed_score.score) {
+                        pending_score = std::move(failed_score);
+                    }
+                }
+                retryAt        = std::chrono::steady_clock::now() + retryDelay;
+                flushRequested = true;
+            }
+        }
+
+        enum class UploadResult {
+            OK,
+            // no response, a server error or turned away (429), sent again later
+            FAILED,
+            // the server does not accept the batch, sending it again would not help
+            REJECTED,
+        };
+
+        // retryDelay is set to the Retry-After of the response if it has one, to flushInterval if not
+        UploadResult Upload(const std::map<PendingKey, PendingScore>& batch) {
+            json params = json::array();
+            for (const auto& [key, pending_score] : batch) {
+                json entry;
+                entry["uuid"]      = key.second;
+                entry["user_name"] = pending_score.userName;
+                entry["score"]     = pending_score.score;
+                entry["board"]     = key.first;
+                params.push_back(std::move(entry));
+            }
+
+            int status = 0;
+            retryDelay = flushInterval;
+            bool received = Exchange(url, Method::POST, params, [&](const HttpResponseParser& parser) {
+                status = parser.GetStatusCode();
+                // only the delay-seconds form, an HTTP-date keeps the default
+                auto retry_after = parser.GetHeaderField("Retry-After");
+                std::uint32_t seconds = 0;
+                auto [ptr, ec] = std::from_chars(retry_after.data(), retry_after.data() + retry_after.size(), seconds);
+                if (ec == std::errc() && ptr == retry_after.data() + retry_after.size() && !retry_after.empty()) {
+                    retryDelay = std::chrono::seconds(seconds);
+                }
+            });
+            if (received && status / 100 == 2) {
+                return UploadResult::OK;
+            }
+            if (received && status / 100 == 4 && status != 429) {
+                return UploadResult::REJECTED;
+            }
+            return UploadResult::FAILED;
+        }
+
+        std::string                                   url;
+        std::size_t                                   maxBatchSize;
+        std::chrono::milliseconds                     flushInterval;
+
+        mutable std::mutex                            mutex;
+        std::condition_variable                       condition;
+        std::map<PendingKey, PendingScore>            pending;
+        std::chrono::steady_clock::time_point         oldestSubmission;
+        // no upload before retryAt after a failed one
+        std::chrono::steady_clock::time_point         retryAt;
+        std::chrono::milliseconds                     retryDelay;
+        std::uint64_t                                 failedUploads  = 0;
+        std::uint64_t                                 droppedScores  = 0;
+        bool                                          flushRequested = false;
+        bool                                          running        = true;
+
+        std::thread                                   flushThread;
+
+    };
+};
@@ -0,0 +1,161 @@
+﻿#pragma once
+
+namespace ors_benchmark
+{
+    // high dynamic range histogram of latencies, the bucket layout of HdrHistogram
+    //
+    // values are counted in buckets whose width doubles every power of two, each power of two is split
+    // into enough linear sub-buckets to keep significant_figures decimal digits. Recording is a couple of
+    // integer operations, the memory does not grow with the number of values and percentiles are exact
+    // to the precision, also at p999. Histograms of several threads are combined with Merge
+    class HdrHistogram
+    {
+    public:
+
+        // lowest and highest in the unit of the values (e.g. microseconds), larger values are clamped
+        HdrHistogram(std::int64_t lowest = 1, std::int64_t highest = 60'000'000, int significant_figures = 3)
+            : lowest(lowest)
+            , highest(highest)
+            , significantFigures(significant_figures)
+        {
+            if (lowest < 1 || highest < 2 * lowest || significant_figures < 1 || significant_figures > 5) {
+                assert::ExceptionThrow("Invalid histogram range");
+            }
+
+            std::int64_t largest_single_unit = 2;
+            for (int i = 0; i < significant_figures; ++i) {
+                largest_single_unit *= 10;
+            }
+            unitMagnitude               = std::bit_width(static_cast<std::uint64_t>(lowest)) - 1;
+            subBucketHalfCountMagnitude = std::bit_width(static_cast<std::uint64_t>(largest_single_unit - 1)) - 1;
+            subBucketCount              = std::int64_t(1) << (subBucketHalfCountMagnitude + 1);
+            subBucketHalfCount          = subBucketCount / 2;
+            subBucketMask               = (subBucketCount - 1) << unitMagnitude;
+
+            // buckets until the highest value is covered
+            int bucket_count = 1;
+            for (auto trackable = subBucketCount << unitMagnitude; trackable <= highest; trackable <<= 1) {
+                ++bucket_count;
+            }
+            counts.assign(static_cast<std::size_t>((bucket_count + 1) * subBucketHalfCount), 0);
+        }
+
+        void Record(std::int64_t value) {
+            value = std::clamp(value, std::int64_t(0), highest);
+            ++counts[GetCountsIndex(value)];
+            ++totalCount;
+            sum      += value;
+            minValue  = (std::min)(minValue, value);
+            maxValue  = (std::max)(maxValue, value);
+        }
+
+        // add the values of a histogram with the same layout
+        void Merge(const HdrHistogram& other) {
+            if (other.counts.size() != counts.size() || other.lowest != lowest || other.significantFigures != significantFigures) {
+                assert::ExceptionThrow("Histograms have different layouts");
+            }
+            for (std::size_t i = 0; i < counts.size(); ++i) {
+                counts[i] += other.counts[i];
+            }
+            totalCount += other.totalCount;
+            sum        += other.sum;
+            minValue    = (std::min)(minValue, other.minValue);
+            maxValue    = (std::max)(maxValue, other.maxValue);
+        }
+
+        std::uint64_t GetTotalCount() const {
+            return totalCount;
+        }
+
+        std::int64_t GetMin() const {
+            return totalCount ? minValue : 0;
+        }
+
+        std::int64_t GetMax() const {
+            return totalCount ? maxValue : 0;
+        }
+
+        double GetMean() const {
+            return totalCount ? static_cast<double>(sum) / static_cast<double>(totalCount) : 0.0;
+        }
+
+        // value at or below which percentile percent of the values are, as HdrHistogram reports it:
+        // the highest value that is equivalent to the one found within the precision
+        std::int64_t GetValueAtPercentile(double percentile) const {
+            if (totalCount == 0) {
+                return 0;
+            }
+            percentile = std::clamp(percentile, 0.0, 100.0);
+            auto count_at_percentile = (std::max)(std::uint64_t(1), static_cast<std::uint64_t>(percentile / 100.0 * static_cast<double>(totalCount) + 0.5));
+            std::uint64_t total = 0;
+            for (std::size_t i = 0; i < counts.size(); ++i) {
+                total += counts[i];
+                if (total >= count_at_percentile) {
+                    return (std::min)(GetHighestEquivalentValue(GetValueFromIndex(i)), maxValue);
+                }
+            }
+            return maxValue;
+        }
+
+        // visit(lowest value, highest equivalent value, count) of every bucket that has values, in order
+        template<class Visitor>
+        void ForEachBucket(Visitor&& visitor) const {
+            for (std::size_t i = 0; i < counts.size(); ++i) {
+                if (counts[i]) {
+                    auto value = GetValueFromIndex(i);
+                    visitor(value, GetHighestEquivalentValue(value), counts[i]);
+                }
+            }
+        }
+
+    private:
+
+        int GetBucketIndex(std::int64_t value) const {
+            // the power of two of value above the first bucket, which is subBucketCount values wide
+            return static_cast<int>(64 - unitMagnitude - subBucketHalfCountMagnitude - 1)
+                - std::countl_zero(static_cast<std::uint64_t>(value | subBucketMask));
+        }
+
+        std::size_t GetCountsIndex(std::int64_t value) const {
+            auto bucket_index     = GetBucketIndex(value);
+            auto sub_bucket_index = value >> (bucket_index + unitMagnitude);
+            // buckets after the first one only use their upper half, the lower half is the previous bucket
+            auto bucket_base_index = static_cast<std::int64_t>(bucket_index + 1) << subBucketHalfCountMagnitude;
+            return static_cast<std::size_t>(bucket_base_index + sub_bucket_index - subBucketHalfCount);
+        }
+
+        std::int64_t GetValueFromIndex(std::size_t index) const {
+            auto bucket_index     = static_cast<int>(index >> subBucketHalfCountMagnitude) - 1;
+            auto sub_bucket_index = static_cast<std::int64_t>(index & (subBucketHalfCount - 1)) + subBucketHalfCount;
+            if (bucket_index < 0) {
+                sub_bucket_index -= subBucketHalfCount;
+                bucket_index      = 0;
+            }
+            return sub_bucket_index << (bucket_index + unitMagnitude);
+        }
+
+        std::int64_t GetHighestEquivalentValue(std::int64_t value) const {
+            auto bucket_index     = GetBucketIndex(value);
+            auto sub_bucket_index = value >> (bucket_index + unitMagnitude);
+            auto lowest_value     = sub_bucket_index << (bucket_index + unitMagnitude);
+            auto range            = std::int64_t(1) << (unitMagnitude + (sub_bucket_index >= subBucketCount ? bucket_index + 1 : bucket_index));
+            return lowest_value + range - 1;
+        }
+
+        std::int64_t               lowest;
+        std::int64_t               highest;
+        int                        significantFigures;
+        int                        unitMagnitude               = 0;
+        int                        subBucketHalfCountMagnitude = 0;
+        std::int64_t               subBucketCount              = 0;
+        std::int64_t               subBucketHalfCount          = 0;
+        std::int64_t               subBucketMask               = 0;
+
+        std::vector<std::uint64_t> counts;
+        std::uint64_t              totalCount = 0;
+        std::int64_t               sum        = 0;
+        std::int64_t               minValue   = (std::numeric_limits<std::int64_t>::max)();
+        std::int64_t               maxValue   = 0;
+
+    };
+};
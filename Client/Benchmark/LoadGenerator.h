@@ -0,0 +1,411 @@
+﻿#pragma once
+
+#include "HdrHistogram.h"
+#include "OrsApiServer.h"
+#include "UserData.h"
+
+namespace ors_benchmark
+{
+    using ordered_json = nlohmann::ordered_json;
+
+    enum class Operation {
+        SUBMIT,
+        MY_RANK,
+        TOP,
+    };
+
+    constexpr std::size_t                                   OPERATION_COUNT = 3;
+    constexpr std::array<std::string_view, OPERATION_COUNT> OPERATION_NAMES = { "submit", "my_rank", "top" };
+
+    // scores of the simulated users are drawn from [0, MAX_SCORE]
+    constexpr int MAX_SCORE = 1'000'000;
+
+    // settings of a run, parsed from --key=value arguments
+    struct Options
+    {
+        // HTTP url of the server, empty starts a server on loopback
+        std::string                           url;
+        // binary protocol url, empty uses HTTP. "loopback" serves it from the loopback server
+        std::string                           binaryUrl;
+        // ports of the loopback server
+        socket_helper::PORT                   port          = 5077;
+        socket_helper::PORT                   binaryPort    = 5078;
+        std::size_t                           serverWorkers = 0;
+        // UserData objects, split evenly between the client threads
+        std::size_t                           users         = 1000;
+        std::size_t                           clients       = 8;
+        // requests per second over all clients (open loop), 0 sends the next request as soon as the last
+        // one is answered (closed loop)
+        double                                rate          = 0.0;
+        // seconds measured after the warm-up seconds
+        double                                duration      = 10.0;
+        double                                warmup        = 2.0;
+        // relative weights of submit, my_rank and top
+        std::array<double, OPERATION_COUNT>   mix           = { 1.0, 8.0, 1.0 };
+        int                                   topLimit      = 10;
+        std::uint64_t                         seed          = 1;
+        // the report is written there as JSON
+        std::string                           output        = "benchmark.json";
+
+        static constexpr char USAGE[] =
+            "usage: ors-api-benchmark [--url=host:port] [--binary-url=host:port|loopback] [--port=5077] [--binary-port=5078]\n"
+            "                         [--server-workers=0] [--users=1000] [--clients=8] [--rate=0] [--duration=10] [--warmup=2]\n"
+            "                         [--mix=submit:my_rank:top] [--top-limit=10] [--seed=1] [--output=benchmark.json]";
+
+        static Options Parse(int argc, char* argv[]) {
+            Options options;
+            for (int i = 1; i < argc; ++i) {
+                std::string_view arg = argv[i];
+                auto separator = arg.find('=');
+                if (!arg.starts_with("--") || separator == std::string_view::npos) {
+                    assert::ExceptionThrow(std::format("Invalid argument: {}", arg));
+                }
+                auto key   = arg.substr(2, separator - 2);
+                auto value = arg.substr(separator + 1);
+
+                if      (key == "url")            { options.url           = value; }
+                else if (key == "binary-url")     { options.binaryUrl     = value; }
+                else if (key == "port")           { options.port          = ParseNumber<socket_helper::PORT>(key, value); }
+                else if (key == "binary-port")    { options.binaryPort    = ParseNumber<socket_helper::PORT>(key, value); }
+                else if (key == "server-workers") { options.serverWorkers = ParseNumber<std::size_t>(key, value); }
+                else if (key == "users")          { options.users         = ParseNumber<std::size_t>(key, value); }
+                else if (key == "clients")        { options.clients       = ParseNumber<std::size_t>(key, value); }
+                else if (key == "rate")           { options.rate          = ParseNumber<double>(key, value); }
+                else if (key == "duration")       { options.duration      = ParseNumber<double>(key, value); }
+                else if (key == "warmup")         { options.warmup        = ParseNumber<double>(key, value); }
+                else if (key == "top-limit")      { options.topLimit      = ParseNumber<int>(key, value); }
+                else if (key == "seed")           { options.seed          = ParseNumber<std::uint64_t>(key, value); }
+                else if (key == "output")         { options.output        = value; }
+                else if (key == "mix") {
+                    for (std::size_t j = 0; j < OPERATION_COUNT; ++j) {
+                        auto end = j + 1 < OPERATION_COUNT ? value.find(':') : value.size();
+                        if (end == std::string_view::npos) {
+                            assert::ExceptionThrow(std::format("Invalid mix: {}", arg));
+                        }
+                        options.mix[j] = ParseNumber<double>(key, value.substr(0, end));
+                        value.remove_prefix(j + 1 < OPERATION_COUNT ? end + 1 : end);
+                    }
+                }
+                else {
+                    assert::ExceptionThrow(std::format("Unknown option: {}", arg));
+                }
+            }
+
+            if (options.clients == 0 || options.users < options.clients) {
+                assert::ExceptionThrow("At least one user per client is needed");
+            }
+            if (options.rate < 0.0 || options.duration <= 0.0 || options.warmup < 0.0) {
+                assert::ExceptionThrow("Rate and times must not be negative");
+            }
+            if (std::any_of(options.mix.begin(), options.mix.end(), [](double weight) { return weight < 0.0; })
+                || std::all_of(options.mix.begin(), options.mix.end(), [](double weight) { return weight == 0.0; })) {
+                assert::ExceptionThrow("The mix needs a positive weight");
+            }
+            return options;
+        }
+
+        ordered_json ToJson() const {
+            ordered_json config;
+            config["url"]        = url;
+            config["binary_url"] = binaryUrl;
+            config["users"]      = users;
+            config["clients"]    = clients;
+            config["loop"]       = rate > 0.0 ? "open" : "closed";
+            config["rate"]       = rate;
+            config["duration_s"] = duration;
+            config["warmup_s"]   = warmup;
+            for (std::size_t i = 0; i < OPERATION_COUNT; ++i) {
+                config["mix"][OPERATION_NAMES[i]] = mix[i];
+            }
+            config["top_limit"]  = topLimit;
+            config["seed"]       = seed;
+            return config;
+        }
+
+    private:
+
+        template<class T>
+        static T ParseNumber(std::string_view key, std::string_view value) {
+            T number{};
+            auto [ptr, ec] = std::from_chars(value.data(), value.data() + value.size(), number);
+            if (ec != std::errc() || ptr != value.data() + value.size()) {
+                assert::ExceptionThrow(std::format("Invalid value of {}: {}", key, value));
+            }
+            return number;
+        }
+    };
+
+    // OrsApiServer with an in-memory ranking on 127.0.0.1, so that a run needs no network
+    class LoopbackServer
+    {
+    public:
+
+        static constexpr char HOST[] = "127.0.0.1";
+
+        LoopbackServer(socket_helper::PORT port, socket_helper::PORT binary_port, std::size_t worker_count)
+            : server(&ranking, nullptr, HOST, port, worker_count, binary_port)
+            , url(std::format("{}:{}", HOST, port))
+            , binaryUrl(std::format("{}:{}", HOST, binary_port))
+        {
+            serverThread = std::thread([this] {
+                try {
+                    server.Start();
+                }
+                catch (const std::exception& e) {
+                    assert::ShowError(ASSERT_FILE_LINE, e.what());
+                    failed = true;
+                }
+            });
+        }
+
+        LoopbackServer(const LoopbackServer&) = delete;
+        LoopbackServer& operator=(const LoopbackServer&) = delete;
+
+        ~LoopbackServer() {
+            server.Stop();
+            serverThread.join();
+        }
+
+        // wait until the server answers, returns false if it failed to start
+        bool WaitUntilReady(std::chrono::milliseconds time_out = std::chrono::milliseconds(10000)) const {
+            auto deadline = std::chrono::steady_clock::now() + time_out;
+            json params;
+            params["limit"] = "1";
+            while (!failed.load() && std::chrono::steady_clock::now() < deadline) {
+                if (!ors_api_client::Request(url, ors_api_client::Method::GET, params).is_null()) {
+                    return true;
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+            return false;
+        }
+
+        const std::string& GetUrl() const {
+            return url;
+        }
+
+        const std::string& GetBinaryUrl() const {
+            return binaryUrl;
+        }
+
+    private:
+
+        ors_api_server::ShardedRanking ranking;
+        ors_api_server::OrsApiServer   server;
+        std::string                    url;
+        std::string                    binaryUrl;
+        std::thread                    serverThread;
+        std::atomic<bool>              failed = false;
+
+    };
+
+    // simulates a population of UserData clients and measures the latency of every request
+    //
+    // each client thread owns a slice of the users and sends one request at a time, the operation and the
+    // user are drawn at random with the weights of the mix. In a closed loop a client sends the next request
+    // when the last one is answered. In an open loop requests arrive as a Poisson process at the rate, and
+    // the latency counts from the time a request was due rather than sent: a stalled server delays every
+    // request behind it, which a closed loop would hide (coordinated omission)
+    class LoadGenerator
+    {
+    public:
+
+        explicit LoadGenerator(Options options)
+            : options(std::move(options))
+        {}
+
+        // upload a score of every user, run the warm-up and the measurement and return the report
+        ordered_json Run() {
+            UserData::UseUrl(options.url);
+            if (!options.binaryUrl.empty()) {
+                UserData::UseBinaryProtocol(options.binaryUrl);
+            }
+
+            std::mt19937_64 random(options.seed);
+            std::uniform_int_distribution<int> pick_score(0, MAX_SCORE);
+            users.clear();
+            users.reserve(options.users);
+            for (std::size_t i = 0; i < options.users; ++i) {
+                users.emplace_back(std::format("user{}", i), pick_score(random));
+            }
+
+            // every user is ranked before the measurement, so that my_rank finds its entry
+            RunClients([this](std::size_t client, ClientResult*) {
+                auto [first, last] = GetUserRange(client);
+                for (auto i = first; i < last; ++i) {
+                    users[i].UploadScore();
+                }
+            });
+
+            auto stats         = UserData::GetStats();
+            auto start         = std::chrono::steady_clock::now();
+            auto measure_start = start + ToDuration(options.warmup);
+            auto end           = measure_start + ToDuration(options.duration);
+            auto results = RunClients([&](std::size_t client, ClientResult* result) {
+                RunClient(client, start, measure_start, end, result);
+            });
+
+            return MakeReport(results, UserData::GetStats().Since(stats));
+        }
+
+    private:
+
+        using Clock = std::chrono::steady_clock;
+
+        struct ClientResult
+        {
+            std::array<HdrHistogram, OPERATION_COUNT>  latencies;
+            std::array<std::uint64_t, OPERATION_COUNT> errors{};
+        };
+
+        // run function(client, result) on one thread per client
+        template<class Function>
+        std::vector<ClientResult> RunClients(Function&& function) {
+            std::vector<ClientResult> results(options.clients);
+            std::vector<std::thread> threads;
+            for (std::size_t i = 0; i < options.clients; ++i) {
+                threads.emplace_back([&, i] {
+                    function(i, &results[i]);
+                });
+            }
+            for (auto& thread : threads) {
+                thread.join();
+            }
+            return results;
+        }
+
+        void RunClient(std::size_t client, Clock::time_point start, Clock::time_point measure_start, Clock::time_point end, ClientResult* result) {
+            std::mt19937_64 random(options.seed + client + 1);
+            std::discrete_distribution<int> pick_operation(options.mix.begin(), options.mix.end());
+            auto [first, last] = GetUserRange(client);
+            std::uniform_int_distribution<std::size_t> pick_user(first, last - 1);
+            std::uniform_int_distribution<int> pick_score(0, MAX_SCORE);
+            std::exponential_distribution<double> pick_interval(options.rate / static_cast<double>(options.clients));
+            bool open_loop = options.rate > 0.0;
+            // rankings are decoded into the same entries every time
+            std::vector<ors_api_client::RankingEntry> entries;
+
+            auto scheduled = start;
+            while (true) {
+                if (open_loop) {
+                    scheduled += std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(pick_interval(random)));
+                    if (scheduled >= end) {
+                        break;
+                    }
+                    std::this_thread::sleep_until(scheduled);
+                }
+                else {
+                    scheduled = Clock::now();
+                    if (scheduled >= end) {
+                        break;
+                    }
+                }
+
+                auto operation = static_cast<Operation>(pick_operation(random));
+                auto& user     = users[pick_user(random)];
+                bool succeeded = Execute(operation, &user, pick_score(random), &entries);
+                auto latency   = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - scheduled);
+
+                if (scheduled < measure_start) {
+                    continue;
+                }
+                auto index = static_cast<std::size_t>(operation);
+                if (succeeded) {
+                    result->latencies[index].Record(latency.count());
+                }
+                else {
+                    ++result->errors[index];
+                }
+            }
+        }
+
+        // returns false if the score was not accepted or the ranking was not received
+        bool Execute(Operation operation, UserData* user, int score, std::vector<ors_api_client::RankingEntry>* entries) {
+            try {
+                switch (operation) {
+                case Operation::SUBMIT:
+                    user->UpdateScore(score);
+                    return user->UploadScore();
+                case Operation::MY_RANK:
+                    return user->GetMyRanking(entries);
+                case Operation::TOP:
+                    return user->GetTopRanking(options.topLimit, entries);
+                }
+            }
+            catch (const std::exception&) {
+            }
+            return false;
+        }
+
+        ordered_json MakeReport(const std::vector<ClientResult>& results, const ors_api_client::Metrics::Snapshot& stats) const {
+            ordered_json report;
+            report["config"]     = options.ToJson();
+            report["duration_s"] = options.duration;
+
+            std::uint64_t requests = 0;
+            std::uint64_t errors   = 0;
+            ordered_json operations;
+            for (std::size_t i = 0; i < OPERATION_COUNT; ++i) {
+                HdrHistogram latencies;
+                std::uint64_t operation_errors = 0;
+                for (const auto& result : results) {
+                    latencies.Merge(result.latencies[i]);
+                    operation_errors += result.errors[i];
+                }
+                requests += latencies.GetTotalCount() + operation_errors;
+                errors   += operation_errors;
+
+                auto& value = operations[OPERATION_NAMES[i]];
+                value["count"]          = latencies.GetTotalCount();
+                value["errors"]         = operation_errors;
+                value["throughput_rps"] = static_cast<double>(latencies.GetTotalCount()) / options.duration;
+                auto& latency = value["latency_us"];
+                latency["min"]  = latencies.GetMin();
+                latency["mean"] = latencies.GetMean();
+                latency["p50"]  = latencies.GetValueAtPercentile(50.0);
+                latency["p90"]  = latencies.GetValueAtPercentile(90.0);
+                latency["p99"]  = latencies.GetValueAtPercentile(99.0);
+                latency["p999"] = latencies.GetValueAtPercentile(99.9);
+                latency["max"]  = latencies.GetMax();
+                // [lowest, highest, count] of every bucket, enough to merge runs or plot the distribution
+                value["histogram_us"] = ordered_json::array();
+                latencies.ForEachBucket([&](std::int64_t lowest, std::int64_t highest, std::uint64_t count) {
+                    value["histogram_us"].push_back({ lowest, highest, count });
+                });
+            }
+
+            report["requests"]       = requests;
+            report["errors"]         = errors;
+            report["throughput_rps"] = static_cast<double>(requests - errors) / options.duration;
+            report["operations"]     = std::move(operations);
+
+            // where the time of the requests went, warm-up included: the client stages of UserData::GetStats
+            auto& client_stats = report["client_stats"];
+            for (std::size_t i = 0; i < ors_api_client::COUNTER_NAMES.size(); ++i) {
+                client_stats["counters"][ors_api_client::COUNTER_NAMES[i]] = stats.counters[i];
+            }
+            for (std::size_t i = 0; i < ors_api_client::STAGE_NAMES.size(); ++i) {
+                const auto& stage = stats.stages[i];
+                auto& value = client_stats["stages_us"][ors_api_client::STAGE_NAMES[i]];
+                value["count"] = stage.count;
+                value["mean"]  = stage.GetMeanUs();
+                value["p50"]   = stage.GetPercentileUs(50.0);
+                value["p99"]   = stage.GetPercentileUs(99.0);
+                value["max"]   = stage.maxUs;
+            }
+            return report;
+        }
+
+        std::pair<std::size_t, std::size_t> GetUserRange(std::size_t client) const {
+            return { client * options.users / options.clients, (client + 1) * options.users / options.clients };
+        }
+
+        static Clock::duration ToDuration(double seconds) {
+            return std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(seconds));
+        }
+
+        Options               options;
+        std::vector<UserData> users;
+
+    };
+};
@@ -0,0 +1,60 @@
+﻿#include "LoadGenerator.h"
+
+int main(int argc, char* argv[])
+{
+    // --key=value 形式の引数から設定を読み込む
+    ors_benchmark::Options options;
+    try {
+        options = ors_benchmark::Options::Parse(argc, argv);
+    }
+    catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl << ors_benchmark::Options::USAGE << std::endl;
+        return 1;
+    }
+
+    // URLの指定がなければループバックでサーバーを起動し、オフラインで計測する
+    std::unique_ptr<ors_benchmark::LoopbackServer> server;
+    if (options.url.empty() || options.binaryUrl == "loopback") {
+        server = std::make_unique<ors_benchmark::LoopbackServer>(options.port, options.binaryPort, options.serverWorkers);
+        if (!server->WaitUntilReady()) {
+            std::cerr << "Cannot start the loopback server" << std::endl;
+            return 1;
+        }
+        if (options.url.empty()) {
+            options.url = server->GetUrl();
+        }
+        if (options.binaryUrl == "loopback") {
+            options.binaryUrl = server->GetBinaryUrl();
+        }
+    }
+
+    // 計測する
+    ors_benchmark::LoadGenerator generator(options);
+    auto report = generator.Run();
+
+    // 結果を表示し、JSONで書き出す
+    std::cout << std::format("{:<8} {:>10} {:>8} {:>12} {:>10} {:>10} {:>10} {:>10}",
+        "op", "count", "errors", "rps", "p50(us)", "p99(us)", "p999(us)", "max(us)") << std::endl;
+    for (const auto& [name, value] : report["operations"].items()) {
+        const auto& latency = value["latency_us"];
+        std::cout << std::format("{:<8} {:>10} {:>8} {:>12.1f} {:>10} {:>10} {:>10} {:>10}",
+            name, value["count"].get<std::uint64_t>(), value["errors"].get<std::uint64_t>(), value["throughput_rps"].get<double>(),
+            latency["p50"].get<std::int64_t>(), latency["p99"].get<std::int64_t>(), latency["p999"].get<std::int64_t>(), latency["max"].get<std::int64_t>()) << std::endl;
+    }
+    std::cout << std::format("total {} requests, {} errors, {:.1f} requests/s", report["requests"].get<std::uint64_t>(), report["errors"].get<std::uint64_t>(), report["throughput_rps"].get<double>()) << std::endl;
+
+    // クライアント側の段階別レイテンシ（バケットの上限で丸めた値）
+    std::cout << std::format("{:<12} {:>10} {:>10} {:>10} {:>10}", "stage", "count", "mean(us)", "p50(us)", "p99(us)") << std::endl;
+    for (const auto& [name, value] : report["client_stats"]["stages_us"].items()) {
+        std::cout << std::format("{:<12} {:>10} {:>10.1f} {:>10} {:>10}",
+            name, value["count"].get<std::uint64_t>(), value["mean"].get<double>(), value["p50"].get<std::uint64_t>(), value["p99"].get<std::uint64_t>()) << std::endl;
+    }
+
+    std::ofstream ofs(options.output);
+    ofs << report.dump(4) << std::endl;
+    if (!ofs) {
+        std::cerr << std::format("Cannot write {}", options.output) << std::endl;
+        return 1;
+    }
+    std::cout << std::format("Report written to {}", options.output) << std::endl;
+}
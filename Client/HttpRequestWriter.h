@@ -0,0 +1,193 @@
+﻿#pragma once
+
+namespace ors_api_client
+{
+    enum class Method {
+        GET,
+        POST,
+    };
+
+    // HTTP/1.1 request messages written straight into buffers of the caller
+    // nothing is built in temporaries: the query string is percent-encoded and the JSON body serialized in place,
+    // so with buffers that keep their capacity (the ones of a pooled connection) a request allocates nothing
+
+    // str percent-encoded for a query string, the unreserved characters of RFC 3986 are kept as they are
+    inline void AppendUrlEncoded(std::string_view str, std::string* out) {
+        static constexpr char DIGITS[] = "0123456789ABCDEF";
+        for (char c : str) {
+            if (('a' <= c && c <= 'z') || ('A' <= c && c <= 'Z') || ('0' <= c && c <= '9') || c == '-' || c == '_' || c == '.' || c == '~') {
+                *out += c;
+                continue;
+            }
+            auto byte = static_cast<unsigned char>(c);
+            *out += '%';
+            *out += DIGITS[byte >> 4];
+            *out += DIGITS[byte & 0x0F];
+        }
+    }
+
+    template<class Integer>
+    inline void AppendInteger(Integer value, std::string* out) {
+        char buffer[24];
+        auto [ptr, ec] = std::to_chars(buffer, buffer + sizeof(buffer), value);
+        out->append(buffer, ptr);
+    }
+
+    // str as a JSON string literal, escaped the way json::dump does
+    inline void AppendJsonString(std::string_view str, std::string* out) {
+        static constexpr char DIGITS[] = "0123456789abcdef";
+        *out += '"';
+        // runs of characters that need no escaping are appended at once
+        std::size_t begin = 0;
+        for (std::size_t i = 0; i < str.size(); ++i) {
+            auto c = static_cast<unsigned char>(str[i]);
+            if (c >= 0x20 && c != '"' && c != '\\') {
+                continue;
+            }
+            out->append(str.data() + begin, i - begin);
+            begin = i + 1;
+            switch (c) {
+            case '"':  *out += "\\\""; break;
+            case '\\': *out += "\\\\"; break;
+            case '\b': *out += "\\b";  break;
+            case '\f': *out += "\\f";  break;
+            case '\n': *out += "\\n";  break;
+            case '\r': *out += "\\r";  break;
+            case '\t': *out += "\\t";  break;
+            default:
+                *out += "\\u00";
+                *out += DIGITS[c >> 4];
+                *out += DIGITS[c & 0x0F];
+                break;
+            }
+        }
+        out->append(str.data() + begin, str.size() - begin);
+        *out += '"';
+    }
+
+    // value.dump() appended to out without the temporary string
+    // floats are written in their shortest round-trip form, large ones may be in another notation than dump uses
+    inline void AppendJson(const json& value, std::string* out) {
+        switch (value.type()) {
+        case json::value_t::object: {
+            *out += '{';
+            bool first = true;
+            for (const auto& [key, member] : value.items()) {
+                if (!first) {
+                    *out += ',';
+                }
+                first = false;
+                AppendJsonString(key, out);
+                *out += ':';
+                AppendJson(member, out);
+            }
+            *out += '}';
+            break;
+        }
+        case json::value_t::array: {
+            *out += '[';
+            for (std::size_t i = 0; i < value.size(); ++i) {
+                if (i) {
+                    *out += ',';
+                }
+                AppendJson(value[i], out);
+            }
+            *out += ']';
+            break;
+        }
+        case json::value_t::string:
+            AppendJsonString(value.get_ref<const json::string_t&>(), out);
+            break;
+        case json::value_t::boolean:
+            *out += value.get<bool>() ? "true" : "false";
+            break;
+        case json::value_t::number_integer:
+            AppendInteger(value.get<std::int64_t>(), out);
+            break;
+        case json::value_t::number_unsigned:
+            AppendInteger(value.get<std::uint64_t>(), out);
+            break;
+        case json::value_t::number_float: {
+            auto number = value.get<double>();
+            // dump writes the numbers JSON cannot represent as null and keeps a fraction on integral values
+            if (!std::isfinite(number)) {
+                *out += "null";
+                break;
+            }
+            auto begin = out->size();
+            char buffer[32];
+            auto [ptr, ec] = std::to_chars(buffer, buffer + sizeof(buffer), number);
+            out->append(buffer, ptr);
+            if (out->find_first_of(".e", begin) == std::string::npos) {
+                *out += ".0";
+            }
+            break;
+        }
+        default:
+            // null and discarded values
+            *out += "null";
+            break;
+        }
+    }
+
+    // the request line and the header fields of a request to host:port, up to the Content-Length value of a POST
+    inline void AppendRequestHead(std::string_view host, socket_helper::PORT port, std::string_view path, Method method, const json& params, std::string* out) {
+        if (method == Method::GET) {
+            *out += "GET ";
+            *out += path;
+            // query string, the values are strings
+            if (params.size()) {
+                char separator = '?';
+                for (const auto& [key, value] : params.items()) {
+                    *out += separator;
+                    AppendUrlEncoded(key, out);
+                    *out += '=';
+                    AppendUrlEncoded(value.get_ref<const json::string_t&>(), out);
+                    separator = '&';
+                }
+            }
+        }
+        else {
+            *out += "POST ";
+            *out += path;
+        }
+        *out += " HTTP/1.1\r\nHost: ";
+        *out += host;
+        *out += ':';
+        AppendInteger(port, out);
+        *out += "\r\nConnection: keep-alive\r\n";
+        if (method != Method::GET) {
+            *out += "Content-Type: application/json\r\nContent-Length: ";
+        }
+    }
+
+    // append the request line and the header fields to out and write the body into body (empty for a GET)
+    // the two are meant for one scatter send (socket_helper::SendV), the body is never copied behind the header
+    inline void WriteHttpRequest(std::string_view host, socket_helper::PORT port, std::string_view path, Method method, const json& params, std::string* out, std::string* body) {
+        body->clear();
+        AppendRequestHead(host, port, path, method, params, out);
+        if (method != Method::GET) {
+            AppendJson(params, body);
+            AppendInteger(body->size(), out);
+            *out += "\r\n";
+        }
+        *out += "\r\n";
+    }
+
+    // append the whole request message to out, e.g. for requests that are sent together
+    inline void AppendHttpRequest(std::string_view host, socket_helper::PORT port, std::string_view path, Method method, const json& params, std::string* out) {
+        AppendRequestHead(host, port, path, method, params, out);
+        if (method == Method::GET) {
+            *out += "\r\n";
+            return;
+        }
+        // the body goes right behind the header, its size is put in front of it afterwards (a move within the buffer)
+        auto length_pos = out->size();
+        *out += "\r\n\r\n";
+        auto body_pos = out->size();
+        AppendJson(params, out);
+        char buffer[24];
+        auto [ptr, ec] = std::to_chars(buffer, buffer + sizeof(buffer), out->size() - body_pos);
+        out->insert(length_pos, buffer, static_cast<std::size_t>(ptr - buffer));
+    }
+};
@@ -0,0 +1,315 @@
+﻿#pragma once
+
+#include "SimdScan.h"
+
+namespace ors_api_client
+{
+    // incremental HTTP/1.1 response parser
+    // every received byte is looked at once, line ends are found with vectorized scans (SimdScan.h) and lines
+    // that arrived whole are parsed in place. The message body is accumulated into a buffer
+    // that is kept between responses so that a pooled connection does not reallocate it
+    class HttpResponseParser
+    {
+    public:
+
+        enum class State {
+            STATUS_LINE,
+            HEADER_FIELDS,
+            BODY_CONTENT_LENGTH,
+            BODY_UNTIL_CLOSE,
+            CHUNK_SIZE,
+            CHUNK_DATA,
+            CHUNK_DATA_CRLF,
+            TRAILER_FIELDS,
+            COMPLETE,
+            BAD_MESSAGE,
+        };
+
+        // maximum length of the status line, a header field or a chunk size line
+        static constexpr std::size_t MAX_LINE_LENGTH = 8192;
+        // Content-Length is not trusted for more than this up front, a larger body grows as its bytes arrive
+        static constexpr std::size_t MAX_RESERVE     = 1024 * 1024;
+
+        // prepare for the next response, buffers keep their capacity
+        void Reset() {
+            state               = State::STATUS_LINE;
+            line.clear();
+            headerFields.clear();
+            body.clear();
+            statusCode          = 0;
+            minorVersion        = 1;
+            remaining           = 0;
+            connectionClose     = false;
+            connectionKeepAlive = false;
+        }
+
+        // consume received bytes, returns the number of bytes used
+        // bytes after a complete response are not consumed, they belong to the next response
+        std::size_t Feed(std::string_view data) {
+            std::size_t pos = 0;
+            while (pos < data.size() && state != State::COMPLETE && state != State::BAD_MESSAGE) {
+                switch (state) {
+                case State::BODY_CONTENT_LENGTH:
+                case State::CHUNK_DATA:
+                {
+                    std::size_t n = (std::min)(remaining, data.size() - pos);
+                    body.append(data.data() + pos, n);
+                    pos       += n;
+                    remaining -= n;
+                    if (!remaining) {
+                        state = state == State::CHUNK_DATA ? State::CHUNK_DATA_CRLF : State::COMPLETE;
+                    }
+                    break;
+                }
+                case State::BODY_UNTIL_CLOSE:
+                    body.append(data.data() + pos, data.size() - pos);
+                    pos = data.size();
+                    break;
+                default:
+                {
+                    // line based states, collect bytes up to LF
+                    auto lf = FindByte(data, pos, '\n');
+                    std::size_t end = lf == std::string_view::npos ? data.size() : lf;
+                    // the whole line is in data, no need to copy it
+                    if (lf != std::string_view::npos && line.empty() && end - pos <= MAX_LINE_LENGTH) {
+                        auto text = data.substr(pos, end - pos);
+                        pos = lf + 1;
+                        if (!text.empty() && text.back() == '\r') {
+                            text.remove_suffix(1);
+                        }
+                        OnLine(text);
+                        break;
+                    }
+                    if (line.size() + (end - pos) > MAX_LINE_LENGTH) {
+                        state = State::BAD_MESSAGE;
+                        break;
+                    }
+                    line.append(data.data() + pos, end - pos);
+                    pos = end;
+                    if (lf == std::string_view::npos) {
+                        break;
+                    }
+                    // skip LF
+                    ++pos;
+                    if (!line.empty() && line.back() == '\r') {
+                        line.pop_back();
+                    }
+                    OnLine(line);
+                    line.clear();
+                    break;
+                }
+                }
+            }
+            return pos;
+        }
+
+        // notify that the server closed the connection
+        // completes a body that is delimited by the end of the connection
+        void FeedEof() {
+            if (state == State::BODY_UNTIL_CLOSE) {
+                state = State::COMPLETE;
+            }
+            else if (state != State::COMPLETE) {
+                state = State::BAD_MESSAGE;
+            }
+        }
+
+        bool IsComplete() const {
+            return state == State::COMPLETE;
+        }
+
+        bool HasError() const {
+            return state == State::BAD_MESSAGE;
+        }
+
+        // true while no byte of the response has been consumed
+        bool IsEmpty() const {
+            return state == State::STATUS_LINE && line.empty();
+        }
+
+        int GetStatusCode() const {
+            return statusCode;
+        }
+
+        // header field value, names are compared case-insensitively
+        std::string_view GetHeaderField(std::string_view name) const {
+            for (const auto& [key, value] : headerFields) {
+                if (EqualsIgnoreCase(key, name)) {
+                    return value;
+                }
+            }
+            return std::string_view();
+        }
+
+        const std::string& GetMessageBody() const {
+            return body;
+        }
+
+        // whether the connection can carry the next request after this response
+        bool IsKeepAlive() const {
+            if (state != State::COMPLETE || connectionClose) {
+                return false;
+            }
+            // HTTP/1.1 defaults to persistent connections, HTTP/1.0 has to ask for it
+            return minorVersion >= 1 || connectionKeepAlive;
+        }
+
+    private:
+
+        static char ToLower(char c) {
+            return ('A' <= c && c <= 'Z') ? static_cast<char>(c - 'A' + 'a') : c;
+        }
+
+        static bool EqualsIgnoreCase(std::string_view lhs, std::string_view rhs) {
+            if (lhs.size() != rhs.size()) {
+                return false;
+            }
+            for (std::size_t i = 0; i < lhs.size(); ++i) {
+                if (ToLower(lhs[i]) != ToLower(rhs[i])) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        static bool ContainsTokenIgnoreCase(std::string_view value, std::string_view token) {
+            // comma separated list, e.g. "keep-alive, Upgrade"
+            while (!value.empty()) {
+                auto comma = value.find(',');
+                auto item  = value.substr(0, comma);
+                while (!item.empty() && (item.front() == ' ' || item.front() == '\t')) item.remove_prefix(1);
+                while (!item.empty() && (item.back()  == ' ' || item.back()  == '\t')) item.remove_suffix(1);
+                if (EqualsIgnoreCase(item, token)) {
+                    return true;
+                }
+                if (comma == std::string_view::npos) {
+                    break;
+                }
+                value.remove_prefix(comma + 1);
+            }
+            return false;
+        }
+
+        void OnLine(std::string_view text) {
+            switch (state) {
+            case State::STATUS_LINE:
+                OnStatusLine(text);
+                break;
+            case State::HEADER_FIELDS:
+                if (text.empty()) {
+                    OnHeaderFieldsEnd();
+                }
+                else {
+                    OnHeaderField(text);
+                }
+                break;
+            case State::CHUNK_SIZE:
+                OnChunkSize(text);
+                break;
+            case State::CHUNK_DATA_CRLF:
+                state = text.empty() ? State::CHUNK_SIZE : State::BAD_MESSAGE;
+                break;
+            case State::TRAILER_FIELDS:
+                // trailer fields are not used, wait for the empty line
+                if (text.empty()) {
+                    state = State::COMPLETE;
+                }
+                break;
+            default:
+                break;
+            }
+        }
+
+        void OnStatusLine(std::string_view status_line) {
+            // HTTP/1.x SP status-code SP reason-phrase
+            if (status_line.size() < 12 || !status_line.starts_with("HTTP/1.") || status_line[8] != ' ') {
+                state = State::BAD_MESSAGE;
+                return;
+            }
+            minorVersion = status_line[7] - '0';
+            auto [ptr, ec] = std::from_chars(status_line.data() + 9, status_line.data() + 12, statusCode);
+            if (ec != std::errc() || ptr != status_line.data() + 12) {
+                state = State::BAD_MESSAGE;
+                return;
+            }
+            state = State::HEADER_FIELDS;
+        }
+
+        void OnHeaderField(std::string_view field) {
+            auto colon = field.find(':');
+            if (colon == std::string_view::npos || colon == 0) {
+                state = State::BAD_MESSAGE;
+                return;
+            }
+            auto value = field.substr(colon + 1);
+            while (!value.empty() && (value.front() == ' ' || value.front() == '\t')) value.remove_prefix(1);
+            while (!value.empty() && (value.back()  == ' ' || value.back()  == '\t')) value.remove_suffix(1);
+            headerFields.emplace_back(field.substr(0, colon), value);
+        }
+
+        void OnHeaderFieldsEnd() {
+            // 1xx is an interim response, the final response follows
+            if (100 <= statusCode && statusCode < 200) {
+                headerFields.clear();
+                state = State::STATUS_LINE;
+                return;
+            }
+
+            auto connection = GetHeaderField("Connection");
+            connectionClose     = ContainsTokenIgnoreCase(connection, "close");
+            connectionKeepAlive = ContainsTokenIgnoreCase(connection, "keep-alive");
+
+            // 204 and 304 never have a message body
+            if (statusCode == 204 || statusCode == 304) {
+                state = State::COMPLETE;
+                return;
+            }
+
+            if (ContainsTokenIgnoreCase(GetHeaderField("Transfer-Encoding"), "chunked")) {
+                state = State::CHUNK_SIZE;
+                return;
+            }
+
+            if (auto content_length = GetHeaderField("Content-Length"); !content_length.empty()) {
+                auto [ptr, ec] = std::from_chars(content_length.data(), content_length.data() + content_length.size(), remaining);
+                if (ec != std::errc() || ptr != content_length.data() + content_length.size()) {
+                    state = State::BAD_MESSAGE;
+                    return;
+                }
+                body.reserve((std::min)(remaining, MAX_RESERVE));
+                state = remaining ? State::BODY_CONTENT_LENGTH : State::COMPLETE;
+                return;
+            }
+
+            // no framing, the body ends with the connection
+            connectionClose = true;
+            state = State::BODY_UNTIL_CLOSE;
+        }
+
+        void OnChunkSize(std::string_view chunk_size) {
+            // chunk-size [ chunk-ext ]
+            if (auto ext = chunk_size.find(';'); ext != std::string_view::npos) {
+                chunk_size = chunk_size.substr(0, ext);
+            }
+            while (!chunk_size.empty() && (chunk_size.back() == ' ' || chunk_size.back() == '\t')) chunk_size.remove_suffix(1);
+            auto [ptr, ec] = std::from_chars(chunk_size.data(), chunk_size.data() + chunk_size.size(), remaining, 16);
+            if (chunk_size.empty() || ec != std::errc() || ptr != chunk_size.data() + chunk_size.size()) {
+                state = State::BAD_MESSAGE;
+                return;
+            }
+            // the last chunk is followed by optional trailer fields
+            state = remaining ? State::CHUNK_DATA : State::TRAILER_FIELDS;
+        }
+
+        State                                            state               = State::STATUS_LINE;
+        std::string                                      line;
+        std::vector<std::pair<std::string, std::string>> headerFields;
+        std::string                                      body;
+        int                                              statusCode          = 0;
+        int                                              minorVersion        = 1;
+        std::size_t                                      remaining           = 0;
+        bool                                             connectionClose     = false;
+        bool                                             connectionKeepAlive = false;
+
+    };
+};
@@ -0,0 +1,236 @@
+﻿#pragma once
+
+namespace ors_metrics
+{
+    // counters and latency histograms that many threads update without locks
+    //
+    // every thread that records gets a slot of its own in the registry, so an update is a load and a store of
+    // relaxed atomics in memory no other thread writes (no read-modify-write, no shared cache line). A snapshot
+    // sums the slots, it may miss the updates in flight but never reads a torn value. The slot of a thread that
+    // exits goes to the next thread that records, its values stay counted. Counters only grow, as Prometheus
+    // counters do: rates and the latencies of an interval are the difference of two snapshots
+
+    // upper bounds of the histogram buckets in microseconds, the last bucket has no bound (+Inf)
+    inline constexpr std::array<std::uint64_t, 16> LATENCY_BOUNDS_US = {
+        25, 50, 100, 250, 500, 1'000, 2'500, 5'000, 10'000, 25'000, 50'000, 100'000, 250'000, 500'000, 1'000'000, 5'000'000,
+    };
+    inline constexpr std::size_t BUCKET_COUNT = LATENCY_BOUNDS_US.size() + 1;
+
+    using Clock = std::chrono::steady_clock;
+
+    // latencies of one stage, counts per bucket (not cumulative)
+    struct HistogramSnapshot
+    {
+        std::array<std::uint64_t, BUCKET_COUNT> buckets{};
+        std::uint64_t                           count = 0;
+        std::uint64_t                           sumUs = 0;
+        std::uint64_t                           maxUs = 0;
+
+        double GetMeanUs() const {
+            return count ? static_cast<double>(sumUs) / static_cast<double>(count) : 0.0;
+        }
+
+        // upper bound of the bucket percentile percent of the values are in or below, the largest value for the
+        // last bucket. An upper estimate, off by at most the width of the bucket
+        std::uint64_t GetPercentileUs(double percentile) const {
+            if (count == 0) {
+                return 0;
+            }
+            auto target = (std::max)(std::uint64_t(1), static_cast<std::uint64_t>(std::ceil(std::clamp(percentile, 0.0, 100.0) / 100.0 * static_cast<double>(count))));
+            std::uint64_t total = 0;
+            for (std::size_t i = 0; i < LATENCY_BOUNDS_US.size(); ++i) {
+                total += buckets[i];
+                if (total >= target) {
+                    return (std::min)(LATENCY_BOUNDS_US[i], maxUs);
+                }
+            }
+            return maxUs;
+        }
+
+        // the values recorded after earlier, a snapshot of the same histogram. maxUs stays the largest value
+        // since the start, the one of the interval is not known
+        HistogramSnapshot Since(const HistogramSnapshot& earlier) const {
+            HistogramSnapshot interval = *this;
+            for (std::size_t i = 0; i < BUCKET_COUNT; ++i) {
+                interval.buckets[i] -= earlier.buckets[i];
+            }
+            interval.count -= earlier.count;
+            interval.sumUs -= earlier.sumUs;
+            return interval;
+        }
+    };
+
+    // Counter and Stage are enums whose last member is COUNT, a histogram is kept for every stage
+    template<class Counter, class Stage>
+    class Registry
+    {
+    public:
+
+        static constexpr std::size_t COUNTER_COUNT = static_cast<std::size_t>(Counter::COUNT);
+        static constexpr std::size_t STAGE_COUNT   = static_cast<std::size_t>(Stage::COUNT);
+
+        struct Snapshot
+        {
+            std::array<std::uint64_t, COUNTER_COUNT>     counters{};
+            std::array<HistogramSnapshot, STAGE_COUNT> stages{};
+
+            std::uint64_t Get(Counter counter) const {
+                return counters[static_cast<std::size_t>(counter)];
+            }
+
+            const HistogramSnapshot& Get(Stage stage) const {
+                return stages[static_cast<std::size_t>(stage)];
+            }
+
+            // the counts between earlier, a snapshot of the same registry, and this one
+            Snapshot Since(const Snapshot& earlier) const {
+                Snapshot interval;
+                for (std::size_t i = 0; i < COUNTER_COUNT; ++i) {
+                    interval.counters[i] = counters[i] - earlier.counters[i];
+                }
+                for (std::size_t i = 0; i < STAGE_COUNT; ++i) {
+                    interval.stages[i] = stages[i].Since(earlier.stages[i]);
+                }
+                return interval;
+            }
+        };
+
+        Registry() = default;
+        Registry(const Registry&) = delete;
+        Registry& operator=(const Registry&) = delete;
+
+        void Add(Counter counter, std::uint64_t value = 1) {
+            Increase(&GetSlot().counters[static_cast<std::size_t>(counter)], value);
+        }
+
+        void Record(Stage stage, Clock::duration elapsed) {
+            auto  us        = static_cast<std::uint64_t>((std::max)(std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count(), std::int64_t(0)));
+            auto& histogram = GetSlot().stages[static_cast<std::size_t>(stage)];
+            auto  bucket    = static_cast<std::size_t>(std::lower_bound(LATENCY_BOUNDS_US.begin(), LATENCY_BOUNDS_US.end(), us) - LATENCY_BOUNDS_US.begin());
+            Increase(&histogram.buckets[bucket], 1);
+            Increase(&histogram.count, 1);
+            Increase(&histogram.sumUs, us);
+            if (us > histogram.maxUs.load(std::memory_order_relaxed)) {
+                histogram.maxUs.store(us, std::memory_order_relaxed);
+            }
+        }
+
+        // record the time since start, returns now so that the next stage can start there
+        Clock::time_point Record(Stage stage, Clock::time_point start) {
+            auto now = Clock::now();
+            Record(stage, now - start);
+            return now;
+        }
+
+        Snapshot GetSnapshot() const {
+            Snapshot snapshot;
+            std::lock_guard lock(shared->mutex);
+            for (const auto& slot : shared->slots) {
+                for (std::size_t i = 0; i < COUNTER_COUNT; ++i) {
+                    snapshot.counters[i] += slot.counters[i].load(std::memory_order_relaxed);
+                }
+                for (std::size_t i = 0; i < STAGE_COUNT; ++i) {
+                    auto& stage = snapshot.stages[i];
+                    for (std::size_t k = 0; k < BUCKET_COUNT; ++k) {
+                        stage.buckets[k] += slot.stages[i].buckets[k].load(std::memory_order_relaxed);
+                    }
+                    stage.count += slot.stages[i].count.load(std::memory_order_relaxed);
+                    stage.sumUs += slot.stages[i].sumUs.load(std::memory_order_relaxed);
+                    stage.maxUs  = (std::max)(stage.maxUs, slot.stages[i].maxUs.load(std::memory_order_relaxed));
+                }
+            }
+            return snapshot;
+        }
+
+    private:
+
+        struct Histogram
+        {
+            std::array<std::atomic<std::uint64_t>, BUCKET_COUNT> buckets{};
+            std::atomic<std::uint64_t>                           count = 0;
+            std::atomic<std::uint64_t>                           sumUs = 0;
+            std::atomic<std::uint64_t>                           maxUs = 0;
+        };
+
+        // written by one thread at a time, on cache lines of its own
+        struct alignas(64) Slot
+        {
+            std::array<std::atomic<std::uint64_t>, COUNTER_COUNT> counters{};
+            std::array<Histogram, STAGE_COUNT>                    stages;
+        };
+
+        // slots of the registry, shared with the threads that hold one of them so that a thread can give its slot
+        // back when it exits after the registry was destroyed
+        struct Slots
+        {
+            std::mutex         mutex;
+            // a deque never moves its elements, threads keep pointers to them
+            std::deque<Slot>   slots;
+            std::vector<Slot*> freeSlots;
+        };
+
+        // the slots a thread holds in the registries it recorded in, given back when the thread exits
+        struct ThreadSlots
+        {
+            ~ThreadSlots() {
+                for (auto& [shared, slot] : held) {
+                    std::lock_guard lock(shared->mutex);
+                    shared->freeSlots.push_back(slot);
+                }
+            }
+
+            std::vector<std::pair<std::shared_ptr<Slots>, Slot*>> held;
+        };
+
+        // only the owner of the slot writes it
+        static void Increase(std::atomic<std::uint64_t>* value, std::uint64_t delta) {
+            value->store(value->load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+        }
+
+        Slot& GetSlot() {
+            thread_local ThreadSlots thread_slots;
+            for (const auto& [held, slot] : thread_slots.held) {
+                if (held == shared) {
+                    return *slot;
+                }
+            }
+            Slot* slot = nullptr;
+            {
+                std::lock_guard lock(shared->mutex);
+                if (shared->freeSlots.empty()) {
+                    slot = &shared->slots.emplace_back();
+                }
+                else {
+                    slot = shared->freeSlots.back();
+                    shared->freeSlots.pop_back();
+                }
+            }
+            thread_slots.held.emplace_back(shared, slot);
+            return *slot;
+        }
+
+        std::shared_ptr<Slots> shared = std::make_shared<Slots>();
+
+    };
+
+    // append snapshot in the Prometheus text format: a <prefix>_<counter>_total counter for every counter and
+    // the <prefix>_stage_seconds histogram with a stage label, names are the lowercase names of the enum members
+    template<class Snapshot>
+    inline void AppendPrometheus(const Snapshot& snapshot, std::string_view prefix, std::span<const std::string_view> counter_names, std::span<const std::string_view> stage_names, std::string* out) {
+        for (std::size_t i = 0; i < counter_names.size(); ++i) {
+            *out += std::format("# TYPE {0}_{1}_total counter\n{0}_{1}_total {2}\n", prefix, counter_names[i], snapshot.counters[i]);
+        }
+        *out += std::format("# TYPE {}_stage_seconds histogram\n", prefix);
+        for (std::size_t i = 0; i < stage_names.size(); ++i) {
+            const auto& stage = snapshot.stages[i];
+            std::uint64_t cumulative = 0;
+            for (std::size_t k = 0; k < BUCKET_COUNT; ++k) {
+                cumulative += stage.buckets[k];
+                auto le = k < LATENCY_BOUNDS_US.size() ? std::format("{}", static_cast<double>(LATENCY_BOUNDS_US[k]) / 1e6) : std::string("+Inf");
+                *out += std::format("{}_stage_seconds_bucket{{stage=\"{}\",le=\"{}\"}} {}\n", prefix, stage_names[i], le, cumulative);
+            }
+            *out += std::format("{}_stage_seconds_sum{{stage=\"{}\"}} {}\n", prefix, stage_names[i], static_cast<double>(stage.sumUs) / 1e6);
+            *out += std::format("{}_stage_seconds_count{{stage=\"{}\"}} {}\n", prefix, stage_names[i], stage.count);
+        }
+    }
+};
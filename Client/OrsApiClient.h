@@ -1,153 +1,390 @@
 ﻿#pragma once
 
+#include "HttpRequestWriter.h"
+#include "HttpResponseParser.h"
+#include "Metrics.h"
+#include "RankingDecoder.h"
+
 namespace ors_api_client
 {
-    constexpr char CRLF[] = "\r\n";
-    constexpr char CRLFCRLF[] = "\r\n\r\n";
+    // stages of a request timed by the client, REQUEST is the whole exchange from taking a connection to the parsed result
+    enum class Stage {
+        RESOLVE,
+        CONNECT,
+        SEND,
+        FIRST_BYTE,
+        BODY_PARSE,
+        REQUEST,
+        COUNT,
+    };
 
-    enum class Method {
-        GET,
-        POST,
+    enum class Counter {
+        REQUESTS,
+        // requests that got no response
+        FAILURES,
+        CONNECTIONS_OPENED,
+        CONNECTIONS_REUSED,
+        CONNECT_FAILURES,
+        // requests sent again on a new connection after a reused one turned out to be closed
+        RETRIES,
+        COUNT,
     };
 
-    inline void AddCrlf(std::string* str) {
-        str->append(CRLF);
+    // lowercase names of the members, e.g. for ors_metrics::AppendPrometheus
+    inline constexpr std::array<std::string_view, static_cast<std::size_t>(Stage::COUNT)>   STAGE_NAMES   = { "resolve", "connect", "send", "first_byte", "body_parse", "request" };
+    inline constexpr std::array<std::string_view, static_cast<std::size_t>(Counter::COUNT)> COUNTER_NAMES = { "requests", "failures", "connections_opened", "connections_reused", "connect_failures", "retries" };
+
+    using Metrics = ors_metrics::Registry<Counter, Stage>;
+
+    // shared by all requests of the process, never destroyed so that the threads of other statics
+    // (BatchUploader, AsyncClient) can record until they are joined
+    inline Metrics& GetMetrics() {
+        static Metrics* metrics = new Metrics();
+        return *metrics;
     }
 
-    inline std::tuple<std::string, socket_helper::PORT> SplitUrl(std::string str) {
-        if (auto pos = str.find_last_of(":"); pos != std::string::npos) {
-            return { str.substr(0, pos).data(), std::stoi(str.substr(pos + 1).data())};
-        }
-        return { str.data(), 80 };
+    // counters and stage latencies of every request since the process started,
+    // the ones of an interval are the difference of two snapshots
+    inline Metrics::Snapshot GetStats() {
+        return GetMetrics().GetSnapshot();
     }
 
-    inline std::string GetResponseMessageBody(std::string_view response) {
-        if (auto crlf_pos = response.find(CRLFCRLF); crlf_pos != std::string::npos) {
-            return response.substr(crlf_pos + sizeof(CRLFCRLF) - 1).data();
+    // split "host[:port][/path]" into host, port and path, host and path view url
+    inline std::tuple<std::string_view, socket_helper::PORT, std::string_view> SplitUrl(std::string_view url) {
+        std::string_view path = "/";
+        if (auto pos = url.find('/'); pos != std::string_view::npos) {
+            path = url.substr(pos);
+            url  = url.substr(0, pos);
         }
-        return std::string();
+        auto pos = url.find_last_of(':');
+        if (pos == std::string_view::npos) {
+            return { url, 80, path };
+        }
+        socket_helper::PORT port = 0;
+        auto [ptr, ec] = std::from_chars(url.data() + pos + 1, url.data() + url.size(), port);
+        if (ec != std::errc() || ptr != url.data() + url.size()) {
+            assert::ExceptionThrow(std::format("Invalid port in {}", url));
+        }
+        return { url.substr(0, pos), port, path };
     }
 
-    inline json Request(std::string_view url, Method method, const json& params = {}) {
+    // a keep-alive connection together with the buffers and the response parser whose storage it reuses
+    struct Connection
+    {
+        Connection(SOCKET sock) : sock(sock) {}
+        Connection(const Connection&) = delete;
+        Connection& operator=(const Connection&) = delete;
 
-        if (method == Method::GET) {
-            // split url into host and port
-            auto [host, port] = SplitUrl(url.data());
-
-            // create socket and connect to host
-            SOCKET sock = socket_helper::Create();
-            ADDRINFO addr_info;
-            socket_helper::GetAddrInfo(host, port, &addr_info);
-            if (!socket_helper::Connect(&sock, addr_info, 5000)) {
-                return json();
-            }
-
-            // query string
-            std::string query;
-            if (params.size()) {
-                // start query string
-                query.append("?");
-                for (const auto& [key, value] : params.items()) {
-                    query += std::format("{}={}&", key, value.get<std::string>());
-                }
-                // remove last &
-                query.pop_back();
-            }
-
-            // request line
-            std::string request_line;
-            request_line = std::format("GET {} HTTP/1.1", query);
-            AddCrlf(&request_line);
-
-            // header fields
-            std::string header_fields;
-            header_fields = std::format("Host: {}:{}", host, port);
-            AddCrlf(&header_fields);
-
-            // finally send the request
-            std::string http_request = request_line + header_fields + CRLF;
-
-            // send request
-            socket_helper::Send(sock, http_request);
-
-            // receive response
-            int recv_limit = 1024;
-            int recv_count = 0;
-            std::string response;
-            std::string message_body;
-            while (++recv_count < recv_limit) {
-                int content_length = -1;
-                response += socket_helper::Recv(sock);
-
-                // Determine if all data has been received by checking the Content-Length header field
-                if (auto pos = response.find("Content-Length: "); pos != std::string::npos) {
-                    content_length = std::stoi(response.substr(pos + sizeof("Content-Length: ") - 1).data());
-                }
-                else if (auto pos = response.find("content-length: "); pos != std::string::npos) {
-                    content_length = std::stoi(response.substr(pos + sizeof("content-length: ") - 1).data());
+        ~Connection() {
+            socket_helper::Close(&sock);
+        }
+
+        SOCKET                    sock;
+        socket_helper::RecvBuffer recvBuffer;
+        HttpResponseParser        parser;
+        // the request being sent, the header (or all of a pipelined batch) and the body of a POST
+        std::string               sendBuffer;
+        std::string               sendBody;
+    };
+
+    // keeps HTTP/1.1 keep-alive connections open per endpoint (host:port)
+    // shared by all UserData instances, so repeated requests skip the TCP handshake
+    class ConnectionPool
+    {
+    public:
+
+        static constexpr std::size_t MAX_IDLE_CONNECTIONS = 8;
+        static constexpr int         CONNECT_TIME_OUT_MS  = 5000;
+
+        static ConnectionPool& Instance() {
+            static ConnectionPool instance;
+            return instance;
+        }
+
+        ~ConnectionPool() {
+            Clear();
+        }
+
+        // take an idle connection to host:port, or connect a new one
+        // reused is set to true when the connection came from the pool
+        std::unique_ptr<Connection> Acquire(std::string_view host, socket_helper::PORT port, bool* reused) {
+            {
+                std::lock_guard lock(mutex);
+                auto& idle = GetIdleConnections(host, port);
+                while (!idle.empty()) {
+                    auto connection = std::move(idle.back());
+                    idle.pop_back();
+                    // the server may have closed the connection while it was idle
+                    if (socket_helper::IsConnectionAlive(connection->sock)) {
+                        *reused = true;
+                        GetMetrics().Add(Counter::CONNECTIONS_REUSED);
+                        return connection;
+                    }
                 }
+            }
+
+            *reused = false;
+            return Connect(host, port);
+        }
+
+        // give a connection back after a complete response has been received
+        void Release(std::string_view host, socket_helper::PORT port, std::unique_ptr<Connection> connection) {
+            std::lock_guard lock(mutex);
+            auto& idle = GetIdleConnections(host, port);
+            if (idle.size() < MAX_IDLE_CONNECTIONS) {
+                idle.push_back(std::move(connection));
+            }
+        }
+
+        // close all idle connections
+        void Clear() {
+            std::lock_guard lock(mutex);
+            endpoints.clear();
+        }
+
+    private:
 
-                // if all data has been received, break
-                message_body = GetResponseMessageBody(response);
-                if (content_length != -1 && message_body.size() == content_length) {
-                    break;
+        struct Endpoint
+        {
+            std::string                              host;
+            socket_helper::PORT                      port = 0;
+            std::vector<std::unique_ptr<Connection>> idleConnections;
+        };
+
+        ConnectionPool() = default;
+
+        // idle connections of host:port, call with mutex held
+        // a client talks to a handful of endpoints, a linear search needs no key string per request
+        std::vector<std::unique_ptr<Connection>>& GetIdleConnections(std::string_view host, socket_helper::PORT port) {
+            for (auto& endpoint : endpoints) {
+                if (endpoint.port == port && endpoint.host == host) {
+                    return endpoint.idleConnections;
                 }
             }
+            return endpoints.emplace_back(Endpoint{ std::string(host), port, {} }).idleConnections;
+        }
+
+        static std::unique_ptr<Connection> Connect(std::string_view host, socket_helper::PORT port) {
+            auto& metrics    = GetMetrics();
+            auto  resolving  = ors_metrics::Clock::now();
+            auto& resolver   = socket_helper::Resolver::Instance();
+            auto  addresses  = resolver.Resolve(host, port);
+            auto  connecting = metrics.Record(Stage::RESOLVE, resolving);
+            if (!addresses) {
+                metrics.Add(Counter::CONNECT_FAILURES);
+                return nullptr;
+            }
+            SOCKET sock = socket_helper::ConnectRace(*addresses, CONNECT_TIME_OUT_MS);
+            if (sock == INVALID_SOCKET) {
+                // the cached addresses may be stale, resolve again next time
+                resolver.Invalidate(host, port);
+                metrics.Add(Counter::CONNECT_FAILURES);
+                return nullptr;
+            }
+            metrics.Record(Stage::CONNECT, connecting);
+            metrics.Add(Counter::CONNECTIONS_OPENED);
+            return std::make_unique<Connection>(sock);
+        }
+
+        std::mutex            mutex;
+        std::vector<Endpoint> endpoints;
+
+    };
+
+    // receive one response into connection->parser
+    // returns false if the connection was closed or the response was malformed
+    // the wait for the first bytes that were not buffered yet is recorded as FIRST_BYTE
+    inline bool ReceiveResponse(Connection* connection) {
+        auto& parser  = connection->parser;
+        auto  waiting = ors_metrics::Clock::now();
+        bool  waited  = false;
+        parser.Reset();
+
+        // a pipelined response may already be buffered behind the previous one
+        connection->recvBuffer.Consume(parser.Feed(connection->recvBuffer.Data()));
+        while (!parser.IsComplete()) {
+            if (socket_helper::Recv(connection->sock, &connection->recvBuffer).status != socket_helper::RecvStatus::OK) {
+                // connection closed by the server
+                parser.FeedEof();
+                break;
+            }
+            if (!waited) {
+                GetMetrics().Record(Stage::FIRST_BYTE, waiting);
+                waited = true;
+            }
+            // bytes after the response stay in recvBuffer
+            connection->recvBuffer.Consume(parser.Feed(connection->recvBuffer.Data()));
+            if (parser.HasError()) {
+                return false;
+            }
+        }
+
+        return parser.IsComplete();
+    }
+
+    // send a request to url over a pooled connection and pass the parsed response to on_response
+    // the connection goes back to the pool only after on_response returned
+    // the request is written into the buffers of the connection and sent with one scatter send
+    template<class ResponseHandler>
+    inline bool Exchange(std::string_view url, Method method, const json& params, ResponseHandler&& on_response) {
+        auto [host, port, path] = SplitUrl(url);
+        auto& pool    = ConnectionPool::Instance();
+        auto& metrics = GetMetrics();
+        auto  start   = ors_metrics::Clock::now();
+        metrics.Add(Counter::REQUESTS);
+
+        // a reused connection may turn out to be closed by the server only when we use it,
+        // in that case retry once on a new connection
+        for (int attempt = 0; attempt < 2; ++attempt) {
+            if (attempt) {
+                metrics.Add(Counter::RETRIES);
+            }
+            bool reused = false;
+            auto connection = pool.Acquire(host, port, &reused);
+            if (!connection) {
+                break;
+            }
 
-            std::string content_type;
-            // check if Content-Type is application/json
-            if (auto pos = response.find("Content-Type: "); pos != std::string::npos) {
-                content_type = response.substr(pos + sizeof("Content-Type: ") - 1);
+            connection->sendBuffer.clear();
+            WriteHttpRequest(host, port, path, method, params, &connection->sendBuffer, &connection->sendBody);
+            std::array<std::string_view, 2> message = { connection->sendBuffer, connection->sendBody };
+            auto sending = ors_metrics::Clock::now();
+            bool sent    = socket_helper::SendV(connection->sock, message) == static_cast<int>(message[0].size() + message[1].size());
+            if (sent) {
+                metrics.Record(Stage::SEND, sending);
             }
-            else if (auto pos = response.find("content-type: "); pos != std::string::npos) {
-                content_type = response.substr(pos + sizeof("content-type: ") - 1);
+            if (sent && ReceiveResponse(connection.get())) {
+                on_response(connection->parser);
+                // anything after the response is unexpected, the connection is not reused
+                if (connection->parser.IsKeepAlive() && connection->recvBuffer.Empty()) {
+                    pool.Release(host, port, std::move(connection));
+                }
+                metrics.Record(Stage::REQUEST, start);
+                return true;
             }
-            if (content_type.find("application/json") == std::string::npos) {
-                throw std::exception("Content-Type is not application/json");
+
+            if (!reused) {
+                break;
             }
+        }
 
-            // close socket
-            socket_helper::Close(&sock);
+        metrics.Add(Counter::FAILURES);
+        return false;
+    }
 
-            // return message body as json
-            return json::parse(message_body);
+    // result of a request: the message body of a GET response as json, nothing for a POST answered without one
+    inline json ParseResponse(Method method, const HttpResponseParser& parser) {
+        if (method != Method::GET && parser.GetHeaderField("Content-Type").find("application/json") == std::string_view::npos) {
+            return json();
         }
 
-        else if (method == Method::POST) {
-            // split url into host and port
-            auto [host, port] = SplitUrl(url.data());
+        // check if Content-Type is application/json
+        if (parser.GetHeaderField("Content-Type").find("application/json") == std::string_view::npos) {
+            assert::ExceptionThrow("Content-Type is not application/json");
+        }
 
-            // create socket and connect to host
-            SOCKET sock = socket_helper::Create();
-            ADDRINFO addr_info;
-            socket_helper::GetAddrInfo(host, port, &addr_info);
-            socket_helper::Connect(&sock, addr_info, 5000);
+        // parse message body in place
+        return json::parse(parser.GetMessageBody());
+    }
 
-            // request line
-            std::string request_line;
-            request_line = std::format("POST {} HTTP/1.1", url);
-            AddCrlf(&request_line);
+    inline json Request(std::string_view url, Method method, const json& params = {}) {
 
-            // header fields
-            std::string header_fields;
-            header_fields = std::format("Host: {}:{}", host, port);
-            AddCrlf(&header_fields);
-            header_fields += std::format("Content-Type: application/json");
-            AddCrlf(&header_fields);
-            header_fields += std::format("Content-Length: {}", params.dump().size());
-            AddCrlf(&header_fields);
+        // send request and receive response
+        // the response of a POST has to be read as well so that the connection can be reused
+        json result;
+        Exchange(url, method, params, [&](const HttpResponseParser& parser) {
+            auto parsing = ors_metrics::Clock::now();
+            result = ParseResponse(method, parser);
+            GetMetrics().Record(Stage::BODY_PARSE, parsing);
+        });
+        return result;
+    }
 
-            // finally send the request
-            std::string http_request = request_line + header_fields + CRLF + params.dump();
+    // entries of a ranking GET (top, own rank, page or neighborhood) or POST (ranks of many uuids) decoded by
+    // RankingDecoder, without a json DOM. entries is overwritten, returns false if no ranking response was received
+    inline bool RequestRanking(std::string_view url, const json& params, std::vector<RankingEntry>* entries, Method method = Method::GET) {
+        entries->clear();
+        bool decoded = false;
+        Exchange(url, method, params, [&](const HttpResponseParser& parser) {
+            auto parsing = ors_metrics::Clock::now();
+            decoded = parser.GetHeaderField("Content-Type").find("application/json") != std::string_view::npos
+                && RankingDecoder::Decode(parser.GetMessageBody(), entries);
+            GetMetrics().Record(Stage::BODY_PARSE, parsing);
+        });
+        return decoded;
+    }
 
-            // send request
-            socket_helper::Send(sock, http_request);
+    struct PipelinedRequest
+    {
+        Method method = Method::GET;
+        json   params;
+    };
 
-            // close socket
-            socket_helper::Close(&sock);
+    // send all requests on one connection before reading any response (HTTP/1.1 pipelining),
+    // so a batch costs about one round trip instead of one per request
+    // results[i] is the result of requests[i], null if it got no response
+    inline std::vector<json> RequestPipelined(std::string_view url, const std::vector<PipelinedRequest>& requests) {
+        auto [host, port, path] = SplitUrl(url);
+        std::vector<json> results(requests.size());
+
+        auto& pool    = ConnectionPool::Instance();
+        auto& metrics = GetMetrics();
+        auto  start   = ors_metrics::Clock::now();
+        metrics.Add(Counter::REQUESTS, requests.size());
+        std::size_t next = 0; // first request without a response
+        for (int attempt = 0; attempt < 2 && next < requests.size(); ++attempt) {
+            // the server may close the connection before it answered everything,
+            // requests without a response are sent again once, unless that could apply a score twice
+            if (attempt && std::any_of(requests.begin() + next, requests.end(), [](const auto& request) { return request.method != Method::GET; })) {
+                break;
+            }
+            if (attempt) {
+                metrics.Add(Counter::RETRIES, requests.size() - next);
+            }
+
+            bool reused = false;
+            auto connection = pool.Acquire(host, port, &reused);
+            if (!connection) {
+                break;
+            }
+
+            // write all outstanding requests at once
+            auto& http_requests = connection->sendBuffer;
+            http_requests.clear();
+            for (std::size_t i = next; i < requests.size(); ++i) {
+                AppendHttpRequest(host, port, path, requests[i].method, requests[i].params, &http_requests);
+            }
+            auto sending = ors_metrics::Clock::now();
+            if (socket_helper::Send(connection->sock, http_requests) != static_cast<int>(http_requests.size())) {
+                continue;
+            }
+            metrics.Record(Stage::SEND, sending);
+
+            // responses come back in request order
+            bool keep_alive = true;
+            while (keep_alive && next < requests.size() && ReceiveResponse(connection.get())) {
+                // one unexpected response must not discard the others
+                auto parsing = ors_metrics::Clock::now();
+                try {
+                    results[next] = ParseResponse(requests[next].method, connection->parser);
+                }
+                catch (const std::exception&) {}
+                metrics.Record(Stage::BODY_PARSE, parsing);
+                keep_alive = connection->parser.IsKeepAlive();
+                ++next;
+            }
+
+            if (next == requests.size() && keep_alive && connection->recvBuffer.Empty()) {
+                pool.Release(host, port, std::move(connection));
+            }
         }
 
-        return json();
+        // the batch is one round trip, REQUEST is recorded once for it
+        metrics.Add(Counter::FAILURES, requests.size() - next);
+        if (next) {
+            metrics.Record(Stage::REQUEST, start);
+        }
+        return results;
     }
 
 };
@@ -0,0 +1,521 @@
+﻿#pragma once
+
+#include "OrsApiClient.h"
+
+namespace ors_api_client
+{
+    // runs requests on a single event loop thread with non-blocking sockets
+    // any number of requests can be in flight, the calling thread never waits on the network
+    class AsyncClient
+    {
+    public:
+
+        static constexpr std::size_t MAX_IDLE_CONNECTIONS     = 8;
+        static constexpr int         CONNECT_TIME_OUT_MS      = 5000;
+        // the next address is tried when the connects so far have not answered within this, as in ConnectRace
+        static constexpr int         CONNECT_ATTEMPT_DELAY_MS = 250;
+        static constexpr int         RESPONSE_TIME_OUT_MS     = 10000;
+
+        static AsyncClient& Instance() {
+            static AsyncClient instance;
+            return instance;
+        }
+
+        ~AsyncClient() {
+            {
+                std::lock_guard lock(mutex);
+                running = false;
+            }
+            poller.Wakeup();
+            loopThread.join();
+        }
+
+        // same result as ors_api_client::Request, delivered through the future
+        std::future<json> Request(std::string_view url, Method method, const json& params = {}) {
+            auto operation = std::make_unique<Operation>();
+            auto [host, port, path] = SplitUrl(url);
+            AppendHttpRequest(host, port, path, method, params, &operation->httpRequest);
+            operation->host        = host;
+            operation->port        = port;
+            operation->method      = method;
+            operation->start       = std::chrono::steady_clock::now();
+            auto future = operation->promise.get_future();
+            GetMetrics().Add(Counter::REQUESTS);
+
+            {
+                std::lock_guard lock(mutex);
+                submitted.push_back(std::move(operation));
+            }
+            poller.Wakeup();
+            return future;
+        }
+
+    private:
+
+        enum class State {
+            CONNECTING,
+            SENDING,
+            RECEIVING,
+        };
+
+        struct Operation
+        {
+            std::string                           host;
+            socket_helper::PORT                   port   = 0;
+            Method                                method = Method::GET;
+            std::string                           httpRequest;
+            std::size_t                           sent   = 0;
+            State                                 state  = State::CONNECTING;
+            socket_helper::AddressList            addresses;
+            const ADDRINFO*                       nextAddress = nullptr;
+            // connects still running while CONNECTING, the first one established becomes connection
+            std::vector<SOCKET>                   attempts;
+            std::unique_ptr<Connection>           connection;
+            bool                                  reused  = false;
+            bool                                  retried = false;
+            // while CONNECTING the earlier of connectDeadline and the start of the next attempt
+            std::chrono::steady_clock::time_point deadline;
+            std::chrono::steady_clock::time_point connectDeadline;
+            // when the request was made and when its current stage began
+            std::chrono::steady_clock::time_point start;
+            std::chrono::steady_clock::time_point stageStart;
+            std::promise<json>                    promise;
+        };
+
+        // host:port and its addresses, posted by a resolver thread to the event loop
+        struct ResolvedName
+        {
+            std::string                key;
+            socket_helper::AddressList addresses;
+        };
+
+        AsyncClient() {
+            loopThread = std::thread([this] { Run(); });
+        }
+
+        void Run() {
+            std::vector<std::unique_ptr<Operation>> starting;
+            std::vector<ResolvedName>               names;
+            std::vector<socket_helper::Poller::Event> events;
+
+            while (true) {
+                {
+                    std::lock_guard lock(mutex);
+                    if (!running) {
+                        break;
+                    }
+                    std::move(submitted.begin(), submitted.end(), std::back_inserter(starting));
+                    submitted.clear();
+                    names.swap(resolvedNames);
+                }
+                for (auto& [key, addresses] : names) {
+                    OnResolved(key, std::move(addresses));
+                }
+                names.clear();
+                std::move(retrying.begin(), retrying.end(), std::back_inserter(starting));
+                retrying.clear();
+                for (auto& operation : starting) {
+                    Start(std::move(operation));
+                }
+                starting.clear();
+
+                poller.Wait(&events, NextTimeOut());
+                for (const auto& event : events) {
+                    if (auto it = active.find(event.sock); it != active.end()) {
+                        OnEvent(it->second.get(), event.events);
+                    }
+                    else if (auto attempt = connectAttempts.find(event.sock); attempt != connectAttempts.end()) {
+                        OnConnectEvent(attempt->second, event.sock);
+                    }
+                }
+                ExpireTimeOuts();
+            }
+
+            // the client is shutting down, requests that are still in flight fail
+            // a resolve cannot be cancelled, the requests waiting for it fail once it is done
+            for (auto& [key, resolver] : resolvers) {
+                resolver.join();
+            }
+            for (auto& [key, operations] : unresolved) {
+                for (auto& operation : operations) {
+                    operation->promise.set_value(json());
+                }
+            }
+            std::lock_guard lock(mutex);
+            for (auto& [sock, operation] : active) {
+                poller.Remove(sock);
+                operation->promise.set_value(json());
+            }
+            for (auto& [key, operation] : connecting) {
+                CloseAttempts(operation.get());
+                operation->promise.set_value(json());
+            }
+            for (auto& operation : submitted) {
+                operation->promise.set_value(json());
+            }
+            for (auto& operation : retrying) {
+                operation->promise.set_value(json());
+            }
+        }
+
+        void Start(std::unique_ptr<Operation> operation) {
+            // a retry always gets a new connection
+            if (!operation->retried) {
+                auto& idle = idleConnections[MakeKey(operation->host, operation->port)];
+                while (!idle.empty()) {
+                    auto connection = std::move(idle.back());
+                    idle.pop_back();
+                    // the server may have closed the connection while it was idle
+                    if (socket_helper::IsConnectionAlive(connection->sock)) {
+                        operation->connection = std::move(connection);
+                        operation->reused     = true;
+                        operation->state      = State::SENDING;
+                        operation->stageStart = std::chrono::steady_clock::now();
+                        operation->deadline   = operation->stageStart + std::chrono::milliseconds(RESPONSE_TIME_OUT_MS);
+                        GetMetrics().Add(Counter::CONNECTIONS_REUSED);
+                        Watch(std::move(operation), socket_helper::Poller::WRITABLE);
+                        return;
+                    }
+                }
+            }
+
+            operation->stageStart = std::chrono::steady_clock::now();
+            if (!socket_helper::Resolver::Instance().Find(operation->host, operation->port, &operation->addresses)) {
+                Resolve(std::move(operation));
+                return;
+            }
+            Connect(std::move(operation));
+        }
+
+        // getaddrinfo blocks, a name that is not cached is resolved on a thread of its own so that neither the event
+        // loop nor the requests to other names wait for it. Requests for a name that is being resolved wait for that
+        void Resolve(std::unique_ptr<Operation> operation) {
+            auto  key     = MakeKey(operation->host, operation->port);
+            auto& waiting = unresolved[key];
+            waiting.push_back(std::move(operation));
+            if (waiting.size() != 1) {
+                return;
+            }
+            resolvers.emplace(key, std::thread([this, key, host = waiting.front()->host, port = waiting.front()->port] {
+                auto addresses = socket_helper::Resolver::Instance().Resolve(host, port);
+                {
+                    std::lock_guard lock(mutex);
+                    resolvedNames.push_back({ key, std::move(addresses) });
+                }
+                poller.Wakeup();
+            }));
+        }
+
+        void OnResolved(const std::string& key, socket_helper::AddressList addresses) {
+            // the thread has posted its result and is about to end
+            auto resolver = resolvers.find(key);
+            resolver->second.join();
+            resolvers.erase(resolver);
+
+            auto waiting = unresolved.extract(key);
+            for (auto& operation : waiting.mapped()) {
+                operation->addresses = addresses;
+                Connect(std::move(operation));
+            }
+        }
+
+        // start connecting to the resolved addresses of operation, the resolve began at stageStart
+        void Connect(std::unique_ptr<Operation> operation) {
+            operation->nextAddress     = operation->addresses.get();
+            operation->stageStart      = GetMetrics().Record(Stage::RESOLVE, operation->stageStart);
+            operation->connectDeadline = operation->stageStart + std::chrono::milliseconds(CONNECT_TIME_OUT_MS);
+            operation->reused          = false;
+            operation->state           = State::CONNECTING;
+
+            auto* connecting_operation = operation.get();
+            connecting.emplace(connecting_operation, std::move(operation));
+            if (!ConnectNext(connecting_operation)) {
+                ConnectFailed(connecting_operation);
+            }
+        }
+
+        // operations in active have a connection, connect attempts are handled by OnConnectEvent
+        void OnEvent(Operation* operation, std::uint32_t events) {
+            bool closed = (events & socket_helper::Poller::CLOSED) != 0;
+            switch (operation->state) {
+            case State::CONNECTING:
+                break;
+            case State::SENDING:
+                // the server hung up or reset the connection, the request cannot be sent on it
+                if (closed) {
+                    Fail(operation);
+                    return;
+                }
+                Send(operation);
+                break;
+            case State::RECEIVING:
+                Receive(operation, closed);
+                break;
+            }
+        }
+
+        // start a non-blocking connect to the next address that takes one, earlier attempts keep running
+        // returns false if no address is left
+        bool ConnectNext(Operation* operation) {
+            while (operation->nextAddress) {
+                const ADDRINFO& addr_info = *operation->nextAddress;
+                operation->nextAddress = addr_info.ai_next;
+                SOCKET sock = socket_helper::Create(addr_info.ai_family, addr_info.ai_socktype, addr_info.ai_protocol);
+                if (sock == INVALID_SOCKET) {
+                    continue;
+                }
+                if (socket_helper::BeginConnect(&sock, addr_info)) {
+                    poller.Add(sock, socket_helper::Poller::WRITABLE);
+                    operation->attempts.push_back(sock);
+                    connectAttempts.emplace(sock, operation);
+                    operation->deadline = operation->connectDeadline;
+                    if (operation->nextAddress) {
+                        operation->deadline = (std::min)(operation->deadline, std::chrono::steady_clock::now() + std::chrono::milliseconds(CONNECT_ATTEMPT_DELAY_MS));
+                    }
+                    return true;
+                }
+                socket_helper::Close(&sock);
+            }
+            operation->deadline = operation->connectDeadline;
+            return false;
+        }
+
+        // writable means the attempt on sock is established, or failed if the socket has an error
+        void OnConnectEvent(Operation* operation, SOCKET sock) {
+            poller.Remove(sock);
+            connectAttempts.erase(sock);
+            std::erase(operation->attempts, sock);
+            if (socket_helper::GetSocketError(sock)) {
+                socket_helper::Close(&sock);
+                // once every attempt so far failed the next address is tried without waiting
+                if (operation->attempts.empty() && !ConnectNext(operation)) {
+                    ConnectFailed(operation);
+                }
+                return;
+            }
+
+            // the first established connection wins
+            auto connected = TakeConnecting(operation);
+            CloseAttempts(connected.get());
+            connected->connection = std::make_unique<Connection>(sock);
+            connected->state      = State::SENDING;
+            connected->stageStart = GetMetrics().Record(Stage::CONNECT, connected->stageStart);
+            connected->deadline   = connected->stageStart + std::chrono::milliseconds(RESPONSE_TIME_OUT_MS);
+            GetMetrics().Add(Counter::CONNECTIONS_OPENED);
+            Watch(std::move(connected), socket_helper::Poller::WRITABLE);
+            Send(operation);
+        }
+
+        // none of the addresses accepted a connection within the connect deadline
+        void ConnectFailed(Operation* operation) {
+            auto failed = TakeConnecting(operation);
+            CloseAttempts(failed.get());
+            // the cached addresses may be stale, resolve again next time
+            socket_helper::Resolver::Instance().Invalidate(failed->host, failed->port);
+            GetMetrics().Add(Counter::CONNECT_FAILURES);
+            GetMetrics().Add(Counter::FAILURES);
+            failed->promise.set_value(json());
+        }
+
+        std::unique_ptr<Operation> TakeConnecting(Operation* operation) {
+            auto it = connecting.find(operation);
+            auto taken = std::move(it->second);
+            connecting.erase(it);
+            return taken;
+        }
+
+        void CloseAttempts(Operation* operation) {
+            for (SOCKET sock : operation->attempts) {
+                poller.Remove(sock);
+                connectAttempts.erase(sock);
+                socket_helper::Close(&sock);
+            }
+            operation->attempts.clear();
+        }
+
+        void Send(Operation* operation) {
+            std::string_view data = operation->httpRequest;
+            while (operation->sent < data.size()) {
+                int sent = socket_helper::Send(operation->connection->sock, data.substr(operation->sent));
+                if (sent == SOCKET_ERROR) {
+                    if (!socket_helper::IsWouldBlock()) {
+                        Fail(operation);
+                    }
+                    // wait until writable again
+                    return;
+                }
+                operation->sent += sent;
+            }
+
+            operation->state      = State::RECEIVING;
+            operation->stageStart = GetMetrics().Record(Stage::SEND, operation->stageStart);
+            operation->connection->parser.Reset();
+            poller.Modify(operation->connection->sock, socket_helper::Poller::READABLE);
+        }
+
+        // closed if the poller reported that the server hung up, nothing arrives after what can be read now
+        void Receive(Operation* operation, bool closed) {
+            auto& parser      = operation->connection->parser;
+            auto& recv_buffer = operation->connection->recvBuffer;
+            while (!parser.IsComplete() && !parser.HasError()) {
+                auto result = socket_helper::Recv(operation->connection->sock, &recv_buffer);
+                if (result.status == socket_helper::RecvStatus::WOULD_BLOCK && closed) {
+                    // the rest of the response will not come, do not wait for the time out
+                    parser.FeedEof();
+                    break;
+                }
+                if (result.status == socket_helper::RecvStatus::WOULD_BLOCK) {
+                    // wait until readable again
+                    return;
+                }
+                if (result.status != socket_helper::RecvStatus::OK) {
+                    // connection closed by the server
+                    parser.FeedEof();
+                    break;
+                }
+                if (parser.IsEmpty()) {
+                    GetMetrics().Record(Stage::FIRST_BYTE, operation->stageStart);
+                }
+                // bytes after the response stay in recv_buffer
+                recv_buffer.Consume(parser.Feed(recv_buffer.Data()));
+            }
+
+            if (parser.IsComplete()) {
+                Complete(operation);
+            }
+            else {
+                Fail(operation);
+            }
+        }
+
+        void Complete(Operation* operation) {
+            auto finished = Unwatch(operation->connection->sock);
+
+            // the response lives in the parser of the connection, read it before the connection is reused
+            auto& metrics = GetMetrics();
+            auto  parsing = std::chrono::steady_clock::now();
+            try {
+                finished->promise.set_value(ParseResponse(finished->method, finished->connection->parser));
+            }
+            catch (...) {
+                finished->promise.set_exception(std::current_exception());
+            }
+            metrics.Record(Stage::BODY_PARSE, parsing);
+            metrics.Record(Stage::REQUEST, finished->start);
+
+            // anything after the response is unexpected, the connection is not reused
+            if (finished->connection->parser.IsKeepAlive() && finished->connection->recvBuffer.Empty()) {
+                auto& idle = idleConnections[MakeKey(finished->host, finished->port)];
+                if (idle.size() < MAX_IDLE_CONNECTIONS) {
+                    idle.push_back(std::move(finished->connection));
+                }
+            }
+        }
+
+        void Fail(Operation* operation) {
+            auto failed = Unwatch(operation->connection->sock);
+            bool nothing_received = failed->state != State::RECEIVING || failed->connection->parser.IsEmpty();
+            failed->connection.reset();
+
+            // a reused connection may have been closed by the server just before we used it,
+            // in that case retry once on a new connection
+            if (failed->reused && !failed->retried && nothing_received) {
+                failed->retried = true;
+                failed->sent    = 0;
+                retrying.push_back(std::move(failed));
+                GetMetrics().Add(Counter::RETRIES);
+                return;
+            }
+            GetMetrics().Add(Counter::FAILURES);
+            failed->promise.set_value(json());
+        }
+
+        void Watch(std::unique_ptr<Operation> operation, std::uint32_t events) {
+            SOCKET sock = operation->connection->sock;
+            poller.Add(sock, events);
+            active.emplace(sock, std::move(operation));
+        }
+
+        std::unique_ptr<Operation> Unwatch(SOCKET sock) {
+            poller.Remove(sock);
+            auto it = active.find(sock);
+            auto operation = std::move(it->second);
+            active.erase(it);
+            return operation;
+        }
+
+        int NextTimeOut() const {
+            if (active.empty() && connecting.empty()) {
+                return -1;
+            }
+            auto deadline = (std::chrono::steady_clock::time_point::max)();
+            for (const auto& [sock, operation] : active) {
+                deadline = (std::min)(deadline, operation->deadline);
+            }
+            for (const auto& [key, operation] : connecting) {
+                deadline = (std::min)(deadline, operation->deadline);
+            }
+            auto time_out = std::chrono::ceil<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+            return static_cast<int>((std::max)(time_out, std::chrono::milliseconds::rep(0)));
+        }
+
+        void ExpireTimeOuts() {
+            auto now = std::chrono::steady_clock::now();
+            std::vector<Operation*> expired;
+            for (const auto& [sock, operation] : active) {
+                if (operation->deadline <= now) {
+                    expired.push_back(operation.get());
+                }
+            }
+            for (auto* operation : expired) {
+                // do not retry a request that timed out
+                operation->retried = true;
+                Fail(operation);
+            }
+
+            // start the next attempt of the connects that have not answered yet
+            std::vector<Operation*> due;
+            for (const auto& [key, operation] : connecting) {
+                if (operation->deadline <= now) {
+                    due.push_back(operation.get());
+                }
+            }
+            for (auto* operation : due) {
+                if (operation->connectDeadline <= now || (!ConnectNext(operation) && operation->attempts.empty())) {
+                    ConnectFailed(operation);
+                }
+            }
+        }
+
+        static std::string MakeKey(std::string_view host, socket_helper::PORT port) {
+            return std::format("{}:{}", host, port);
+        }
+
+        // shared with the calling threads
+        socket_helper::Poller                                                    poller;
+        std::mutex                                                               mutex;
+        std::vector<std::unique_ptr<Operation>>                                  submitted;
+        bool                                                                     running = true;
+        std::vector<ResolvedName>                                                resolvedNames;
+
+        // owned by the event loop thread
+        std::unordered_map<SOCKET, std::unique_ptr<Operation>>                   active;
+        std::unordered_map<Operation*, std::unique_ptr<Operation>>               connecting;
+        // the socket of each connect attempt and the operation it belongs to
+        std::unordered_map<SOCKET, Operation*>                                   connectAttempts;
+        std::vector<std::unique_ptr<Operation>>                                  retrying;
+        std::unordered_map<std::string, std::vector<std::unique_ptr<Connection>>> idleConnections;
+        // requests waiting for the resolve of their host:port and the thread resolving it
+        std::unordered_map<std::string, std::vector<std::unique_ptr<Operation>>> unresolved;
+        std::unordered_map<std::string, std::thread>                             resolvers;
+
+        std::thread                                                              loopThread;
+
+    };
+
+    // asynchronous variant of Request, does not block the calling thread
+    inline std::future<json> RequestAsync(std::string_view url, Method method, const json& params = {}) {
+        return AsyncClient::Instance().Request(url, method, params);
+    }
+
+};
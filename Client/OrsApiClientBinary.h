@@ -0,0 +1,161 @@
+﻿#pragma once
+
+#include "OrsApiClient.h"
+#include "OrsBinaryProtocol.h"
+
+namespace ors_api_client
+{
+    // requests over the binary protocol (OrsBinaryProtocol.h), url is "host:port" of the binary port
+    // results have the same form as the ones of Request over HTTP, connections come from the same pool
+    // board is the board of the request, empty for the default board of the server
+
+    // send a request frame over a pooled connection and pass the response frame to on_response
+    template<class ResponseHandler>
+    inline bool ExchangeBinary(std::string_view url, std::string_view request, ResponseHandler&& on_response) {
+        auto [host, port, path] = SplitUrl(url);
+        auto& pool    = ConnectionPool::Instance();
+        auto& metrics = GetMetrics();
+        auto  start   = ors_metrics::Clock::now();
+        metrics.Add(Counter::REQUESTS);
+
+        // a reused connection may turn out to be closed by the server only when we use it,
+        // in that case retry once on a new connection
+        for (int attempt = 0; attempt < 2; ++attempt) {
+            if (attempt) {
+                metrics.Add(Counter::RETRIES);
+            }
+            bool reused = false;
+            auto connection = pool.Acquire(host, port, &reused);
+            if (!connection) {
+                break;
+            }
+
+            auto sending = ors_metrics::Clock::now();
+            if (socket_helper::Send(connection->sock, request) == static_cast<int>(request.size())) {
+                auto waiting = metrics.Record(Stage::SEND, sending);
+                auto& buffer = connection->recvBuffer;
+                buffer.Clear();
+                std::size_t frame_size = 0;
+                bool        waited     = false;
+                while ((frame_size = ors_binary_protocol::GetFrameSize(buffer.Data(), ors_binary_protocol::MAX_RESPONSE_SIZE)) == 0) {
+                    if (socket_helper::Recv(connection->sock, &buffer).status != socket_helper::RecvStatus::OK) {
+                        break;
+                    }
+                    if (!waited) {
+                        metrics.Record(Stage::FIRST_BYTE, waiting);
+                        waited = true;
+                    }
+                }
+                if (frame_size == ors_binary_protocol::INVALID_FRAME) {
+                    break;
+                }
+                if (frame_size) {
+                    auto parsing = ors_metrics::Clock::now();
+                    on_response(ors_binary_protocol::ReadFrame(buffer.Data(), frame_size));
+                    metrics.Record(Stage::BODY_PARSE, parsing);
+                    buffer.Consume(frame_size);
+                    // anything after the response is unexpected, the connection is not reused
+                    if (buffer.Empty()) {
+                        pool.Release(host, port, std::move(connection));
+                    }
+                    metrics.Record(Stage::REQUEST, start);
+                    return true;
+                }
+            }
+
+            if (!reused) {
+                break;
+            }
+        }
+
+        metrics.Add(Counter::FAILURES);
+        return false;
+    }
+
+    // {rank: {log_time, uuid, user_name, score}, ...} of an ENTRIES frame, as the HTTP API returns it
+    inline json ParseEntries(const ors_binary_protocol::Frame& frame) {
+        std::vector<ors_binary_protocol::Entry> entries;
+        if (frame.type != ors_binary_protocol::MessageType::ENTRIES || !ors_binary_protocol::ReadEntries(frame.body, &entries)) {
+            assert::ExceptionThrow("Malformed binary response");
+        }
+        json result = json::object();
+        for (const auto& entry : entries) {
+            auto& value = result[std::to_string(entry.rank)];
+            value["log_time"]  = entry.logTime;
+            value["uuid"]      = entry.uuid;
+            value["user_name"] = entry.userName;
+            value["score"]     = entry.score;
+        }
+        return result;
+    }
+
+    // the entries of an ENTRIES frame as RankingDecoder reads them from the HTTP API, entries is overwritten
+    inline bool ReadRankingEntries(const ors_binary_protocol::Frame& frame, std::vector<RankingEntry>* entries) {
+        std::vector<ors_binary_protocol::Entry> frame_entries;
+        if (frame.type != ors_binary_protocol::MessageType::ENTRIES || !ors_binary_protocol::ReadEntries(frame.body, &frame_entries)) {
+            return false;
+        }
+        entries->clear();
+        entries->reserve(frame_entries.size());
+        for (auto& entry : frame_entries) {
+            entries->push_back({ entry.rank, entry.score, std::move(entry.uuid), std::string(entry.userName), std::string(entry.logTime) });
+        }
+        return true;
+    }
+
+    // returns false if the score could not be sent or was rejected (FORBIDDEN for a frozen board)
+    inline bool SubmitScoreBinary(std::string_view url, const ors_binary_protocol::Uuid& uuid, std::string_view user_name, std::int64_t score, std::string_view board = {}) {
+        std::string request;
+        ors_binary_protocol::WriteSubmit(uuid, user_name, score, board, &request);
+        bool accepted = false;
+        ExchangeBinary(url, request, [&](const ors_binary_protocol::Frame& frame) {
+            accepted = frame.type == ors_binary_protocol::MessageType::OK;
+        });
+        return accepted;
+    }
+
+    inline json GetMyRankingBinary(std::string_view url, const ors_binary_protocol::Uuid& uuid, std::string_view board = {}) {
+        std::string request;
+        ors_binary_protocol::WriteRank(uuid, board, &request);
+        json result;
+        ExchangeBinary(url, request, [&](const ors_binary_protocol::Frame& frame) {
+            result = ParseEntries(frame);
+        });
+        return result;
+    }
+
+    // returns false if no ranking was received
+    inline bool GetMyRankingBinary(std::string_view url, const ors_binary_protocol::Uuid& uuid, std::vector<RankingEntry>* entries, std::string_view board = {}) {
+        std::string request;
+        ors_binary_protocol::WriteRank(uuid, board, &request);
+        entries->clear();
+        bool received = false;
+        ExchangeBinary(url, request, [&](const ors_binary_protocol::Frame& frame) {
+            received = ReadRankingEntries(frame, entries);
+        });
+        return received;
+    }
+
+    inline json GetTopRankingBinary(std::string_view url, std::uint32_t limit, std::string_view board = {}) {
+        std::string request;
+        ors_binary_protocol::WriteTop(limit, board, &request);
+        json result;
+        ExchangeBinary(url, request, [&](const ors_binary_protocol::Frame& frame) {
+            result = ParseEntries(frame);
+        });
+        return result;
+    }
+
+    // returns false if no ranking was received
+    inline bool GetTopRankingBinary(std::string_view url, std::uint32_t limit, std::vector<RankingEntry>* entries, std::string_view board = {}) {
+        std::string request;
+        ors_binary_protocol::WriteTop(limit, board, &request);
+        entries->clear();
+        bool received = false;
+        ExchangeBinary(url, request, [&](const ors_binary_protocol::Frame& frame) {
+            received = ReadRankingEntries(frame, entries);
+        });
+        return received;
+    }
+
+};
@@ -0,0 +1,284 @@
+﻿#pragma once
+
+namespace ors_binary_protocol
+{
+    // compact alternative to the HTTP/JSON API, served on its own port
+    //
+    // every message is a frame: u32 body size, u8 message type, body. Integers are little endian.
+    // requests are answered in order, so they can be pipelined like HTTP/1.1 requests
+    //   SUBMIT  uuid[16], i64 score, u16 user_name size, user_name [, board]      -> OK, FORBIDDEN for a frozen board
+    //   RANK    uuid[16] [, board]                                                 -> ENTRIES (0 or 1 entry)
+    //   TOP     u32 limit [, board] (ALL_ENTRIES for as many as the server sends)  -> ENTRIES
+    //   board   u8 board size, board id: the board of the request, the default board of the server without it
+    //   ENTRIES u32 count, entries:
+    //           u64 rank, i64 score, uuid[16], u16 uuid text size, u16 user_name size, u16 log_time size,
+    //           uuid text, user_name, log_time
+    // a uuid is sent as its 16 bytes instead of the 36 characters of its text form. Rankings may hold uuids
+    // that are not in that form, an entry carries the text of those (and its uuid[16] is zero).
+    // a malformed request is answered with BAD_REQUEST and the connection is closed
+
+    enum class MessageType : std::uint8_t {
+        SUBMIT      = 0x01,
+        RANK        = 0x02,
+        TOP         = 0x03,
+        OK          = 0x81,
+        ENTRIES     = 0x82,
+        BAD_REQUEST = 0x83,
+        FORBIDDEN   = 0x84,
+    };
+
+    using Uuid = std::array<std::uint8_t, 16>;
+
+    constexpr std::size_t   FRAME_HEADER_SIZE = 5;
+    // requests are small, responses with a long ranking are not
+    constexpr std::size_t   MAX_REQUEST_SIZE  = 64 * 1024;
+    constexpr std::size_t   MAX_RESPONSE_SIZE = 0xFFFFFFFF;
+    // strings are sent with a 16 bit size, board ids with an 8 bit one
+    constexpr std::size_t   MAX_STRING_SIZE   = 0xFFFF;
+    constexpr std::size_t   MAX_BOARD_SIZE    = 0xFF;
+    constexpr std::uint32_t ALL_ENTRIES       = 0xFFFFFFFF;
+    // returned by GetFrameSize for a frame that cannot be valid
+    constexpr std::size_t   INVALID_FRAME     = SIZE_MAX;
+
+    struct Frame
+    {
+        MessageType      type;
+        std::string_view body;
+    };
+
+    // entry of an ENTRIES message, the strings point into the message
+    struct Entry
+    {
+        std::uint64_t    rank  = 0;
+        std::int64_t     score = 0;
+        std::string      uuid;
+        std::string_view userName;
+        std::string_view logTime;
+    };
+
+    template<class T>
+    inline void WriteInt(T value, std::string* out) {
+        static_assert(std::endian::native == std::endian::little, "the wire format is little endian");
+        out->append(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+
+    // bounds-checked reads from a message body, a read past the end sets the error flag and returns zeros
+    class Reader
+    {
+    public:
+
+        explicit Reader(std::string_view data)
+            : data(data)
+        {}
+
+        template<class T>
+        T ReadInt() {
+            T value{};
+            if (auto bytes = ReadBytes(sizeof(T)); bytes.size() == sizeof(T)) {
+                std::memcpy(&value, bytes.data(), sizeof(T));
+            }
+            return value;
+        }
+
+        std::string_view ReadBytes(std::size_t size) {
+            if (data.size() < size) {
+                error = true;
+                data  = {};
+                return {};
+            }
+            auto bytes = data.substr(0, size);
+            data.remove_prefix(size);
+            return bytes;
+        }
+
+        Uuid ReadUuid() {
+            Uuid uuid{};
+            if (auto bytes = ReadBytes(uuid.size()); bytes.size() == uuid.size()) {
+                std::memcpy(uuid.data(), bytes.data(), uuid.size());
+            }
+            return uuid;
+        }
+
+        // true if every read succeeded and nothing is left
+        bool IsComplete() const {
+            return !error && data.empty();
+        }
+
+        bool HasError() const {
+            return error;
+        }
+
+    private:
+
+        std::string_view data;
+        bool             error = false;
+
+    };
+
+    // uuid of the form xxxxxxxx-xxxx-xxxx-xxxx-xxxxxxxxxxxx, hex digits in either case
+    inline bool ParseUuid(std::string_view text, Uuid* uuid) {
+        if (text.size() != 36) {
+            return false;
+        }
+        std::size_t pos = 0;
+        for (std::size_t i = 0; i < uuid->size(); ++i) {
+            if (pos == 8 || pos == 13 || pos == 18 || pos == 23) {
+                if (text[pos] != '-') {
+                    return false;
+                }
+                ++pos;
+            }
+            auto [ptr, ec] = std::from_chars(text.data() + pos, text.data() + pos + 2, (*uuid)[i], 16);
+            if (ec != std::errc() || ptr != text.data() + pos + 2) {
+                return false;
+            }
+            pos += 2;
+        }
+        return true;
+    }
+
+    // lowercase text form, the one UuidToString produces
+    inline std::string FormatUuid(const Uuid& uuid) {
+        static constexpr char DIGITS[] = "0123456789abcdef";
+        std::string text;
+        text.reserve(36);
+        for (std::size_t i = 0; i < uuid.size(); ++i) {
+            if (i == 4 || i == 6 || i == 8 || i == 10) {
+                text += '-';
+            }
+            text += DIGITS[uuid[i] >> 4];
+            text += DIGITS[uuid[i] & 0x0F];
+        }
+        return text;
+    }
+
+    // size of the frame at the start of data, 0 while it is incomplete
+    inline std::size_t GetFrameSize(std::string_view data, std::size_t max_body_size) {
+        if (data.size() < FRAME_HEADER_SIZE) {
+            return 0;
+        }
+        std::uint32_t body_size;
+        std::memcpy(&body_size, data.data(), sizeof(body_size));
+        if (body_size > max_body_size) {
+            return INVALID_FRAME;
+        }
+        return data.size() < FRAME_HEADER_SIZE + body_size ? 0 : FRAME_HEADER_SIZE + body_size;
+    }
+
+    // the complete frame of frame_size bytes (from GetFrameSize) at the start of data
+    inline Frame ReadFrame(std::string_view data, std::size_t frame_size) {
+        return Frame{ static_cast<MessageType>(data[4]), data.substr(FRAME_HEADER_SIZE, frame_size - FRAME_HEADER_SIZE) };
+    }
+
+    // start a frame in out, returns its position for EndFrame
+    inline std::size_t BeginFrame(MessageType type, std::string* out) {
+        auto pos = out->size();
+        WriteInt(std::uint32_t(0), out);
+        WriteInt(static_cast<std::uint8_t>(type), out);
+        return pos;
+    }
+
+    // fill in the body size of the frame at pos
+    inline void EndFrame(std::size_t pos, std::string* out) {
+        auto body_size = static_cast<std::uint32_t>(out->size() - pos - FRAME_HEADER_SIZE);
+        std::memcpy(out->data() + pos, &body_size, sizeof(body_size));
+    }
+
+    inline void WriteEmpty(MessageType type, std::string* out) {
+        EndFrame(BeginFrame(type, out), out);
+    }
+
+    // the optional last field of a request, nothing for an empty board
+    inline void WriteBoard(std::string_view board, std::string* out) {
+        if (!board.empty()) {
+            WriteInt(static_cast<std::uint8_t>(board.size()), out);
+            *out += board;
+        }
+    }
+
+    // the board of a request after its other fields were read, empty without one
+    inline std::string_view ReadBoard(Reader* reader) {
+        if (reader->IsComplete()) {
+            return {};
+        }
+        return reader->ReadBytes(reader->ReadInt<std::uint8_t>());
+    }
+
+    // board is empty for the default board of the server
+    inline void WriteSubmit(const Uuid& uuid, std::string_view user_name, std::int64_t score, std::string_view board, std::string* out) {
+        auto pos = BeginFrame(MessageType::SUBMIT, out);
+        out->append(reinterpret_cast<const char*>(uuid.data()), uuid.size());
+        WriteInt(score, out);
+        WriteInt(static_cast<std::uint16_t>(user_name.size()), out);
+        *out += user_name;
+        WriteBoard(board, out);
+        EndFrame(pos, out);
+    }
+
+    inline void WriteRank(const Uuid& uuid, std::string_view board, std::string* out) {
+        auto pos = BeginFrame(MessageType::RANK, out);
+        out->append(reinterpret_cast<const char*>(uuid.data()), uuid.size());
+        WriteBoard(board, out);
+        EndFrame(pos, out);
+    }
+
+    inline void WriteTop(std::uint32_t limit, std::string_view board, std::string* out) {
+        auto pos = BeginFrame(MessageType::TOP, out);
+        WriteInt(limit, out);
+        WriteBoard(board, out);
+        EndFrame(pos, out);
+    }
+
+    // start an ENTRIES frame in out, returns its position for EndEntries
+    inline std::size_t BeginEntries(std::string* out) {
+        auto pos = BeginFrame(MessageType::ENTRIES, out);
+        WriteInt(std::uint32_t(0), out);
+        return pos;
+    }
+
+    // fill in the count and the body size of the ENTRIES frame at pos
+    inline void EndEntries(std::size_t pos, std::uint32_t count, std::string* out) {
+        std::memcpy(out->data() + pos + FRAME_HEADER_SIZE, &count, sizeof(count));
+        EndFrame(pos, out);
+    }
+
+    // append one entry to the ENTRIES frame started with BeginEntries
+    inline void WriteEntry(std::uint64_t rank, std::int64_t score, std::string_view uuid, std::string_view user_name, std::string_view log_time, std::string* out) {
+        Uuid binary_uuid{};
+        bool canonical = ParseUuid(uuid, &binary_uuid) && std::none_of(uuid.begin(), uuid.end(), [](char c) { return c >= 'A' && c <= 'F'; });
+        if (!canonical) {
+            binary_uuid = {};
+        }
+        WriteInt(rank, out);
+        WriteInt(score, out);
+        out->append(reinterpret_cast<const char*>(binary_uuid.data()), binary_uuid.size());
+        WriteInt(static_cast<std::uint16_t>(canonical ? 0 : uuid.size()), out);
+        WriteInt(static_cast<std::uint16_t>(user_name.size()), out);
+        WriteInt(static_cast<std::uint16_t>(log_time.size()), out);
+        if (!canonical) {
+            *out += uuid;
+        }
+        *out += user_name;
+        *out += log_time;
+    }
+
+    // entries of an ENTRIES body, false if it is malformed
+    inline bool ReadEntries(std::string_view body, std::vector<Entry>* entries) {
+        Reader reader(body);
+        auto count = reader.ReadInt<std::uint32_t>();
+        for (std::uint32_t i = 0; i < count && !reader.HasError(); ++i) {
+            Entry entry;
+            entry.rank  = reader.ReadInt<std::uint64_t>();
+            entry.score = reader.ReadInt<std::int64_t>();
+            auto uuid           = reader.ReadUuid();
+            auto uuid_text_size = reader.ReadInt<std::uint16_t>();
+            auto user_name_size = reader.ReadInt<std::uint16_t>();
+            auto log_time_size  = reader.ReadInt<std::uint16_t>();
+            entry.uuid     = uuid_text_size ? std::string(reader.ReadBytes(uuid_text_size)) : FormatUuid(uuid);
+            entry.userName = reader.ReadBytes(user_name_size);
+            entry.logTime  = reader.ReadBytes(log_time_size);
+            entries->push_back(std::move(entry));
+        }
+        return reader.IsComplete();
+    }
+};
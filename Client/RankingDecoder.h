@@ -0,0 +1,328 @@
+﻿#pragma once
+
+#include "SimdScan.h"
+
+namespace ors_api_client
+{
+    // one row of a ranking response
+    struct RankingEntry
+    {
+        std::uint64_t rank  = 0;
+        std::int64_t  score = 0;
+        std::string   uuid;
+        std::string   userName;
+        std::string   logTime;
+    };
+
+    // reads the entries of a ranking response straight into RankingEntry, without building a json DOM
+    //   {rank: {log_time, uuid, user_name, score}, ...}                      GetTopRanking, GetMyRanking
+    //   {..., entries: [{rank, log_time, uuid, user_name, score}, ...], ...} GetRankingPage, GetNeighborhood
+    // other members are skipped without being decoded, strings are scanned for their quote or escape with
+    // FindFirstOf. Scores and ranks have to be integers, as the servers write them
+    class RankingDecoder
+    {
+    public:
+
+        // append the entries of body in the order of the response
+        // returns false (and appends nothing) if body is not a ranking response
+        static bool Decode(std::string_view body, std::vector<RankingEntry>* entries) {
+            auto size = entries->size();
+            RankingDecoder decoder(body);
+            if (decoder.ParseRanking(entries) && decoder.AtEnd()) {
+                return true;
+            }
+            entries->resize(size);
+            return false;
+        }
+
+    private:
+
+        explicit RankingDecoder(std::string_view data) : data(data) {}
+
+        bool ParseRanking(std::vector<RankingEntry>* entries) {
+            if (!Consume('{')) {
+                return false;
+            }
+            if (Consume('}')) {
+                return true;
+            }
+            std::string key;
+            do {
+                key.clear();
+                if (!ParseString(&key) || !Consume(':')) {
+                    return false;
+                }
+                std::uint64_t rank = 0;
+                if (key == "entries" && Peek() == '[') {
+                    if (!ParseEntries(entries)) {
+                        return false;
+                    }
+                }
+                else if (Peek() == '{' && ParseInteger(key, &rank)) {
+                    auto& entry = entries->emplace_back();
+                    entry.rank = rank;
+                    if (!ParseEntry(&entry)) {
+                        return false;
+                    }
+                }
+                else if (!SkipValue()) {
+                    return false;
+                }
+            } while (Consume(','));
+            return Consume('}');
+        }
+
+        bool ParseEntries(std::vector<RankingEntry>* entries) {
+            if (!Consume('[')) {
+                return false;
+            }
+            if (Consume(']')) {
+                return true;
+            }
+            do {
+                if (!ParseEntry(&entries->emplace_back())) {
+                    return false;
+                }
+            } while (Consume(','));
+            return Consume(']');
+        }
+
+        bool ParseEntry(RankingEntry* entry) {
+            if (!Consume('{')) {
+                return false;
+            }
+            if (Consume('}')) {
+                return true;
+            }
+            std::string key;
+            do {
+                key.clear();
+                if (!ParseString(&key) || !Consume(':')) {
+                    return false;
+                }
+                bool parsed = false;
+                if (key == "rank") {
+                    parsed = ParseNumber(&entry->rank);
+                }
+                else if (key == "score") {
+                    parsed = ParseNumber(&entry->score);
+                }
+                else if (key == "user_name") {
+                    parsed = ParseString(&entry->userName);
+                }
+                else if (key == "uuid") {
+                    parsed = ParseString(&entry->uuid);
+                }
+                else if (key == "log_time") {
+                    parsed = ParseString(&entry->logTime);
+                }
+                else {
+                    parsed = SkipValue();
+                }
+                if (!parsed) {
+                    return false;
+                }
+            } while (Consume(','));
+            return Consume('}');
+        }
+
+        template<class T>
+        bool ParseNumber(T* value) {
+            SkipWhitespace();
+            auto [ptr, ec] = std::from_chars(data.data() + pos, data.data() + data.size(), *value);
+            if (ec != std::errc()) {
+                return false;
+            }
+            pos = static_cast<std::size_t>(ptr - data.data());
+            return true;
+        }
+
+        // append the decoded string to out
+        bool ParseString(std::string* out) {
+            if (!Consume('"')) {
+                return false;
+            }
+            while (true) {
+                auto stop = FindFirstOf(data, pos, '"', '\\');
+                if (stop == std::string_view::npos) {
+                    return false;
+                }
+                out->append(data.data() + pos, stop - pos);
+                pos = stop + 1;
+                if (data[stop] == '"') {
+                    return true;
+                }
+                if (!ParseEscape(out)) {
+                    return false;
+                }
+            }
+        }
+
+        // the escape sequence after a backslash
+        bool ParseEscape(std::string* out) {
+            if (pos >= data.size()) {
+                return false;
+            }
+            switch (data[pos++]) {
+            case '"':  *out += '"';  return true;
+            case '\\': *out += '\\'; return true;
+            case '/':  *out += '/';  return true;
+            case 'b':  *out += '\b'; return true;
+            case 'f':  *out += '\f'; return true;
+            case 'n':  *out += '\n'; return true;
+            case 'r':  *out += '\r'; return true;
+            case 't':  *out += '\t'; return true;
+            case 'u':  break;
+            default:   return false;
+            }
+
+            std::uint32_t code_point = 0;
+            if (!ParseHex4(&code_point)) {
+                return false;
+            }
+            // a character outside the BMP is a surrogate pair of two escapes
+            if (0xD800 <= code_point && code_point < 0xDC00) {
+                std::uint32_t low = 0;
+                if (data.substr(pos, 2) != "\\u") {
+                    return false;
+                }
+                pos += 2;
+                if (!ParseHex4(&low) || low < 0xDC00 || 0xE000 <= low) {
+                    return false;
+                }
+                code_point = 0x10000 + ((code_point - 0xD800) << 10) + (low - 0xDC00);
+            }
+            AppendUtf8(code_point, out);
+            return true;
+        }
+
+        bool ParseHex4(std::uint32_t* value) {
+            if (data.size() - pos < 4) {
+                return false;
+            }
+            auto [ptr, ec] = std::from_chars(data.data() + pos, data.data() + pos + 4, *value, 16);
+            if (ec != std::errc() || ptr != data.data() + pos + 4) {
+                return false;
+            }
+            pos += 4;
+            return true;
+        }
+
+        static void AppendUtf8(std::uint32_t code_point, std::string* out) {
+            if (code_point < 0x80) {
+                *out += static_cast<char>(code_point);
+            }
+            else if (code_point < 0x800) {
+                *out += static_cast<char>(0xC0 | (code_point >> 6));
+                *out += static_cast<char>(0x80 | (code_point & 0x3F));
+            }
+            else if (code_point < 0x10000) {
+                *out += static_cast<char>(0xE0 | (code_point >> 12));
+                *out += static_cast<char>(0x80 | ((code_point >> 6) & 0x3F));
+                *out += static_cast<char>(0x80 | (code_point & 0x3F));
+            }
+            else {
+                *out += static_cast<char>(0xF0 | (code_point >> 18));
+                *out += static_cast<char>(0x80 | ((code_point >> 12) & 0x3F));
+                *out += static_cast<char>(0x80 | ((code_point >> 6) & 0x3F));
+                *out += static_cast<char>(0x80 | (code_point & 0x3F));
+            }
+        }
+
+        // skip any value, nested ones only by their brackets
+        bool SkipValue() {
+            SkipWhitespace();
+            if (pos >= data.size()) {
+                return false;
+            }
+            switch (data[pos]) {
+            case '"':
+                return SkipString();
+            case '{':
+            case '[': {
+                std::size_t depth = 0;
+                while (pos < data.size()) {
+                    char c = data[pos];
+                    if (c == '"') {
+                        if (!SkipString()) {
+                            return false;
+                        }
+                        continue;
+                    }
+                    ++pos;
+                    if (c == '{' || c == '[') {
+                        ++depth;
+                    }
+                    else if ((c == '}' || c == ']') && --depth == 0) {
+                        return true;
+                    }
+                }
+                return false;
+            }
+            default: {
+                // number, true, false or null
+                auto begin = pos;
+                while (pos < data.size() && data[pos] != ',' && data[pos] != '}' && data[pos] != ']' && !IsWhitespace(data[pos])) {
+                    ++pos;
+                }
+                return pos != begin;
+            }
+            }
+        }
+
+        bool SkipString() {
+            ++pos;
+            while (true) {
+                auto stop = FindFirstOf(data, pos, '"', '\\');
+                if (stop == std::string_view::npos) {
+                    return false;
+                }
+                if (data[stop] == '"') {
+                    pos = stop + 1;
+                    return true;
+                }
+                // the escaped character cannot end the string
+                pos = stop + 2;
+            }
+        }
+
+        // the whole of str as a decimal integer
+        static bool ParseInteger(std::string_view str, std::uint64_t* value) {
+            auto [ptr, ec] = std::from_chars(str.data(), str.data() + str.size(), *value);
+            return !str.empty() && ec == std::errc() && ptr == str.data() + str.size();
+        }
+
+        static bool IsWhitespace(char c) {
+            return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+        }
+
+        void SkipWhitespace() {
+            while (pos < data.size() && IsWhitespace(data[pos])) {
+                ++pos;
+            }
+        }
+
+        // the next character that is not whitespace, 0 at the end
+        char Peek() {
+            SkipWhitespace();
+            return pos < data.size() ? data[pos] : '\0';
+        }
+
+        bool Consume(char c) {
+            if (Peek() != c) {
+                return false;
+            }
+            ++pos;
+            return true;
+        }
+
+        bool AtEnd() {
+            SkipWhitespace();
+            return pos == data.size();
+        }
+
+        std::string_view data;
+        std::size_t      pos = 0;
+
+    };
+};
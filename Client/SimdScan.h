@@ -0,0 +1,59 @@
+﻿#pragma once
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define ORS_API_CLIENT_AVX2
+#define ORS_API_CLIENT_SSE2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define ORS_API_CLIENT_SSE2
+#endif
+
+namespace ors_api_client
+{
+    // byte searches over received data, 32 bytes per step with AVX2 (/arch:AVX2, -mavx2), 16 with SSE2
+    // (every x64 target) and one at a time elsewhere. The instruction set is chosen at compile time
+
+    // position of the first a or b at or after pos, npos if there is none
+    inline std::size_t FindFirstOf(std::string_view data, std::size_t pos, char a, char b) {
+        if (pos >= data.size()) {
+            return std::string_view::npos;
+        }
+        const char* p   = data.data() + pos;
+        const char* end = data.data() + data.size();
+
+#ifdef ORS_API_CLIENT_AVX2
+        const auto a32 = _mm256_set1_epi8(a);
+        const auto b32 = _mm256_set1_epi8(b);
+        for (; end - p >= 32; p += 32) {
+            auto block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+            auto mask  = static_cast<std::uint32_t>(_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(block, a32), _mm256_cmpeq_epi8(block, b32))));
+            if (mask) {
+                return static_cast<std::size_t>(p - data.data()) + std::countr_zero(mask);
+            }
+        }
+#endif
+#ifdef ORS_API_CLIENT_SSE2
+        const auto a16 = _mm_set1_epi8(a);
+        const auto b16 = _mm_set1_epi8(b);
+        for (; end - p >= 16; p += 16) {
+            auto block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+            auto mask  = static_cast<std::uint32_t>(_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(block, a16), _mm_cmpeq_epi8(block, b16))));
+            if (mask) {
+                return static_cast<std::size_t>(p - data.data()) + std::countr_zero(mask);
+            }
+        }
+#endif
+        for (; p < end; ++p) {
+            if (*p == a || *p == b) {
+                return static_cast<std::size_t>(p - data.data());
+            }
+        }
+        return std::string_view::npos;
+    }
+
+    // position of the first c at or after pos, npos if there is none
+    inline std::size_t FindByte(std::string_view data, std::size_t pos, char c) {
+        return FindFirstOf(data, pos, c, c);
+    }
+};
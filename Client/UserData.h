@@ -1,47 +1,243 @@
 ﻿#pragma once
 
+#include "BatchUploader.h"
 #include "OrsApiClient.h"
+#include "OrsApiClientAsync.h"
+#include "OrsApiClientBinary.h"
+#ifdef _WIN32
 #pragma comment(lib, "Rpcrt4.lib")
+#endif
 
 class UserData
 {
 public:
 
-    static constexpr char URL[] = "192.168.1.15:5000";
+    static constexpr char URL[]           = "192.168.1.15:5000";
+    static constexpr char BINARY_URL[]    = "192.168.1.15:5001";
+    // board of the servers that are asked without one, e.g. per mode or per season boards are "duel", "duel-2026s1"
+    static constexpr char DEFAULT_BOARD[] = "ors";
+    // windows of GetMyRanking and GetTopRanking: the all-time ranking and the ones of the current hour, day and week
+    static constexpr char ALL_TIME[]      = "all";
+    static constexpr char HOURLY[]        = "hour";
+    static constexpr char DAILY[]         = "day";
+    static constexpr char WEEKLY[]        = "week";
+    // most uuids of one GetRanks, the MAX_PAGE_SIZE of the servers
+    static constexpr std::size_t MAX_RANKS = 1000;
 
-    UserData(std::string_view user_name, int score) {
+    // the scores and rankings of the user are the ones of board
+    UserData(std::string_view user_name, int score, std::string_view board = DEFAULT_BOARD) {
         uuid        = GetUuid();
         userName    = user_name;
         this->score = score;
+        this->board = board;
+
+        hasBinaryUuid = ors_binary_protocol::ParseUuid(uuid, &binaryUuid);
+    }
+
+    // send the HTTP requests to url instead of URL, e.g. a server on loopback. Set it before any request is made
+    static void UseUrl(std::string_view url = URL) {
+        GetUrl() = url;
+    }
+
+    // send UploadScore, GetMyRanking and GetTopRanking over the binary protocol to binary_url,
+    // an empty url goes back to HTTP. Set it before any request is made
+    static void UseBinaryProtocol(std::string_view binary_url = BINARY_URL) {
+        GetBinaryUrl() = binary_url;
     }
 
     void UpdateScore(int score) {
         this->score = score;
     }
 
-    void UploadScore() {
+    // returns false if the score could not be sent or was not accepted
+    bool UploadScore() {
+        if (UsesBinaryProtocol()) {
+            return ors_api_client::SubmitScoreBinary(GetBinaryUrl(), binaryUuid, userName, score, board);
+        }
+        int status = 0;
+        return ors_api_client::Exchange(GetUrl(), ors_api_client::Method::POST, MakeUploadScoreParams(), [&](const ors_api_client::HttpResponseParser& parser) {
+            status = parser.GetStatusCode();
+        }) && status / 100 == 2;
+    }
+
+    // queue the score for the shared batch uploader instead of sending a request right away
+    void SubmitScore() {
+        GetBatchUploader().Submit(uuid, userName, score, board);
+    }
+
+    static ors_api_client::BatchUploader& GetBatchUploader() {
+        static ors_api_client::BatchUploader batch_uploader(GetUrl());
+        return batch_uploader;
+    }
+
+    // window is ALL_TIME, HOURLY, DAILY or WEEKLY. The binary protocol has the all-time rankings only,
+    // the windows are asked for over HTTP
+    json GetMyRanking(std::string_view window = ALL_TIME) {
+        if (UsesBinaryProtocol() && window == ALL_TIME) {
+            return ors_api_client::GetMyRankingBinary(GetBinaryUrl(), binaryUuid, board);
+        }
+        return ors_api_client::Request(GetUrl(), ors_api_client::Method::GET, MakeMyRankingParams(window));
+    }
+
+    json GetTopRanking(int limit = 3, std::string_view window = ALL_TIME) {
+        if (UsesBinaryProtocol() && window == ALL_TIME) {
+            return ors_api_client::GetTopRankingBinary(GetBinaryUrl(), limit < 0 ? ors_binary_protocol::ALL_ENTRIES : static_cast<std::uint32_t>(limit), board);
+        }
+        return ors_api_client::Request(GetUrl(), ors_api_client::Method::GET, MakeTopRankingParams(limit, board, window));
+    }
+
+    // the same rankings decoded into flat entries instead of json, without building a DOM for them
+    // entries is overwritten, returns false if no ranking was received
+    bool GetMyRanking(std::vector<ors_api_client::RankingEntry>* entries, std::string_view window = ALL_TIME) {
+        if (UsesBinaryProtocol() && window == ALL_TIME) {
+            return ors_api_client::GetMyRankingBinary(GetBinaryUrl(), binaryUuid, entries, board);
+        }
+        return ors_api_client::RequestRanking(GetUrl(), MakeMyRankingParams(window), entries);
+    }
+
+    bool GetTopRanking(int limit, std::vector<ors_api_client::RankingEntry>* entries, std::string_view window = ALL_TIME) {
+        if (UsesBinaryProtocol() && window == ALL_TIME) {
+            return ors_api_client::GetTopRankingBinary(GetBinaryUrl(), limit < 0 ? ors_binary_protocol::ALL_ENTRIES : static_cast<std::uint32_t>(limit), entries, board);
+        }
+        return ors_api_client::RequestRanking(GetUrl(), MakeTopRankingParams(limit, board, window), entries);
+    }
+
+    // page_size entries of the ranking of board after cursor, the "next" of the previous page, from the top without one
+    // {entries: [{rank, log_time, uuid, user_name, score}, ...], next: {score, uuid}}, next is null on the last page
+    static json GetRankingPage(int page_size = 100, const json& cursor = json(), std::string_view board = DEFAULT_BOARD) {
+        return ors_api_client::Request(GetUrl(), ors_api_client::Method::GET, MakeRankingPageParams(page_size, cursor, board));
+    }
+
+    // own rank, percentile, number of ranked players and the around players above and below
+    // {rank, percentile, total, entries: [{rank, log_time, uuid, user_name, score}, ...]}, {} if not ranked yet
+    json GetNeighborhood(int around = 5) {
+        return ors_api_client::Request(GetUrl(), ors_api_client::Method::GET, MakeNeighborhoodParams(around));
+    }
+
+    // ranks and scores of up to MAX_RANKS players of board in one request, e.g. for a friends list
+    // {entries: [{rank, log_time, uuid, user_name, score}, ...]} in ranking order, players that are not ranked are left out
+    static json GetRanks(const std::vector<std::string>& uuids, std::string_view board = DEFAULT_BOARD, std::string_view window = ALL_TIME) {
+        return ors_api_client::Request(GetRanksUrl(), ors_api_client::Method::POST, MakeRanksParams(uuids, board, window));
+    }
+
+    // the same decoded into flat entries, entries is overwritten, returns false if no ranking was received
+    static bool GetRanks(const std::vector<std::string>& uuids, std::vector<ors_api_client::RankingEntry>* entries, std::string_view board = DEFAULT_BOARD, std::string_view window = ALL_TIME) {
+        return ors_api_client::RequestRanking(GetRanksUrl(), MakeRanksParams(uuids, board, window), entries, ors_api_client::Method::POST);
+    }
+
+    // ranks of many users and the top ranking of board in one pipelined round trip, e.g. for a lobby screen
+    // result[i] is GetMyRanking() of users[i], the last element is GetTopRanking(limit)
+    static std::vector<json> GetLobbyRanking(const std::vector<const UserData*>& users, int limit = 3, std::string_view board = DEFAULT_BOARD) {
+        std::vector<ors_api_client::PipelinedRequest> requests;
+        requests.reserve(users.size() + 1);
+        for (const auto* user : users) {
+            requests.push_back({ ors_api_client::Method::GET, user->MakeMyRankingParams() });
+        }
+        requests.push_back({ ors_api_client::Method::GET, MakeTopRankingParams(limit, board) });
+        return ors_api_client::RequestPipelined(GetUrl(), requests);
+    }
+
+    // non-blocking variants, the result is delivered through the future
+    std::future<json> UploadScoreAsync() {
+        return ors_api_client::RequestAsync(GetUrl(), ors_api_client::Method::POST, MakeUploadScoreParams());
+    }
+
+    std::future<json> GetMyRankingAsync(std::string_view window = ALL_TIME) {
+        return ors_api_client::RequestAsync(GetUrl(), ors_api_client::Method::GET, MakeMyRankingParams(window));
+    }
+
+    std::future<json> GetTopRankingAsync(int limit = 3, std::string_view window = ALL_TIME) {
+        return ors_api_client::RequestAsync(GetUrl(), ors_api_client::Method::GET, MakeTopRankingParams(limit, board, window));
+    }
+
+    // request counters and the latencies of resolve, connect, send, first byte, body parse and whole requests
+    // of all requests of the process (HTTP, binary and async), e.g. stats.Get(Stage::FIRST_BYTE).GetPercentileUs(99)
+    static ors_api_client::Metrics::Snapshot GetStats() {
+        return ors_api_client::GetStats();
+    }
+
+private:
+
+    static std::string& GetUrl() {
+        static std::string url = URL;
+        return url;
+    }
+
+    static std::string GetRanksUrl() {
+        return GetUrl() + "/ranks";
+    }
+
+    static std::string& GetBinaryUrl() {
+        static std::string binary_url;
+        return binary_url;
+    }
+
+    // the binary protocol carries uuids as 16 bytes, a uuid without that form stays on HTTP
+    bool UsesBinaryProtocol() const {
+        return hasBinaryUuid && !GetBinaryUrl().empty();
+    }
+
+    json MakeUploadScoreParams() const {
         json params;
         params["uuid"]      = uuid;
         params["user_name"] = userName;
         params["score"]     = score;
-        ors_api_client::Request(URL, ors_api_client::Method::POST, params);
+        params["board"]     = board;
+        return params;
     }
 
-    json GetMyRanking() {
+    json MakeMyRankingParams(std::string_view window = ALL_TIME) const {
         json params;
-        params["uuid"] = uuid;
-        return ors_api_client::Request(URL, ors_api_client::Method::GET, params);
+        params["uuid"]  = uuid;
+        params["board"] = board;
+        AddWindow(window, &params);
+        return params;
     }
 
-    json GetTopRanking(int limit = 3) {
+    json MakeNeighborhoodParams(int around) const {
+        json params;
+        params["uuid"]   = uuid;
+        params["around"] = std::to_string((std::max)(around, 0));
+        params["board"]  = board;
+        return params;
+    }
+
+    static json MakeRankingPageParams(int page_size, const json& cursor, std::string_view board) {
+        json params;
+        params["page_size"] = std::to_string((std::max)(page_size, 1));
+        params["board"]     = board;
+        if (cursor.is_object() && cursor.contains("score") && cursor.contains("uuid")) {
+            params["after_score"] = std::to_string(cursor["score"].get<std::int64_t>());
+            params["after_uuid"]  = cursor["uuid"].get<std::string>();
+        }
+        return params;
+    }
+
+    static json MakeRanksParams(const std::vector<std::string>& uuids, std::string_view board, std::string_view window) {
+        json params;
+        params["uuids"] = uuids;
+        params["board"] = board;
+        AddWindow(window, &params);
+        return params;
+    }
+
+    static json MakeTopRankingParams(int limit, std::string_view board, std::string_view window = ALL_TIME) {
         json params;
         params["limit"] = std::to_string(limit);
-        return ors_api_client::Request(URL, ors_api_client::Method::GET, params);
+        params["board"] = board;
+        AddWindow(window, &params);
+        return params;
     }
 
-private:
+    // the all-time ranking is the one of requests without a window
+    static void AddWindow(std::string_view window, json* params) {
+        if (window != ALL_TIME) {
+            (*params)["window"] = window;
+        }
+    }
 
     std::string GetUuid() {
+#ifdef _WIN32
         GUID guid = GUID_NULL;
         if (FAILED(CoCreateGuid(&guid))) {
             return "";
@@ -52,10 +248,33 @@ private:
             return wide_to_sjis((PWCHAR)str);
         }
         return "";
+#else
+        // random (version 4) uuid in the same lowercase form as UuidToString
+        std::random_device random_device;
+        std::uniform_int_distribution<int> distribution(0, 255);
+        std::array<std::uint8_t, 16> bytes{};
+        for (auto& byte : bytes) {
+            byte = static_cast<std::uint8_t>(distribution(random_device));
+        }
+        bytes[6] = (bytes[6] & 0x0f) | 0x40;
+        bytes[8] = (bytes[8] & 0x3f) | 0x80;
+
+        std::string str;
+        for (std::size_t i = 0; i < bytes.size(); ++i) {
+            if (i == 4 || i == 6 || i == 8 || i == 10) {
+                str += '-';
+            }
+            str += std::format("{:02x}", bytes[i]);
+        }
+        return str;
+#endif
     }
 
-    std::string uuid;
-    std::string userName;
-    int         score;
+    std::string               uuid;
+    std::string               userName;
+    int                       score;
+    std::string               board;
+    ors_binary_protocol::Uuid binaryUuid{};
+    bool                      hasBinaryUuid = false;
 
 };
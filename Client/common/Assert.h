@@ -13,7 +13,11 @@
 #ifndef GAME_LIBRARIES_UTILITY_ASSERT_H_
 #define GAME_LIBRARIES_UTILITY_ASSERT_H_
 
+#ifdef _WIN32
 #include <crtdbg.h>
+#else
+#include <cstdio>
+#endif
 #include <stdexcept>
 #include <string_view>
 
@@ -29,6 +33,23 @@ namespace assert {
     #define ASSERT_FILE_LINE __FILE__, __LINE__
 
 #ifdef _DEBUG
+    /**
+     * @brief Report a message to the visual studio output, or to stderr outside of Windows.
+     * @param error Whether the message is an error, errors also open the popup window on Windows.
+     * @param file File name.
+     * @param line Line number.
+     * @param label Label printed before the message.
+     * @param message Message to display.
+     */
+    inline void Report(bool error, char const* file, int line, char const* label, std::string_view message) {
+#ifdef _WIN32
+        _CrtDbgReport(error ? _CRT_ERROR : _CRT_WARN, file, line, NULL, "%s: %.*s\n", label, static_cast<int>(message.size()), message.data());
+#else
+        (void)error;
+        std::fprintf(stderr, "%s(%d): %s: %.*s\n", file, line, label, static_cast<int>(message.size()), message.data());
+#endif
+    }
+
     /**
      * @brief Show an info message.
      * @param file File name.
@@ -36,7 +57,7 @@ namespace assert {
      * @param message Message to display in the visual studio output.
      */
     inline void ShowInfo(char const* file, int line, std::string_view message) {
-        _CrtDbgReport(_CRT_WARN, file, line, NULL, "info: %s\n", message.data());
+        Report(false, file, line, "info", message);
     }
     /**
      * @brief Show an info message.
@@ -53,7 +74,7 @@ namespace assert {
      * @param message Message to display in the visual studio output.
      */
     inline void ShowWarning(char const* file, int line, std::string_view message) {
-        _CrtDbgReport(_CRT_WARN, file, line, NULL, "warning: %s\n", message.data());
+        Report(false, file, line, "warning", message);
     }
     /**
      * @brief Show a warning message.
@@ -70,7 +91,7 @@ namespace assert {
      * @param message Message to display in the visual studio output and in the popup window.
      */
     inline void ShowError(char const* file, int line, std::string_view message) {
-        _CrtDbgReport(_CRT_ERROR, file, line, NULL, "error: %s\n", message.data());
+        Report(true, file, line, "error", message);
     }
     /**
      * @brief Show an error message.
@@ -13,10 +13,25 @@
 #ifndef GAME_LIBRARIES_EXTERNALDEPENDENCIES_SOCKET_SOCKETHELPER_H_
 #define GAME_LIBRARIES_EXTERNALDEPENDENCIES_SOCKET_SOCKETHELPER_H_
 
+#include <algorithm>
 #include <cassert>
+#include <chrono>
+#include <climits>
+#include <cstddef>
 #include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <span>
 #include <string>
 #include <string_view>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @brief The backend is selected at compile time: WinSock on Windows, POSIX sockets with epoll elsewhere.
+ */
+#ifdef _WIN32
 #ifdef _WINSOCKAPI_
 #error Please include SocketHelper.h before winsock.h (Maybe in Windows.h)
 #endif
@@ -24,14 +39,40 @@
 #include <WS2tcpip.h>
 #pragma comment(lib, "ws2_32.lib")
 #include <Windows.h>
+#else
+#include <cerrno>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
 
 #include "Convert.h"
 #include "Assert.h"
 #include "Macro.h"
 
+#ifdef _WIN32
 #include "strconv.h"
 
 #undef GetAddrInfo
+#else
+/**
+ * @brief WinSock names used by the socket_helper API, mapped to their POSIX counterparts.
+ */
+using SOCKET      = int;
+using ADDRINFO    = addrinfo;
+using SOCKADDR    = sockaddr;
+using SOCKADDR_IN = sockaddr_in;
+constexpr SOCKET INVALID_SOCKET = -1;
+constexpr int    SOCKET_ERROR   = -1;
+#endif
 
 /**
  * @namespace socket_helper
@@ -48,7 +89,11 @@ namespace socket_helper {
 
     MACRO_NAMESPACE_EXTERNAL_BEGIN
     MACRO_NAMESPACE_INTERNAL_BEGIN
-    inline std::string GetWSAErrorDetail() {
+#ifdef _WIN32
+    inline int GetLastError() {
+        return WSAGetLastError();
+    }
+    inline std::string GetErrorDetail() {
         LPVOID msg_buf = nullptr;
         FormatMessage(
             FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS, NULL,
@@ -58,22 +103,101 @@ namespace socket_helper {
         LocalFree(msg_buf);
         return error_detail;
     }
+    inline bool IsWouldBlock(int err) {
+        return err == WSAEWOULDBLOCK;
+    }
+    inline bool IsInProgress(int err) {
+        return err == WSAEWOULDBLOCK;
+    }
+    inline int CloseSocket(SOCKET sock) {
+        return closesocket(sock);
+    }
+    inline int SetBlockingMode(SOCKET sock, bool blocking) {
+        u_long mode = blocking ? 0 : 1;
+        return ioctlsocket(sock, FIONBIO, &mode);
+    }
+    inline bool WaitWritable(SOCKET sock, int time_out_ms) {
+        fd_set writefds{}, exceptfds{};
+        timeval timeout{};
+        FD_ZERO(&writefds);
+        FD_ZERO(&exceptfds);
+        FD_SET(sock, &writefds);
+        FD_SET(sock, &exceptfds);
+        timeout.tv_sec  = time_out_ms / 1000;
+        timeout.tv_usec = convert::MSToUS(time_out_ms % 1000);
+
+        // a failed connect is reported in exceptfds, GetSocketError tells the reason
+        return select(static_cast<int>(sock + 1), nullptr, &writefds, &exceptfds, &timeout) > 0;
+    }
+    using PollFd = WSAPOLLFD;
+    inline int Poll(PollFd* fds, std::size_t count, int time_out_ms) {
+        return WSAPoll(fds, static_cast<ULONG>(count), time_out_ms);
+    }
+#else
+    inline int GetLastError() {
+        return errno;
+    }
+    inline std::string GetErrorDetail() {
+        return std::strerror(errno);
+    }
+    inline bool IsWouldBlock(int err) {
+        return err == EAGAIN || err == EWOULDBLOCK;
+    }
+    inline bool IsInProgress(int err) {
+        return err == EINPROGRESS;
+    }
+    inline int CloseSocket(SOCKET sock) {
+        return close(sock);
+    }
+    inline int SetBlockingMode(SOCKET sock, bool blocking) {
+        int flags = fcntl(sock, F_GETFL, 0);
+        if (flags == -1) {
+            return -1;
+        }
+        return fcntl(sock, F_SETFL, blocking ? (flags & ~O_NONBLOCK) : (flags | O_NONBLOCK));
+    }
+    inline bool WaitWritable(SOCKET sock, int time_out_ms) {
+        // one-shot epoll instance per waiting thread, the socket is only registered while waiting
+        thread_local int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        epoll_event event{};
+        event.events  = EPOLLOUT;
+        event.data.fd = sock;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, sock, &event) == -1) {
+            return false;
+        }
+        int ready = 0;
+        do {
+            ready = epoll_wait(epoll_fd, &event, 1, time_out_ms);
+        } while (ready == -1 && errno == EINTR);
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, sock, nullptr);
+        // EPOLLERR and EPOLLHUP are always reported, GetSocketError tells the reason
+        return ready > 0;
+    }
+    using PollFd = pollfd;
+    inline int Poll(PollFd* fds, std::size_t count, int time_out_ms) {
+        return poll(fds, static_cast<nfds_t>(count), time_out_ms);
+    }
+#endif
     inline std::string MakeErrorDetails(std::string_view detail, int err) {
-        return std::string(detail) + "Error code: " + std::to_string(err) + "(" + std::to_string(WSAGetLastError()) + ")\n" + GetWSAErrorDetail();
+        return std::string(detail) + "Error code: " + std::to_string(err) + "(" + std::to_string(GetLastError()) + ")\n" + GetErrorDetail();
     }
-    inline std::string CheckRecvData(char* buf, int recv_byte) {
-        if (recv_byte) {
-            if (recv_byte > BUFFER) {
-                assert::ShowError(ASSERT_FILE_LINE, "Buffer overflow.");
-            }
-            buf[recv_byte] = '\0';
+    inline std::string CheckRecvData(const char* buf, int recv_byte) {
+        // 0: connection closed, SOCKET_ERROR: failed
+        if (recv_byte > 0) {
+            // the length is passed explicitly, a terminating '\0' would not fit after a full buffer
             return std::string(buf, recv_byte);
         }
         return std::string();
     }
+    inline void SetNoDelay(SOCKET sock) {
+        // requests and responses are small, do not wait for more data to coalesce (Nagle)
+        int no_delay = 1;
+        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&no_delay), sizeof(no_delay));
+    }
     MACRO_NAMESPACE_INTERNAL_END
 
     inline SOCKET Create(int family = IPv4, int type = TCP, int protocol = 0) {
+#ifdef _WIN32
         WSADATA wsa_data{};
         SecureZeroMemory(&wsa_data, sizeof(wsa_data));
 
@@ -93,6 +217,7 @@ namespace socket_helper {
             }
             return SOCKET();
         }
+#endif
 
         if (!protocol) {
             if (type == TCP) {
@@ -103,40 +228,78 @@ namespace socket_helper {
             }
         }
 
-        return socket(family, type, protocol);
+#ifdef _WIN32
+        SOCKET sock = socket(family, type, protocol);
+#else
+        SOCKET sock = socket(family, type | SOCK_CLOEXEC, protocol);
+#endif
+        if (sock != INVALID_SOCKET && type == TCP) {
+            detail::SetNoDelay(sock);
+        }
+        return sock;
     }
 
     inline void Close(SOCKET* sock, bool wsa_cleanup = true) {
-        if (MACRO_FAIL_CHECK(closesocket(*sock), err)) {
+#ifndef _WIN32
+        // 0 is a valid descriptor on POSIX, closed sockets are marked with INVALID_SOCKET
+        if (*sock == INVALID_SOCKET) return;
+#endif
+        if (MACRO_FAIL_CHECK(detail::CloseSocket(*sock), err)) {
             assert::ShowError(ASSERT_FILE_LINE, detail::MakeErrorDetails("closesocket failed.", err));
             return;
         }
+#ifdef _WIN32
         *sock = SOCKET();
         if (!wsa_cleanup) return;
         if (MACRO_FAIL_CHECK(WSACleanup(), err)) {
             assert::ShowError(ASSERT_FILE_LINE, detail::MakeErrorDetails("WSACleanup failed.", err));
         }
+#else
+        (void)wsa_cleanup;
+        *sock = INVALID_SOCKET;
+#endif
     }
 
     inline void SetNonBlocking(SOCKET* sock) {
-        u_long mode = 1;
-        if (MACRO_FAIL_CHECK(ioctlsocket(*sock, FIONBIO, &mode), err)) {
+        if (MACRO_FAIL_CHECK(detail::SetBlockingMode(*sock, false), err)) {
             assert::ShowError(ASSERT_FILE_LINE, detail::MakeErrorDetails("non-blocking mode failed.", err));
         }
     }
     inline void SetBlocking(SOCKET* sock) {
-        u_long mode = 0;
-        if (MACRO_FAIL_CHECK(ioctlsocket(*sock, FIONBIO, &mode), err)) {
+        if (MACRO_FAIL_CHECK(detail::SetBlockingMode(*sock, true), err)) {
             assert::ShowError(ASSERT_FILE_LINE, detail::MakeErrorDetails("blocking mode failed.", err));
         }
     }
 
     inline void Bind(SOCKET* sock, const ADDRINFO& addr_info) {
-        if (MACRO_FAIL_CHECK(bind(*sock, addr_info.ai_addr, convert::SizeOf<int>(*addr_info.ai_addr)), err)) {
+#ifndef _WIN32
+        // allow restarting a server while connections of the previous process are in TIME_WAIT
+        int reuse_addr = 1;
+        setsockopt(*sock, SOL_SOCKET, SO_REUSEADDR, &reuse_addr, sizeof(reuse_addr));
+#endif
+        if (MACRO_FAIL_CHECK(bind(*sock, addr_info.ai_addr, static_cast<int>(addr_info.ai_addrlen)), err)) {
             assert::ShowError(ASSERT_FILE_LINE, detail::MakeErrorDetails("bind failed.", err));
         }
     }
 
+    /**
+     * @brief Lets several sockets bind the same address, the kernel spreads incoming connections across them.
+     *
+     * Must be called before Bind on every socket sharing the address.
+     *
+     * @param sock The socket to configure.
+     * @return false if SO_REUSEPORT is not available (Windows), the caller has to share one listening socket then.
+     */
+    inline bool SetReusePort(SOCKET* sock) {
+#ifdef SO_REUSEPORT
+        int reuse_port = 1;
+        return setsockopt(*sock, SOL_SOCKET, SO_REUSEPORT, &reuse_port, sizeof(reuse_port)) == 0;
+#else
+        (void)sock;
+        return false;
+#endif
+    }
+
     inline void Listen(SOCKET* sock, int backlog) {
         if (MACRO_FAIL_CHECK(listen(*sock, backlog), err)) {
             assert::ShowError(ASSERT_FILE_LINE, detail::MakeErrorDetails("listen failed.", err));
@@ -144,19 +307,42 @@ namespace socket_helper {
     }
 
     inline SOCKET Accept(SOCKET* sock, ADDRINFO* addr_info) {
+#ifdef _WIN32
         SecureZeroMemory(addr_info, sizeof(*addr_info));
         int size = convert::SizeOf<int>(*addr_info->ai_addr);
-        return accept(*sock, addr_info->ai_addr, &size);
+        SOCKET client = accept(*sock, addr_info->ai_addr, &size);
+#else
+        *addr_info = ADDRINFO{};
+        SOCKET client = accept4(*sock, nullptr, nullptr, SOCK_CLOEXEC);
+#endif
+        if (client != INVALID_SOCKET) {
+            detail::SetNoDelay(client);
+        }
+        return client;
+    }
+
+    /**
+     * @brief Returns the pending error of a socket (SO_ERROR), e.g. the result of a non-blocking connect.
+     * @param sock The socket to query.
+     * @return 0 if there is no error, otherwise the error code.
+     */
+    inline int GetSocketError(SOCKET sock) {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        if (getsockopt(sock, SOL_SOCKET, SO_ERROR, reinterpret_cast<char*>(&err), &len) == SOCKET_ERROR) {
+            return detail::GetLastError();
+        }
+        return err;
     }
 
     inline bool Connect(SOCKET* sock, const ADDRINFO& addr_info, int time_out_ms = 0) {
         if (time_out_ms) {
             SetNonBlocking(sock);
-            if (MACRO_FAIL_CHECK(connect(*sock, addr_info.ai_addr, convert::SizeOf<int>(*addr_info.ai_addr)), err)) {
+            if (MACRO_FAIL_CHECK(connect(*sock, addr_info.ai_addr, static_cast<int>(addr_info.ai_addrlen)), err)) {
                 if (err == SOCKET_ERROR) {
-                    err = WSAGetLastError();
-                    SetBlocking(sock);
-                    if (err != WSAEWOULDBLOCK) {
+                    err = detail::GetLastError();
+                    if (!detail::IsInProgress(err)) {
+                        SetBlocking(sock);
                         assert::ShowError(ASSERT_FILE_LINE, detail::MakeErrorDetails("Unexpected error occurred.", err));
                         return false;
                     }
@@ -167,28 +353,18 @@ namespace socket_helper {
                 }
             }
 
-            fd_set readfds{}, writefds{}, exceptfds{};
-            timeval timeout{};
-            FD_ZERO(&readfds);
-            FD_ZERO(&writefds);
-            FD_ZERO(&exceptfds);
-            FD_SET(*sock, &readfds);
-            FD_SET(*sock, &writefds);
-            FD_SET(*sock, &exceptfds);
-            SecureZeroMemory(&timeout, sizeof(timeout));
-            timeout.tv_usec = convert::MSToUS(time_out_ms);
-
-            // if return 0 timeout
-            if (MACRO_SUCCESS_CHECK(select(convert::SizeOf<int>(*sock + 1), &readfds, &writefds, &exceptfds, &timeout), err)) {
-                assert::ShowWarning(ASSERT_FILE_LINE, "Timeout: " + std::string(addr_info.ai_canonname));
+            // if not writable within the timeout
+            if (!detail::WaitWritable(*sock, time_out_ms)) {
+                SetBlocking(sock);
+                assert::ShowWarning(ASSERT_FILE_LINE, "Timeout: " + std::string(addr_info.ai_canonname ? addr_info.ai_canonname : ""));
                 return false;
             }
-            if (FD_ISSET(*sock, &readfds) || FD_ISSET(*sock, &writefds)) {
-                return true;
-            }
+            // restore blocking mode so that Send/Recv behave the same as after a plain connect
+            SetBlocking(sock);
+            return GetSocketError(*sock) == 0;
         }
         else {
-            if (MACRO_FAIL_CHECK(connect(*sock, addr_info.ai_addr, convert::SizeOf<int>(*addr_info.ai_addr)), err)) {
+            if (MACRO_FAIL_CHECK(connect(*sock, addr_info.ai_addr, static_cast<int>(addr_info.ai_addrlen)), err)) {
                 assert::ShowError(ASSERT_FILE_LINE, detail::MakeErrorDetails("Cannot connect.", err));
                 return false;
             }
@@ -196,60 +372,705 @@ namespace socket_helper {
                 return true;
             }
         }
-        return false;
+    }
+
+    /**
+     * @brief Checks whether an idle connection can still be used.
+     *
+     * An idle connection must not have anything to read. If it is readable, the peer has either closed it
+     * (recv would return 0) or sent unexpected data, and in both cases it must not be reused.
+     *
+     * @param sock The connected socket to check.
+     * @return true if the connection is still open and has no pending data.
+     */
+    inline bool IsConnectionAlive(SOCKET sock) {
+#ifdef _WIN32
+        fd_set readfds{};
+        timeval timeout{};
+        FD_ZERO(&readfds);
+        FD_SET(sock, &readfds);
+
+        // zero timeout, only poll the current state
+        return select(static_cast<int>(sock + 1), &readfds, nullptr, nullptr, &timeout) == 0;
+#else
+        // nothing to read means alive, without consuming anything
+        char c;
+        return recv(sock, &c, 1, MSG_PEEK | MSG_DONTWAIT) == -1 && detail::IsWouldBlock(errno);
+#endif
     }
 
     inline int Send(SOCKET sock, std::string_view data) {
+#ifdef _WIN32
         return send(sock, data.data(), static_cast<int>(data.size()), 0);
+#else
+        // a closed peer is reported as EPIPE instead of raising SIGPIPE
+        return static_cast<int>(send(sock, data.data(), data.size(), MSG_NOSIGNAL));
+#endif
     }
     inline int Send(SOCKET sock, std::string_view data, const SOCKADDR& sock_addr) {
-        return sendto(sock, data.data(), static_cast<int>(data.size()), 0, &sock_addr, sizeof(sock_addr));
+        return static_cast<int>(sendto(sock, data.data(), static_cast<int>(data.size()), 0, &sock_addr, sizeof(sock_addr)));
+    }
+
+    /**
+     * @brief Maximum number of buffers of one SendV call.
+     */
+    inline constexpr std::size_t MAX_SEND_BUFFERS = 16;
+
+    /**
+     * @brief Sends several buffers with one call (scatter/gather I/O), as if they were one concatenated buffer.
+     *
+     * Lets a message whose parts live in different buffers, e.g. a header and a body, go out in one segment
+     * without copying the parts together first.
+     *
+     * @param sock The socket to send on.
+     * @param buffers The buffers in sending order, the ones after the first MAX_SEND_BUFFERS are not sent.
+     * @return The number of bytes sent, or SOCKET_ERROR.
+     */
+    inline int SendV(SOCKET sock, std::span<const std::string_view> buffers) {
+        auto count = (std::min)(buffers.size(), MAX_SEND_BUFFERS);
+#ifdef _WIN32
+        WSABUF wsa_buffers[MAX_SEND_BUFFERS];
+        for (std::size_t i = 0; i < count; ++i) {
+            wsa_buffers[i].buf = const_cast<CHAR*>(buffers[i].data());
+            wsa_buffers[i].len = static_cast<ULONG>(buffers[i].size());
+        }
+        DWORD sent = 0;
+        if (WSASend(sock, wsa_buffers, static_cast<DWORD>(count), &sent, 0, nullptr, nullptr) != 0) {
+            return SOCKET_ERROR;
+        }
+        return static_cast<int>(sent);
+#else
+        iovec io_vectors[MAX_SEND_BUFFERS];
+        for (std::size_t i = 0; i < count; ++i) {
+            io_vectors[i].iov_base = const_cast<char*>(buffers[i].data());
+            io_vectors[i].iov_len  = buffers[i].size();
+        }
+        msghdr message{};
+        message.msg_iov    = io_vectors;
+        message.msg_iovlen = count;
+        // a closed peer is reported as EPIPE instead of raising SIGPIPE
+        return static_cast<int>(sendmsg(sock, &message, MSG_NOSIGNAL));
+#endif
     }
 
     inline std::string Recv(SOCKET sock) {
         char buf[BUFFER];
-        return detail::CheckRecvData(buf, recv(sock, buf, BUFFER, 0));
+        return detail::CheckRecvData(buf, static_cast<int>(recv(sock, buf, BUFFER, 0)));
     }
     inline std::string Recv(SOCKET sock, ADDRINFO* addr_info) {
         char buf[BUFFER];
-        int size = convert::SizeOf<int>(*addr_info->ai_addr);
-        return detail::CheckRecvData(buf, recvfrom(sock, buf, BUFFER, 0, addr_info->ai_addr, &size));
+        socklen_t size = sizeof(*addr_info->ai_addr);
+        return detail::CheckRecvData(buf, static_cast<int>(recvfrom(sock, buf, BUFFER, 0, addr_info->ai_addr, &size)));
     }
 
-    inline bool GetAddrInfo(std::string_view host, PORT port, ADDRINFO* addr_info) {
-        SecureZeroMemory(addr_info, sizeof(*addr_info));
+    /**
+     * @brief Outcome of a receive into a caller-provided buffer.
+     */
+    enum class RecvStatus {
+        OK,          // at least one byte was received
+        CLOSED,      // the peer closed the connection
+        WOULD_BLOCK, // nothing to receive yet on a non-blocking socket
+        FAILED,      // the receive failed, the socket should be closed
+    };
+
+    struct RecvResult {
+        std::size_t bytes  = 0;
+        RecvStatus  status = RecvStatus::FAILED;
+    };
+
+    /**
+     * @brief Receives into a caller-provided buffer without allocating.
+     * @param sock The socket to receive from.
+     * @param buf The buffer to receive into.
+     * @return The number of bytes received and whether the receive succeeded.
+     */
+    inline RecvResult Recv(SOCKET sock, std::span<std::byte> buf) {
+        int len = static_cast<int>((std::min)(buf.size(), static_cast<std::size_t>(INT_MAX)));
+        int recv_byte = static_cast<int>(recv(sock, reinterpret_cast<char*>(buf.data()), len, 0));
+#ifndef _WIN32
+        // interrupted by a signal before anything was received
+        while (recv_byte == SOCKET_ERROR && errno == EINTR) {
+            recv_byte = static_cast<int>(recv(sock, reinterpret_cast<char*>(buf.data()), len, 0));
+        }
+#endif
+        if (recv_byte > 0) {
+            return { static_cast<std::size_t>(recv_byte), RecvStatus::OK };
+        }
+        if (recv_byte == 0) {
+            return { 0, RecvStatus::CLOSED };
+        }
+        return { 0, detail::IsWouldBlock(detail::GetLastError()) ? RecvStatus::WOULD_BLOCK : RecvStatus::FAILED };
+    }
+
+    /**
+     * @class RecvBuffer
+     * @brief Growable receive buffer that is reused for the lifetime of a connection.
+     *
+     * Received bytes are appended at the back and consumed from the front. Unconsumed bytes are moved to the
+     * front before the storage grows, so once a connection has seen its largest message it receives without
+     * heap allocations.
+     */
+    class RecvBuffer {
+    public:
+
+        explicit RecvBuffer(std::size_t capacity = BUFFER)
+            : storage(capacity)
+        {}
+
+        /**
+         * @brief Returns the received bytes that have not been consumed yet.
+         */
+        std::string_view Data() const {
+            return std::string_view(reinterpret_cast<const char*>(storage.data()) + begin, end - begin);
+        }
 
-        ADDRINFO* result = nullptr, * next = nullptr;
+        std::size_t Size() const {
+            return end - begin;
+        }
+
+        bool Empty() const {
+            return begin == end;
+        }
+
+        /**
+         * @brief Returns free space at the back, at least min_size bytes.
+         * @param min_size The minimum number of bytes the caller wants to receive.
+         * @return The free space, pass the number of bytes written into it to Commit.
+         */
+        std::span<std::byte> Prepare(std::size_t min_size = BUFFER) {
+            if (storage.size() - end < min_size) {
+                // reclaim the consumed front first, grow only if that is not enough
+                if (begin) {
+                    std::memmove(storage.data(), storage.data() + begin, end - begin);
+                    end  -= begin;
+                    begin = 0;
+                }
+                if (storage.size() - end < min_size) {
+                    storage.resize((std::max)(storage.size() * 2, end + min_size));
+                }
+            }
+            return std::span<std::byte>(storage.data() + end, storage.size() - end);
+        }
+
+        /**
+         * @brief Appends bytes written into the space returned by Prepare.
+         * @param size The number of bytes written.
+         */
+        void Commit(std::size_t size) {
+            end += size;
+        }
+
+        /**
+         * @brief Drops bytes from the front.
+         * @param size The number of bytes to drop, at most Size().
+         */
+        void Consume(std::size_t size) {
+            begin += size;
+            if (begin == end) {
+                begin = end = 0;
+            }
+        }
+
+        /**
+         * @brief Drops all bytes, the storage is kept.
+         */
+        void Clear() {
+            begin = end = 0;
+        }
+
+    private:
+
+        std::vector<std::byte> storage;
+        std::size_t            begin = 0;
+        std::size_t            end   = 0;
+
+    };
+
+    /**
+     * @brief Receives into the free space at the back of a RecvBuffer.
+     * @param sock The socket to receive from.
+     * @param buf The buffer to append to.
+     * @return The number of bytes received and whether the receive succeeded.
+     */
+    inline RecvResult Recv(SOCKET sock, RecvBuffer* buf) {
+        RecvResult result = Recv(sock, buf->Prepare());
+        buf->Commit(result.bytes);
+        return result;
+    }
+
+    /**
+     * @brief Checks whether the last failed operation on a non-blocking socket only needs to be retried later.
+     * @return true if the last error was WSAEWOULDBLOCK (EAGAIN / EWOULDBLOCK on POSIX).
+     */
+    inline bool IsWouldBlock() {
+        return detail::IsWouldBlock(detail::GetLastError());
+    }
+
+    /**
+     * @brief Starts a connect on a socket that is switched to non-blocking mode.
+     *
+     * The connection is established when the socket becomes writable, GetSocketError tells whether it succeeded.
+     *
+     * @param sock The socket to connect.
+     * @param addr_info The address to connect to.
+     * @return true if the connection is established or in progress.
+     */
+    inline bool BeginConnect(SOCKET* sock, const ADDRINFO& addr_info) {
+        SetNonBlocking(sock);
+        if (MACRO_FAIL_CHECK(connect(*sock, addr_info.ai_addr, static_cast<int>(addr_info.ai_addrlen)), err)) {
+            return detail::IsInProgress(detail::GetLastError());
+        }
+        return true;
+    }
+
+    /**
+     * @class Poller
+     * @brief Readiness notification for many sockets with an interface modeled on epoll.
+     *
+     * Implemented with epoll on POSIX and with WSAPoll on Windows. Wakeup can be called from any thread to make
+     * a blocked Wait return, it is delivered through an eventfd (a loopback UDP socket on Windows) that is watched
+     * together with the registered sockets.
+     */
+    class Poller {
+    public:
+
+        static constexpr std::uint32_t READABLE = 1 << 0;
+        static constexpr std::uint32_t WRITABLE = 1 << 1;
+        // error or hang up, reported regardless of the requested events
+        static constexpr std::uint32_t CLOSED   = 1 << 2;
+
+        struct Event {
+            SOCKET        sock;
+            std::uint32_t events;
+        };
+
+#ifdef _WIN32
+        Poller() {
+            wakeupSock = Create(IPv4, UDP);
+            SOCKADDR_IN addr{};
+            addr.sin_family      = AF_INET;
+            addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            int len = sizeof(addr);
+            // bind to an ephemeral port and connect to ourselves
+            if (bind(wakeupSock, reinterpret_cast<SOCKADDR*>(&addr), len) == SOCKET_ERROR ||
+                getsockname(wakeupSock, reinterpret_cast<SOCKADDR*>(&addr), &len) == SOCKET_ERROR ||
+                connect(wakeupSock, reinterpret_cast<SOCKADDR*>(&addr), len) == SOCKET_ERROR) {
+                assert::ShowError(ASSERT_FILE_LINE, detail::MakeErrorDetails("Poller wakeup socket failed.", WSAGetLastError()));
+            }
+            SetNonBlocking(&wakeupSock);
+            pollFds.push_back({ wakeupSock, POLLRDNORM, 0 });
+        }
+#else
+        Poller() {
+            epollFd  = epoll_create1(EPOLL_CLOEXEC);
+            wakeupFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            if (epollFd == -1 || wakeupFd == -1) {
+                assert::ShowError(ASSERT_FILE_LINE, detail::MakeErrorDetails("Poller creation failed.", errno));
+            }
+            epoll_event event{};
+            event.events  = EPOLLIN;
+            event.data.fd = wakeupFd;
+            epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeupFd, &event);
+        }
+#endif
+        Poller(const Poller&) = delete;
+        Poller& operator=(const Poller&) = delete;
+
+        ~Poller() {
+#ifdef _WIN32
+            Close(&wakeupSock);
+#else
+            close(wakeupFd);
+            close(epollFd);
+#endif
+        }
+
+        /**
+         * @brief Starts watching a socket.
+         * @param sock The socket to watch.
+         * @param events READABLE and/or WRITABLE.
+         */
+        void Add(SOCKET sock, std::uint32_t events) {
+#ifdef _WIN32
+            indices[sock] = pollFds.size();
+            pollFds.push_back({ sock, ToPollEvents(events), 0 });
+#else
+            Control(EPOLL_CTL_ADD, sock, events);
+#endif
+        }
+
+        /**
+         * @brief Changes the events watched for a socket.
+         * @param sock A socket passed to Add.
+         * @param events READABLE and/or WRITABLE.
+         */
+        void Modify(SOCKET sock, std::uint32_t events) {
+#ifdef _WIN32
+            if (auto it = indices.find(sock); it != indices.end()) {
+                pollFds[it->second].events = ToPollEvents(events);
+            }
+#else
+            Control(EPOLL_CTL_MOD, sock, events);
+#endif
+        }
+
+        /**
+         * @brief Stops watching a socket, must be called before the socket is closed.
+         * @param sock A socket passed to Add.
+         */
+        void Remove(SOCKET sock) {
+#ifdef _WIN32
+            auto it = indices.find(sock);
+            if (it == indices.end()) {
+                return;
+            }
+            // move the last entry into the hole
+            std::size_t index = it->second;
+            indices.erase(it);
+            if (index != pollFds.size() - 1) {
+                pollFds[index] = pollFds.back();
+                indices[pollFds[index].fd] = index;
+            }
+            pollFds.pop_back();
+#else
+            epoll_ctl(epollFd, EPOLL_CTL_DEL, sock, nullptr);
+#endif
+        }
+
+        /**
+         * @brief Waits until a watched socket is ready, Wakeup is called or the timeout expires.
+         * @param events Receives the ready sockets, cleared first.
+         * @param time_out_ms Timeout in milliseconds, -1 waits forever.
+         * @return The number of ready sockets.
+         */
+        int Wait(std::vector<Event>* events, int time_out_ms) {
+            events->clear();
+#ifdef _WIN32
+            if (WSAPoll(pollFds.data(), static_cast<ULONG>(pollFds.size()), time_out_ms) == SOCKET_ERROR) {
+                assert::ShowError(ASSERT_FILE_LINE, detail::MakeErrorDetails("WSAPoll failed.", WSAGetLastError()));
+                return 0;
+            }
+
+            // drain wakeup notifications
+            if (pollFds[0].revents) {
+                char buf[64];
+                while (recv(wakeupSock, buf, sizeof(buf), 0) > 0) {}
+            }
+            for (std::size_t i = 1; i < pollFds.size(); ++i) {
+                if (!pollFds[i].revents) {
+                    continue;
+                }
+                std::uint32_t ready = 0;
+                if (pollFds[i].revents & POLLRDNORM)                      ready |= READABLE;
+                if (pollFds[i].revents & POLLWRNORM)                      ready |= WRITABLE;
+                if (pollFds[i].revents & (POLLERR | POLLHUP | POLLNVAL)) ready |= CLOSED;
+                events->push_back({ pollFds[i].fd, ready });
+            }
+#else
+            epollEvents.resize((std::max)(epollEvents.size(), std::size_t(64)));
+            int count = epoll_wait(epollFd, epollEvents.data(), static_cast<int>(epollEvents.size()), time_out_ms);
+            if (count == -1) {
+                if (errno != EINTR) {
+                    assert::ShowError(ASSERT_FILE_LINE, detail::MakeErrorDetails("epoll_wait failed.", errno));
+                }
+                return 0;
+            }
+            for (int i = 0; i < count; ++i) {
+                const auto& event = epollEvents[i];
+                // drain wakeup notifications
+                if (event.data.fd == wakeupFd) {
+                    eventfd_t value;
+                    eventfd_read(wakeupFd, &value);
+                    continue;
+                }
+                std::uint32_t ready = 0;
+                if (event.events & EPOLLIN)                          ready |= READABLE;
+                if (event.events & EPOLLOUT)                         ready |= WRITABLE;
+                if (event.events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP)) ready |= CLOSED;
+                events->push_back({ event.data.fd, ready });
+            }
+            // a full buffer means more sockets may be ready, give the next call more room
+            if (static_cast<std::size_t>(count) == epollEvents.size()) {
+                epollEvents.resize(epollEvents.size() * 2);
+            }
+#endif
+            return static_cast<int>(events->size());
+        }
+
+        /**
+         * @brief Makes a blocked Wait return, can be called from any thread.
+         */
+        void Wakeup() {
+#ifdef _WIN32
+            send(wakeupSock, "", 1, 0);
+#else
+            eventfd_write(wakeupFd, 1);
+#endif
+        }
+
+    private:
+
+#ifdef _WIN32
+        static SHORT ToPollEvents(std::uint32_t events) {
+            SHORT poll_events = 0;
+            if (events & READABLE) poll_events |= POLLRDNORM;
+            if (events & WRITABLE) poll_events |= POLLWRNORM;
+            return poll_events;
+        }
+
+        SOCKET                                  wakeupSock = INVALID_SOCKET;
+        std::vector<WSAPOLLFD>                  pollFds;
+        std::unordered_map<SOCKET, std::size_t> indices;
+#else
+        void Control(int op, SOCKET sock, std::uint32_t events) {
+            epoll_event event{};
+            event.data.fd = sock;
+            // a half-closed peer is a read event, level-triggered it would be reported on every wait otherwise
+            if (events & READABLE) event.events |= EPOLLIN | EPOLLRDHUP;
+            if (events & WRITABLE) event.events |= EPOLLOUT;
+            if (epoll_ctl(epollFd, op, sock, &event) == -1) {
+                assert::ShowError(ASSERT_FILE_LINE, detail::MakeErrorDetails("epoll_ctl failed.", errno));
+            }
+        }
+
+        int                      epollFd  = -1;
+        int                      wakeupFd = -1;
+        std::vector<epoll_event> epollEvents;
+#endif
+
+    };
+
+    /**
+     * @brief Resolved addresses linked through ai_next, released with freeaddrinfo when the last owner is gone.
+     */
+    using AddressList = std::shared_ptr<const ADDRINFO>;
+
+    MACRO_NAMESPACE_INTERNAL_BEGIN
+    inline AddressList Resolve(std::string_view host, PORT port, int family) {
+        ADDRINFO* result = nullptr;
         ADDRINFO hints{};
-        SecureZeroMemory(&hints, sizeof(hints));
         hints.ai_flags    = AI_CANONNAME;
-        hints.ai_family   = AF_INET;     // IPv4限定 AF_UNSPEC:全て受け入れる
+        hints.ai_family   = family;
         hints.ai_socktype = SOCK_STREAM; // TCPで送信
         hints.ai_protocol = IPPROTO_TCP; // 受け取りをTCPに限定
 
-        if (MACRO_FAIL_CHECK(getaddrinfo(host.data(), std::to_string(port).c_str(), &hints, &result), err)) {
-            assert::ShowError(ASSERT_FILE_LINE, detail::MakeErrorDetails("Domain not found.", err));
-            return false;
+        if (MACRO_FAIL_CHECK(getaddrinfo(std::string(host).c_str(), std::to_string(port).c_str(), &hints, &result), err)) {
+            assert::ShowWarning(ASSERT_FILE_LINE, "Domain not found: " + std::string(host) + " (" + std::to_string(err) + ")");
+            return nullptr;
         }
-
         if (!result) {
+            return nullptr;
+        }
+        return AddressList(result, [](const ADDRINFO* addr_info) { freeaddrinfo(const_cast<ADDRINFO*>(addr_info)); });
+    }
+    // alternate address families in the order getaddrinfo preferred them (RFC 8305 section 4)
+    inline std::vector<const ADDRINFO*> InterleaveFamilies(const ADDRINFO& addr_list) {
+        std::vector<const ADDRINFO*> preferred, others;
+        for (const ADDRINFO* next = &addr_list; next; next = next->ai_next) {
+            (next->ai_family == addr_list.ai_family ? preferred : others).push_back(next);
+        }
+        std::vector<const ADDRINFO*> candidates;
+        for (std::size_t i = 0; i < (std::max)(preferred.size(), others.size()); ++i) {
+            if (i < preferred.size()) candidates.push_back(preferred[i]);
+            if (i < others.size())    candidates.push_back(others[i]);
+        }
+        return candidates;
+    }
+    MACRO_NAMESPACE_INTERNAL_END
+
+    /**
+     * @brief Resolves a host for binding or connecting over IPv4.
+     * @param host The host name or address.
+     * @param port The port.
+     * @param addr_list Receives the resolved addresses, the first one is the preferred address.
+     * @return true if at least one address was found.
+     */
+    inline bool GetAddrInfo(std::string_view host, PORT port, AddressList* addr_list) {
+        *addr_list = detail::Resolve(host, port, AF_INET); // IPv4限定 AF_UNSPEC:全て受け入れる
+        if (!*addr_list) {
             assert::ShowError(ASSERT_FILE_LINE, "Domain not found.");
             return false;
         }
+        return true;
+    }
+
+    /**
+     * @class Resolver
+     * @brief Caches name resolution results per host:port.
+     *
+     * Successful lookups are kept for TTL and failed lookups for NEGATIVE_TTL, so neither a resolved name nor an
+     * unresolvable one costs a getaddrinfo call per request. getaddrinfo does not expose the record TTL, a fixed
+     * one is used instead.
+     */
+    class Resolver {
+    public:
 
-        *addr_info = *result;
-        for (next = result; next != NULL; next = next->ai_next) {
-            SOCKET sock = Create(next->ai_family, next->ai_socktype, next->ai_protocol);
-            if (Connect(&sock, *next, 1000)) {
-                Close(&sock);
-                *addr_info = *result;
-                continue;
+        static constexpr std::chrono::seconds TTL{ 60 };
+        static constexpr std::chrono::seconds NEGATIVE_TTL{ 5 };
+
+        static Resolver& Instance() {
+            static Resolver instance;
+            return instance;
+        }
+
+        Resolver(const Resolver&) = delete;
+        Resolver& operator=(const Resolver&) = delete;
+
+        ~Resolver() {
+#ifdef _WIN32
+            WSACleanup();
+#endif
+        }
+
+        /**
+         * @brief Returns the addresses of host:port, both IPv4 and IPv6.
+         * @param host The host name or address.
+         * @param port The port.
+         * @return The resolved addresses, or nullptr if the host could not be resolved.
+         */
+        AddressList Resolve(std::string_view host, PORT port) {
+            AddressList addresses;
+            if (Find(host, port, &addresses)) {
+                return addresses;
             }
-            Close(&sock);
+
+            // resolve without holding the lock, a concurrent lookup of the same name only repeats the work
+            auto now = std::chrono::steady_clock::now();
+            addresses = detail::Resolve(host, port, AF_UNSPEC);
+            std::lock_guard lock(mutex);
+            entries[MakeKey(host, port)] = { addresses, now + (addresses ? TTL : NEGATIVE_TTL) };
+            return addresses;
         }
-        //freeaddrinfo(result);
 
-        return true;
+        /**
+         * @brief Returns the cached result of host:port without resolving it, e.g. on a thread that must not block.
+         * @param host The host name or address.
+         * @param port The port.
+         * @param addresses Receives the cached addresses, nullptr for a cached failure.
+         * @return false if nothing is cached for host:port or the cached result has expired.
+         */
+        bool Find(std::string_view host, PORT port, AddressList* addresses) {
+            std::lock_guard lock(mutex);
+            auto it = entries.find(MakeKey(host, port));
+            if (it == entries.end() || std::chrono::steady_clock::now() >= it->second.expires) {
+                return false;
+            }
+            *addresses = it->second.addresses;
+            return true;
+        }
+
+        /**
+         * @brief Forgets the cached result of host:port, e.g. after none of its addresses accepted a connection.
+         * @param host The host name or address.
+         * @param port The port.
+         */
+        void Invalidate(std::string_view host, PORT port) {
+            std::lock_guard lock(mutex);
+            entries.erase(MakeKey(host, port));
+        }
+
+        /**
+         * @brief Forgets all cached results.
+         */
+        void Clear() {
+            std::lock_guard lock(mutex);
+            entries.clear();
+        }
+
+    private:
+
+        struct Entry {
+            AddressList                           addresses;
+            std::chrono::steady_clock::time_point expires;
+        };
+
+        Resolver() {
+#ifdef _WIN32
+            // getaddrinfo needs WinSock to be initialized even before the first socket is created
+            WSADATA wsa_data{};
+            WSAStartup(WINSOCK_VERSION, &wsa_data);
+#endif
+        }
+
+        static std::string MakeKey(std::string_view host, PORT port) {
+            return std::string(host) + ":" + std::to_string(port);
+        }
+
+        std::mutex                             mutex;
+        std::unordered_map<std::string, Entry> entries;
+
+    };
+
+    /**
+     * @brief Connects to whichever of the addresses answers first (Happy Eyeballs, RFC 8305).
+     *
+     * Attempts are started one after another, alternating address families. The next attempt starts when
+     * attempt_delay_ms has passed or the previous attempts failed, earlier attempts keep running. The first
+     * established connection wins and the other attempts are closed.
+     *
+     * @param addr_list The addresses to try, linked through ai_next.
+     * @param time_out_ms Timeout for all attempts together in milliseconds.
+     * @param attempt_delay_ms Delay before the next address is tried in milliseconds.
+     * @return The connected socket in blocking mode, or INVALID_SOCKET if no address could be connected.
+     */
+    inline SOCKET ConnectRace(const ADDRINFO& addr_list, int time_out_ms, int attempt_delay_ms = 250) {
+        auto candidates   = detail::InterleaveFamilies(addr_list);
+        auto now          = std::chrono::steady_clock::now();
+        auto deadline     = now + std::chrono::milliseconds(time_out_ms);
+        auto next_attempt = now;
+        std::size_t next  = 0;
+
+        std::vector<detail::PollFd> attempts;
+        SOCKET winner = INVALID_SOCKET;
+        while (winner == INVALID_SOCKET && now < deadline) {
+            // start the next attempt
+            if (next < candidates.size() && (attempts.empty() || next_attempt <= now)) {
+                const ADDRINFO& addr_info = *candidates[next++];
+                SOCKET sock = Create(addr_info.ai_family, addr_info.ai_socktype, addr_info.ai_protocol);
+                if (sock == INVALID_SOCKET) {
+                    continue;
+                }
+                if (!BeginConnect(&sock, addr_info)) {
+                    Close(&sock);
+                    continue;
+                }
+                attempts.push_back({ sock, POLLOUT, 0 });
+                next_attempt = now + std::chrono::milliseconds(attempt_delay_ms);
+            }
+            if (attempts.empty()) {
+                break;
+            }
+
+            auto wake_up = next < candidates.size() ? (std::min)(deadline, next_attempt) : deadline;
+            auto wait_ms = std::chrono::ceil<std::chrono::milliseconds>(wake_up - now).count();
+            if (detail::Poll(attempts.data(), attempts.size(), static_cast<int>(wait_ms)) > 0) {
+                // writable means connected, or failed if SO_ERROR is set
+                for (auto it = attempts.begin(); it != attempts.end();) {
+                    if (!it->revents) {
+                        ++it;
+                        continue;
+                    }
+                    SOCKET sock = it->fd;
+                    if (winner == INVALID_SOCKET && GetSocketError(sock) == 0) {
+                        winner = sock;
+                    }
+                    else {
+                        Close(&sock);
+                    }
+                    it = attempts.erase(it);
+                }
+            }
+            now = std::chrono::steady_clock::now();
+        }
+
+        for (auto& attempt : attempts) {
+            SOCKET sock = attempt.fd;
+            Close(&sock);
+        }
+        if (winner != INVALID_SOCKET) {
+            SetBlocking(&winner);
+        }
+        return winner;
     }
 
     /**
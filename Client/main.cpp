@@ -1,11 +1,11 @@
 ﻿#include "UserData.h"
 #include "OrsApiClient.h"
 
-void ShowRanking(const json& j)
+void ShowRanking(const std::vector<ors_api_client::RankingEntry>& entries)
 {
     std::cout << "========== Ranking ==========" << std::endl;
-    for (const auto& [key, value] : j.items()) {
-        std::cout << std::format("{}st) {} / {}", key, value["user_name"].get<std::string>(), value["score"].get<int>()) << std::endl;
+    for (const auto& entry : entries) {
+        std::cout << std::format("{}st) {} / {}", entry.rank, entry.userName, entry.score) << std::endl;
     };
     std::cout << "=============================" << std::endl;
 }
@@ -25,16 +25,22 @@ int main()
     userData3.UploadScore();
     userData4.UploadScore();
 
+    // ランキングはDOMを作らずにエントリーの配列へ直接読み込む
+    std::vector<ors_api_client::RankingEntry> ranking;
+
     // 自分の順位を取得
-    ShowRanking(userData.GetMyRanking());
+    userData.GetMyRanking(&ranking);
+    ShowRanking(ranking);
 
     // トップ3のランキングを取得
-    ShowRanking(userData.GetTopRanking(3));
+    userData.GetTopRanking(3, &ranking);
+    ShowRanking(ranking);
 
     // スコアを更新
     userData.UpdateScore(450);
     userData.UploadScore();
 
     // トップ3のランキングを取得
-    ShowRanking(userData.GetTopRanking(3));
+    userData.GetTopRanking(3, &ranking);
+    ShowRanking(ranking);
 }
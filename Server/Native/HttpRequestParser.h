@@ -0,0 +1,251 @@
+﻿#pragma once
+
+namespace ors_api_server
+{
+    // incremental HTTP/1.1 request parser
+    // request bodies are only accepted with Content-Length, which is what every client of the API sends
+    class HttpRequestParser
+    {
+    public:
+
+        enum class State {
+            REQUEST_LINE,
+            HEADER_FIELDS,
+            BODY,
+            COMPLETE,
+            BAD_MESSAGE,
+        };
+
+        // maximum length of the request line or a header field
+        static constexpr std::size_t MAX_LINE_LENGTH = 8192;
+        // maximum size of a request body
+        static constexpr std::size_t MAX_BODY_SIZE   = 1024 * 1024;
+
+        // prepare for the next request, buffers keep their capacity
+        void Reset() {
+            state               = State::REQUEST_LINE;
+            line.clear();
+            method.clear();
+            target.clear();
+            headerFields.clear();
+            body.clear();
+            minorVersion        = 1;
+            remaining           = 0;
+            connectionClose     = false;
+            connectionKeepAlive = false;
+        }
+
+        // consume received bytes, returns the number of bytes used
+        // bytes after a complete request are not consumed, they belong to the next request
+        std::size_t Feed(std::string_view data) {
+            std::size_t pos = 0;
+            while (pos < data.size() && state != State::COMPLETE && state != State::BAD_MESSAGE) {
+                if (state == State::BODY) {
+                    std::size_t n = (std::min)(remaining, data.size() - pos);
+                    body.append(data.data() + pos, n);
+                    pos       += n;
+                    remaining -= n;
+                    if (!remaining) {
+                        state = State::COMPLETE;
+                    }
+                    continue;
+                }
+
+                // line based states, collect bytes up to LF
+                auto lf = data.find('\n', pos);
+                std::size_t end = lf == std::string_view::npos ? data.size() : lf;
+                if (line.size() + (end - pos) > MAX_LINE_LENGTH) {
+                    state = State::BAD_MESSAGE;
+                    break;
+                }
+                line.append(data.data() + pos, end - pos);
+                pos = end;
+                if (lf == std::string_view::npos) {
+                    break;
+                }
+                // skip LF
+                ++pos;
+                if (!line.empty() && line.back() == '\r') {
+                    line.pop_back();
+                }
+                OnLine();
+                line.clear();
+            }
+            return pos;
+        }
+
+        bool IsComplete() const {
+            return state == State::COMPLETE;
+        }
+
+        bool HasError() const {
+            return state == State::BAD_MESSAGE;
+        }
+
+        // true while no byte of the request has been consumed
+        bool IsEmpty() const {
+            return state == State::REQUEST_LINE && line.empty();
+        }
+
+        const std::string& GetMethod() const {
+            return method;
+        }
+
+        // path without the query string
+        std::string_view GetPath() const {
+            std::string_view path = target;
+            return path.substr(0, path.find('?'));
+        }
+
+        // query string without '?', empty if there is none
+        std::string_view GetQueryString() const {
+            std::string_view query = target;
+            auto pos = query.find('?');
+            return pos == std::string_view::npos ? std::string_view() : query.substr(pos + 1);
+        }
+
+        // header field value, names are compared case-insensitively
+        std::string_view GetHeaderField(std::string_view name) const {
+            for (const auto& [key, value] : headerFields) {
+                if (EqualsIgnoreCase(key, name)) {
+                    return value;
+                }
+            }
+            return std::string_view();
+        }
+
+        const std::string& GetMessageBody() const {
+            return body;
+        }
+
+        // whether the client wants to send another request on this connection
+        bool IsKeepAlive() const {
+            if (state != State::COMPLETE || connectionClose) {
+                return false;
+            }
+            // HTTP/1.1 defaults to persistent connections, HTTP/1.0 has to ask for it
+            return minorVersion >= 1 || connectionKeepAlive;
+        }
+
+    private:
+
+        static char ToLower(char c) {
+            return ('A' <= c && c <= 'Z') ? static_cast<char>(c - 'A' + 'a') : c;
+        }
+
+        static bool EqualsIgnoreCase(std::string_view lhs, std::string_view rhs) {
+            if (lhs.size() != rhs.size()) {
+                return false;
+            }
+            for (std::size_t i = 0; i < lhs.size(); ++i) {
+                if (ToLower(lhs[i]) != ToLower(rhs[i])) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        static bool ContainsTokenIgnoreCase(std::string_view value, std::string_view token) {
+            // comma separated list, e.g. "keep-alive, Upgrade"
+            while (!value.empty()) {
+                auto comma = value.find(',');
+                auto item  = value.substr(0, comma);
+                while (!item.empty() && (item.front() == ' ' || item.front() == '\t')) item.remove_prefix(1);
+                while (!item.empty() && (item.back()  == ' ' || item.back()  == '\t')) item.remove_suffix(1);
+                if (EqualsIgnoreCase(item, token)) {
+                    return true;
+                }
+                if (comma == std::string_view::npos) {
+                    break;
+                }
+                value.remove_prefix(comma + 1);
+            }
+            return false;
+        }
+
+        void OnLine() {
+            if (state == State::REQUEST_LINE) {
+                // tolerate empty lines before the request line (RFC 9112 2.2)
+                if (!line.empty()) {
+                    OnRequestLine();
+                }
+            }
+            else if (line.empty()) {
+                OnHeaderFieldsEnd();
+            }
+            else {
+                OnHeaderField();
+            }
+        }
+
+        void OnRequestLine() {
+            // method SP request-target SP HTTP/1.x
+            std::string_view request_line = line;
+            auto first = request_line.find(' ');
+            auto last  = request_line.rfind(' ');
+            if (first == std::string_view::npos || first == last) {
+                state = State::BAD_MESSAGE;
+                return;
+            }
+            auto version = request_line.substr(last + 1);
+            if (version.size() != 8 || !version.starts_with("HTTP/1.")) {
+                state = State::BAD_MESSAGE;
+                return;
+            }
+            method.assign(request_line.substr(0, first));
+            target.assign(request_line.substr(first + 1, last - first - 1));
+            minorVersion = version[7] - '0';
+            state = State::HEADER_FIELDS;
+        }
+
+        void OnHeaderField() {
+            std::string_view field = line;
+            auto colon = field.find(':');
+            if (colon == std::string_view::npos || colon == 0) {
+                state = State::BAD_MESSAGE;
+                return;
+            }
+            auto value = field.substr(colon + 1);
+            while (!value.empty() && (value.front() == ' ' || value.front() == '\t')) value.remove_prefix(1);
+            while (!value.empty() && (value.back()  == ' ' || value.back()  == '\t')) value.remove_suffix(1);
+            headerFields.emplace_back(field.substr(0, colon), value);
+        }
+
+        void OnHeaderFieldsEnd() {
+            auto connection = GetHeaderField("Connection");
+            connectionClose     = ContainsTokenIgnoreCase(connection, "close");
+            connectionKeepAlive = ContainsTokenIgnoreCase(connection, "keep-alive");
+
+            // chunked request bodies are not supported
+            if (!GetHeaderField("Transfer-Encoding").empty()) {
+                state = State::BAD_MESSAGE;
+                return;
+            }
+
+            if (auto content_length = GetHeaderField("Content-Length"); !content_length.empty()) {
+                auto [ptr, ec] = std::from_chars(content_length.data(), content_length.data() + content_length.size(), remaining);
+                if (ec != std::errc() || ptr != content_length.data() + content_length.size() || remaining > MAX_BODY_SIZE) {
+                    state = State::BAD_MESSAGE;
+                    return;
+                }
+                body.reserve(remaining);
+                state = remaining ? State::BODY : State::COMPLETE;
+                return;
+            }
+
+            state = State::COMPLETE;
+        }
+
+        State                                            state               = State::REQUEST_LINE;
+        std::string                                      line;
+        std::string                                      method;
+        std::string                                      target;
+        std::vector<std::pair<std::string, std::string>> headerFields;
+        std::string                                      body;
+        int                                              minorVersion        = 1;
+        std::size_t                                      remaining           = 0;
+        bool                                             connectionClose     = false;
+        bool                                             connectionKeepAlive = false;
+
+    };
+};
@@ -0,0 +1,120 @@
+﻿#pragma once
+
+namespace ors_api_server
+{
+    // minimal JSON output for the hot response paths, appends straight to a send buffer
+    // the strings are escaped the way nlohmann::json::dump does with error_handler_t::replace (JSON_DUMP_ERROR_HANDLER),
+    // so the output is byte-identical: ill-formed UTF-8 becomes U+FFFD instead of being passed through
+
+    // size of the well-formed UTF-8 sequence at str[pos], 0 if there is none. *invalid is then the size of the
+    // ill-formed part: the lead byte and the continuation bytes that were still possible after it
+    inline std::size_t DecodeUtf8(std::string_view str, std::size_t pos, std::size_t* invalid) {
+        auto lead = static_cast<unsigned char>(str[pos]);
+        if (lead < 0x80) {
+            return 1;
+        }
+        // continuation bytes and the range of the first one, which rules out overlong forms and surrogates
+        std::size_t   count = 0;
+        unsigned char low   = 0x80;
+        unsigned char high  = 0xBF;
+        if (0xC2 <= lead && lead <= 0xDF) {
+            count = 1;
+        }
+        else if (0xE0 <= lead && lead <= 0xEF) {
+            count = 2;
+            low   = lead == 0xE0 ? 0xA0 : 0x80;
+            high  = lead == 0xED ? 0x9F : 0xBF;
+        }
+        else if (0xF0 <= lead && lead <= 0xF4) {
+            count = 3;
+            low   = lead == 0xF0 ? 0x90 : 0x80;
+            high  = lead == 0xF4 ? 0x8F : 0xBF;
+        }
+        else {
+            *invalid = 1;
+            return 0;
+        }
+        for (std::size_t i = 1; i <= count; ++i) {
+            if (pos + i >= str.size() || static_cast<unsigned char>(str[pos + i]) < low || static_cast<unsigned char>(str[pos + i]) > high) {
+                *invalid = i;
+                return 0;
+            }
+            low  = 0x80;
+            high = 0xBF;
+        }
+        return count + 1;
+    }
+
+    // JSON strings have to be UTF-8, nlohmann::json::dump throws on anything else
+    inline bool IsValidUtf8(std::string_view str) {
+        for (std::size_t pos = 0, invalid = 0; pos < str.size();) {
+            auto size = DecodeUtf8(str, pos, &invalid);
+            if (size == 0) {
+                return false;
+            }
+            pos += size;
+        }
+        return true;
+    }
+
+    // how the json responses that are not written here are dumped, the same replacement as AppendJsonString
+    inline constexpr auto JSON_DUMP_ERROR_HANDLER = nlohmann::json::error_handler_t::replace;
+
+    inline void AppendJsonInt(std::int64_t value, std::string* out) {
+        char buffer[20];
+        auto [ptr, ec] = std::to_chars(buffer, buffer + sizeof(buffer), value);
+        out->append(buffer, ptr);
+    }
+
+    // str as a JSON string literal, quotes included
+    inline void AppendJsonString(std::string_view str, std::string* out) {
+        static constexpr char DIGITS[] = "0123456789abcdef";
+        out->reserve(out->size() + str.size() + 2);
+        *out += '"';
+        // runs of characters that need no escaping are appended at once
+        std::size_t begin = 0;
+        for (std::size_t i = 0; i < str.size(); ++i) {
+            auto c = static_cast<unsigned char>(str[i]);
+            if (c >= 0x80) {
+                // names are checked when they are submitted, records written before may still be ill-formed
+                std::size_t invalid = 0;
+                if (auto size = DecodeUtf8(str, i, &invalid)) {
+                    i += size - 1;
+                    continue;
+                }
+                out->append(str.data() + begin, i - begin);
+                *out += "\xEF\xBF\xBD";
+                i    += invalid - 1;
+                begin = i + 1;
+                continue;
+            }
+            if (c >= 0x20 && c != '"' && c != '\\') {
+                continue;
+            }
+            out->append(str.data() + begin, i - begin);
+            begin = i + 1;
+            switch (c) {
+            case '"':  *out += "\\\""; break;
+            case '\\': *out += "\\\\"; break;
+            case '\b': *out += "\\b";  break;
+            case '\f': *out += "\\f";  break;
+            case '\n': *out += "\\n";  break;
+            case '\r': *out += "\\r";  break;
+            case '\t': *out += "\\t";  break;
+            default:
+                *out += "\\u00";
+                *out += DIGITS[c >> 4];
+                *out += DIGITS[c & 0x0F];
+                break;
+            }
+        }
+        out->append(str.data() + begin, str.size() - begin);
+        *out += '"';
+    }
+
+    inline std::string ToJsonString(std::string_view str) {
+        std::string json_string;
+        AppendJsonString(str, &json_string);
+        return json_string;
+    }
+};
@@ -0,0 +1,1520 @@
+﻿#pragma once
+
+#include "HttpRequestParser.h"
+#include "Metrics.h"
+#include "OrsBinaryProtocol.h"
+#include "RankingSnapshot.h"
+#include "ScoreLog.h"
+#include "ShardedRanking.h"
+
+namespace ors_api_server
+{
+    // online ranking system api server
+    // native counterpart of ORSAPIServer in orsapiserver.py, speaks the same HTTP/JSON API:
+    //   GET  ?uuid=<uuid>   -> {rank: {log_time, uuid, user_name, score}}
+    //   GET  ?uuid=<uuid>&around=<n>
+    //                       -> {rank, percentile, total, entries: [{rank, log_time, uuid, user_name, score}, ...]}
+    //                          the player and the n entries above and below, in ranking order
+    //   GET  ?limit=<n>     -> {1: {...}, 2: {...}, ...}, at most MAX_PAGE_SIZE entries (also for a negative n)
+    //   GET  ?page_size=<n>[&after_score=<score>&after_uuid=<uuid>]
+    //                       -> {entries: [{rank, log_time, uuid, user_name, score}, ...], next: {score, uuid} or null}
+    //                          the entries after the cursor in ranking order, next is the cursor of the next page
+    //   GET                 -> first page of DEFAULT_PAGE_SIZE entries
+    //   POST {uuid, user_name, score}
+    //   POST /scores [{uuid, user_name, score}, ...]
+    //   POST /ranks {uuids: [<uuid>, ...]}
+    //                       -> {entries: [{rank, log_time, uuid, user_name, score}, ...]}
+    //                          the ranked ones of at most MAX_PAGE_SIZE uuids (each once), in ranking order
+    //   POST /rollover {board, archive}
+    //                       -> the board is frozen as it is into the new read-only board archive and starts
+    //                          empty again (403 if it is frozen, 409 if archive exists, needs a ScoreLog)
+    //   GET  /metrics       -> the counters and stage latencies of GetStats in the Prometheus text format
+    // and optionally the binary protocol of OrsBinaryProtocol.h on binary_port
+    // every request is for a board: the board query parameter of a GET, the board member of a POST (of every
+    // entry of /scores), DEFAULT_BOARD without one. Boards are indexes of one ShardedRanking, frozen boards
+    // are RankingSnapshots that refuse new scores with 403
+    // the window query parameter of a GET or member of /ranks (all, hour, day or week) reads the ranking of the
+    // current hour, day or week of the board instead of the all-time one, frozen boards have no windows
+    // the top ranking and the pages are streamed from the index in chunks (Transfer-Encoding: chunked)
+    // connections are kept alive and served by worker threads with an event loop each, pipelined requests are
+    // answered in order. Every worker accepts on its own SO_REUSEPORT socket where the platform has it
+    // the ranking is read without locks, a score is acknowledged once readers see it
+    // with a ScoreLog, scores are acknowledged only after they were logged durably
+    // and the ranking is restored on a background thread at Start: until then GETs are answered from the
+    // memory-mapped snapshot, without the scores of the log or the ones submitted during the warm-up
+    class OrsApiServer
+    {
+    public:
+
+        // path of the bulk score endpoint
+        static constexpr char SCORES_PATH[]   = "/scores";
+        // path of the bulk rank lookup endpoint
+        static constexpr char RANKS_PATH[]    = "/ranks";
+        // path of the season rollover endpoint
+        static constexpr char ROLLOVER_PATH[] = "/rollover";
+        // path of the Prometheus scrape endpoint
+        static constexpr char METRICS_PATH[]  = "/metrics";
+        // larger around values of a neighborhood query are clamped
+        static constexpr std::size_t MAX_AROUND        = 100;
+        // no response holds more entries than that, the whole ranking is read page by page
+        static constexpr std::size_t MAX_PAGE_SIZE     = 1000;
+        static constexpr std::size_t DEFAULT_PAGE_SIZE = 100;
+
+        // worker_count 0 starts one worker per hardware thread, binary_port 0 serves HTTP only
+        OrsApiServer(ShardedRanking* ranking, ScoreLog* score_log = nullptr, std::string_view host = "localhost", socket_helper::PORT port = 5000, std::size_t worker_count = 0, socket_helper::PORT binary_port = 0)
+            : ranking(ranking)
+            , scoreLog(score_log)
+            , host(host)
+            , port(port)
+            , binaryPort(binary_port)
+            , workerCount(worker_count ? worker_count : (std::max)(1u, std::thread::hardware_concurrency()))
+        {}
+
+        ~OrsApiServer() {
+            if (warmThread.joinable()) {
+                warmThread.join();
+            }
+        }
+
+        // serve until Stop is called or a worker fails, its exception is rethrown here
+        void Start() {
+            auto listen_socks        = ListenAll(port);
+            auto binary_listen_socks = binaryPort ? ListenAll(binaryPort) : std::vector<SOCKET>(workerCount, INVALID_SOCKET);
+            {
+                std::lock_guard lock(stopMutex);
+                for (std::size_t i = 0; i < workerCount; ++i) {
+                    workers.push_back(std::make_unique<Worker>(this, listen_socks[i], binary_listen_socks[i]));
+                }
+            }
+
+            if (scoreLog) {
+                StartWarmUp();
+            }
+            else {
+                ranking->Start();
+                warmed = true;
+            }
+
+            std::cout << std::format("Serving on {}:{} with {} workers...", host, port, workerCount) << std::endl;
+            if (binaryPort) {
+                std::cout << std::format("Serving the binary protocol on {}:{}...", host, binaryPort) << std::endl;
+            }
+            std::vector<std::thread> threads;
+            for (std::size_t i = 1; i < workers.size(); ++i) {
+                threads.emplace_back([this, worker = workers[i].get()] {
+                    RunWorker(worker);
+                });
+            }
+            RunWorker(workers[0].get());
+            for (auto& thread : threads) {
+                thread.join();
+            }
+
+            // pending commits call back into the workers
+            ranking->Drain();
+            {
+                std::lock_guard lock(stopMutex);
+                workers.clear();
+            }
+            listen_socks.insert(listen_socks.end(), binary_listen_socks.begin(), binary_listen_socks.end());
+            std::sort(listen_socks.begin(), listen_socks.end());
+            listen_socks.erase(std::unique(listen_socks.begin(), listen_socks.end()), listen_socks.end());
+            for (SOCKET listen_sock : listen_socks) {
+                if (listen_sock != INVALID_SOCKET) {
+                    socket_helper::Close(&listen_sock, false);
+                }
+            }
+            if (failure) {
+                std::rethrow_exception(failure);
+            }
+        }
+
+        // make Start return, can be called from any thread
+        void Stop() {
+            Stop(nullptr);
+        }
+
+        // stages of the work of the server, timed on the thread that does it
+        enum class Stage {
+            // the HTTP request message, from its first byte to its last one
+            PARSE,
+            // App or BinaryApp: the body, the reads of the ranking and the json of the small responses
+            HANDLE,
+            // the response message, the chunks of a streamed one each
+            SERIALIZE,
+            // ScoreLog::Append of a batch, the fsync included
+            LOG_APPEND,
+            // from handing a batch to the ranking writers until readers see it
+            INDEX_UPDATE,
+            COMPACTION,
+            COUNT,
+        };
+
+        enum class Counter {
+            HTTP_REQUESTS,
+            BINARY_REQUESTS,
+            // 4xx responses, malformed and refused binary requests
+            CLIENT_ERRORS,
+            // 5xx responses
+            SERVER_ERRORS,
+            // scores committed to the ranking (and the log)
+            SCORES,
+            CONNECTIONS_ACCEPTED,
+            CONNECTIONS_CLOSED,
+            COMPACTIONS,
+            BYTES_RECEIVED,
+            BYTES_SENT,
+            COUNT,
+        };
+
+        using Metrics = ors_metrics::Registry<Counter, Stage>;
+
+        static constexpr std::array<std::string_view, static_cast<std::size_t>(Stage::COUNT)>   STAGE_NAMES   = { "parse", "handle", "serialize", "log_append", "index_update", "compaction" };
+        static constexpr std::array<std::string_view, static_cast<std::size_t>(Counter::COUNT)> COUNTER_NAMES = {
+            "http_requests", "binary_requests", "client_errors", "server_errors", "scores",
+            "connections_accepted", "connections_closed", "compactions", "bytes_received", "bytes_sent",
+        };
+
+        // counters and stage latencies since the server was created, can be called from any thread
+        Metrics::Snapshot GetStats() const {
+            return metrics.GetSnapshot();
+        }
+
+    private:
+
+        using ordered_json = nlohmann::ordered_json;
+
+        // a ranking response that is written chunk by chunk as the client reads it (chunked transfer encoding)
+        // every chunk is a read of its own that continues after the last entry written, so neither the response
+        // nor the ranking is held while the client is slow. An entry that moves meanwhile can be skipped or repeated
+        struct RankingStream
+        {
+            std::string                 board;
+            RankingWindow               window    = RankingWindow::ALL;
+            // {entries: [...], next} of a page instead of {1: {...}, 2: {...}, ...}
+            bool                        page      = false;
+            // entries still to be visited, a page visits one more to know whether there is a next one
+            std::size_t                 remaining = 0;
+            std::size_t                 written   = 0;
+            // the next chunk starts after this entry, at the top without one
+            std::optional<RankingEntry> cursor;
+        };
+
+        // a keep-alive connection, requests are parsed from recvBuffer and their responses queued in sendBuffer
+        struct Connection
+        {
+            SOCKET                                sock;
+            socket_helper::RecvBuffer             recvBuffer;
+            HttpRequestParser                     parser;
+            std::string                           sendBuffer;
+            std::size_t                           sent       = 0;
+            std::uint32_t                         watching   = socket_helper::Poller::READABLE;
+            // close once sendBuffer has been sent
+            bool                                  closing    = false;
+            // the last response acknowledges scores that are not committed yet, it is held back until they are
+            bool                                  committing = false;
+            std::chrono::steady_clock::time_point lastActive;
+            // speaks the binary protocol instead of HTTP
+            bool                                  binary     = false;
+            // the response being streamed, the requests after it wait until it is complete
+            std::unique_ptr<RankingStream>        stream;
+            // time spent parsing the request that is not complete yet
+            ors_metrics::Clock::duration          parsing{};
+        };
+
+        struct Response
+        {
+            std::string_view status;
+            std::string      body;
+            std::string_view contentType;
+            // the body is streamed instead
+            std::unique_ptr<RankingStream> stream;
+        };
+
+        // {uuid, user_name, score, board} of a POST, the strings point into the parsed request
+        struct ScoreSubmission
+        {
+            const std::string* uuid     = nullptr;
+            const std::string* userName = nullptr;
+            std::int64_t       score    = 0;
+            std::string_view   board    = DEFAULT_BOARD;
+        };
+
+        // frozen boards by id, replaced as a whole when one is added
+        using FrozenBoards = std::map<std::string, std::shared_ptr<const RankingSnapshot>, std::less<>>;
+
+        // connections without traffic for this long are closed
+        static constexpr int         KEEP_ALIVE_TIME_OUT_MS = 5000;
+        static constexpr int         IDLE_CHECK_INTERVAL_MS = 1000;
+        // stop reading requests from a client that does not read its responses
+        static constexpr std::size_t MAX_PENDING_SEND_SIZE  = 1024 * 1024;
+        // entries per chunk of a streamed response
+        static constexpr std::size_t CHUNK_ENTRIES          = 256;
+        // a chunk starts with its size in hex, which is known only once it is written: a fixed width is reserved
+        static constexpr std::size_t CHUNK_SIZE_DIGITS      = 8;
+        static constexpr char        CHUNK_SIZE_PLACEHOLDER[] = "00000000\r\n";
+        // the score log is compacted into a snapshot when it grows beyond this
+        static constexpr std::size_t COMPACT_LOG_SIZE       = 64 * 1024 * 1024;
+        // a failed compaction is tried again after this, not after every commit
+        static constexpr int         COMPACT_RETRY_INTERVAL_MS = 10000;
+
+        // one event loop thread, owns its listening sockets (unless shared), its connections and its staged scores
+        class Worker
+        {
+        public:
+
+            // binary_listen_sock is INVALID_SOCKET without the binary protocol
+            Worker(OrsApiServer* server, SOCKET listen_sock, SOCKET binary_listen_sock)
+                : server(server)
+                , reader(server->ranking->RegisterReader())
+                , listenSock(listen_sock)
+                , binaryListenSock(binary_listen_sock)
+            {
+                poller.Add(listenSock, socket_helper::Poller::READABLE);
+                if (binaryListenSock != INVALID_SOCKET) {
+                    poller.Add(binaryListenSock, socket_helper::Poller::READABLE);
+                }
+            }
+
+            void Run() {
+                std::vector<socket_helper::Poller::Event> events;
+                while (!server->stopping.load()) {
+                    poller.Wait(&events, IDLE_CHECK_INTERVAL_MS);
+                    for (const auto& event : events) {
+                        if (event.sock == listenSock || event.sock == binaryListenSock) {
+                            AcceptAll(event.sock, event.sock == binaryListenSock);
+                            continue;
+                        }
+                        if (auto it = connections.find(event.sock); it != connections.end() && !OnEvent(it->second.get(), event.events)) {
+                            CloseConnection(event.sock);
+                        }
+                    }
+                    CommitScores();
+                    CloseIdleConnections();
+                }
+            }
+
+            void Wakeup() {
+                poller.Wakeup();
+            }
+
+        private:
+
+            void AcceptAll(SOCKET listen_sock, bool binary) {
+                while (true) {
+                    ADDRINFO client_addr_info;
+                    SOCKET sock = socket_helper::Accept(&listen_sock, &client_addr_info);
+                    if (sock == INVALID_SOCKET) {
+                        return;
+                    }
+                    socket_helper::SetNonBlocking(&sock);
+                    server->metrics.Add(Counter::CONNECTIONS_ACCEPTED);
+                    auto connection = std::make_unique<Connection>();
+                    connection->sock       = sock;
+                    connection->lastActive = std::chrono::steady_clock::now();
+                    connection->binary     = binary;
+                    poller.Add(sock, connection->watching);
+                    connections.emplace(sock, std::move(connection));
+                }
+            }
+
+            // returns false when the connection has to be closed
+            bool OnEvent(Connection* connection, std::uint32_t events) {
+                connection->lastActive = std::chrono::steady_clock::now();
+
+                if (events & socket_helper::Poller::WRITABLE) {
+                    if (!Flush(connection)) {
+                        return false;
+                    }
+                }
+                if (events & (socket_helper::Poller::READABLE | socket_helper::Poller::CLOSED)) {
+                    while (!connection->closing && !connection->committing && !connection->stream && connection->sendBuffer.size() < MAX_PENDING_SEND_SIZE) {
+                        auto result = socket_helper::Recv(connection->sock, &connection->recvBuffer);
+                        if (result.status == socket_helper::RecvStatus::WOULD_BLOCK) {
+                            break;
+                        }
+                        if (result.status != socket_helper::RecvStatus::OK) {
+                            return false;
+                        }
+                        server->metrics.Add(Counter::BYTES_RECEIVED, result.bytes);
+                        ProcessRequests(connection);
+                    }
+                    return Flush(connection);
+                }
+                return true;
+            }
+
+            // answer every complete request in the order it arrived, pipelined requests included
+            void ProcessRequests(Connection* connection) {
+                if (connection->binary) {
+                    ProcessBinaryRequests(connection);
+                    return;
+                }
+                auto& parser  = connection->parser;
+                auto& metrics = server->metrics;
+                while (!connection->closing && !connection->committing && !connection->stream && !connection->recvBuffer.Empty()) {
+                    auto parsing = ors_metrics::Clock::now();
+                    connection->recvBuffer.Consume(parser.Feed(connection->recvBuffer.Data()));
+                    auto handling = ors_metrics::Clock::now();
+                    connection->parsing += handling - parsing;
+                    if (parser.HasError()) {
+                        metrics.Add(Counter::HTTP_REQUESTS);
+                        metrics.Add(Counter::CLIENT_ERRORS);
+                        WriteResponse(MakeResponse("400 Bad Request"), false, &connection->sendBuffer);
+                        connection->closing = true;
+                        return;
+                    }
+                    if (!parser.IsComplete()) {
+                        return;
+                    }
+                    metrics.Add(Counter::HTTP_REQUESTS);
+                    metrics.Record(Stage::PARSE, std::exchange(connection->parsing, {}));
+                    bool     keep_alive  = parser.IsKeepAlive();
+                    auto     staged_size = stagedScores.size();
+                    Response response;
+                    try {
+                        response = App(parser);
+                    }
+                    catch (const std::exception& e) {
+                        // one failed request closes its connection only, the other connections and workers go on
+                        assert::ShowWarning(ASSERT_FILE_LINE, e.what());
+                        stagedScores.resize(staged_size);
+                        response   = MakeResponse("500 Internal Server Error");
+                        keep_alive = false;
+                    }
+                    auto serializing = metrics.Record(Stage::HANDLE, handling);
+                    if (response.status.starts_with('4')) {
+                        metrics.Add(Counter::CLIENT_ERRORS);
+                    }
+                    else if (response.status.starts_with('5')) {
+                        metrics.Add(Counter::SERVER_ERRORS);
+                    }
+                    WriteResponse(response, keep_alive, &connection->sendBuffer);
+                    metrics.Record(Stage::SERIALIZE, serializing);
+                    connection->closing = !keep_alive;
+                    parser.Reset();
+                    // the first chunk goes out right away, the next ones whenever the previous ones were sent
+                    if (response.stream) {
+                        connection->stream = std::move(response.stream);
+                        WriteChunk(connection);
+                    }
+                    // later requests of this connection have to see the scores, wait for the commit
+                    if (stagedScores.size() != staged_size) {
+                        WaitForCommit(connection);
+                    }
+                }
+            }
+
+            // binary protocol counterpart of ProcessRequests
+            void ProcessBinaryRequests(Connection* connection) {
+                while (!connection->closing && !connection->committing) {
+                    auto data       = connection->recvBuffer.Data();
+                    auto frame_size = ors_binary_protocol::GetFrameSize(data, ors_binary_protocol::MAX_REQUEST_SIZE);
+                    if (frame_size == 0) {
+                        return;
+                    }
+                    server->metrics.Add(Counter::BINARY_REQUESTS);
+                    auto staged_size = stagedScores.size();
+                    auto sent_size   = connection->sendBuffer.size();
+                    auto handling    = ors_metrics::Clock::now();
+                    bool handled     = false;
+                    bool failed      = false;
+                    try {
+                        handled = frame_size != ors_binary_protocol::INVALID_FRAME && BinaryApp(ors_binary_protocol::ReadFrame(data, frame_size), &connection->sendBuffer);
+                    }
+                    catch (const std::exception& e) {
+                        // as in ProcessRequests, without a response of its own: BAD_REQUEST and the connection is closed
+                        assert::ShowWarning(ASSERT_FILE_LINE, e.what());
+                        stagedScores.resize(staged_size);
+                        connection->sendBuffer.resize(sent_size);
+                        failed = true;
+                    }
+                    server->metrics.Record(Stage::HANDLE, handling);
+                    if (!handled) {
+                        server->metrics.Add(failed ? Counter::SERVER_ERRORS : Counter::CLIENT_ERRORS);
+                        ors_binary_protocol::WriteEmpty(ors_binary_protocol::MessageType::BAD_REQUEST, &connection->sendBuffer);
+                        connection->closing = true;
+                        return;
+                    }
+                    connection->recvBuffer.Consume(frame_size);
+                    // later requests of this connection have to see the scores, wait for the commit
+                    if (stagedScores.size() != staged_size) {
+                        WaitForCommit(connection);
+                    }
+                }
+            }
+
+            // commit the scores staged in this round as one batch (one fsync with a ScoreLog, group commit)
+            // and release the responses that acknowledge them once they are applied
+            void CommitScores() {
+                while (true) {
+                    if (applying) {
+                        if (!applied.exchange(false)) {
+                            break;
+                        }
+                        applying = false;
+                        Resume(std::exchange(applyingConnections, {}));
+                    }
+                    if (stagedScores.empty()) {
+                        break;
+                    }
+                    // pipelined requests that waited for the commit may stage scores again
+                    auto committed = std::exchange(committingConnections, {});
+                    applying = server->Commit(&stagedScores, [this] {
+                        applied.store(true);
+                        poller.Wakeup();
+                    });
+                    if (applying) {
+                        applyingConnections = std::move(committed);
+                    }
+                    else {
+                        Resume(committed);
+                    }
+                }
+                server->CompactScoreLog(reader);
+            }
+
+            // hold the responses and the requests of connection until the scores it staged are committed
+            // the poller is level-triggered: the socket is not watched meanwhile, or bytes pipelined behind the
+            // scores would report it readable on every wait without being read
+            void WaitForCommit(Connection* connection) {
+                connection->committing = true;
+                committingConnections.push_back(connection->sock);
+                Watch(connection, 0);
+            }
+
+            void Resume(const std::vector<SOCKET>& committed) {
+                for (SOCKET sock : committed) {
+                    auto it = connections.find(sock);
+                    if (it == connections.end()) {
+                        continue;
+                    }
+                    it->second->committing = false;
+                    Watch(it->second.get(), socket_helper::Poller::READABLE);
+                    ProcessRequests(it->second.get());
+                    if (!Flush(it->second.get())) {
+                        CloseConnection(sock);
+                    }
+                }
+            }
+
+            // send queued responses, returns false when the connection has to be closed
+            bool Flush(Connection* connection) {
+                if (connection->committing) {
+                    return true;
+                }
+                while (true) {
+                    std::string_view data = connection->sendBuffer;
+                    while (connection->sent < data.size()) {
+                        int sent = socket_helper::Send(connection->sock, data.substr(connection->sent));
+                        if (sent == SOCKET_ERROR) {
+                            if (!socket_helper::IsWouldBlock()) {
+                                return false;
+                            }
+                            // wait until writable again, stop reading while the client does not keep up or a response is streamed
+                            Watch(connection, !connection->stream && connection->sendBuffer.size() < MAX_PENDING_SEND_SIZE ? socket_helper::Poller::READABLE | socket_helper::Poller::WRITABLE : socket_helper::Poller::WRITABLE);
+                            return true;
+                        }
+                        connection->sent += sent;
+                        server->metrics.Add(Counter::BYTES_SENT, static_cast<std::uint64_t>(sent));
+                    }
+
+                    connection->sendBuffer.clear();
+                    connection->sent = 0;
+                    if (!connection->stream) {
+                        break;
+                    }
+                    // everything was sent, continue the streamed response
+                    WriteChunk(connection);
+                    if (!connection->stream && !connection->closing) {
+                        // it is complete, answer the requests that arrived meanwhile
+                        ProcessRequests(connection);
+                        if (connection->committing) {
+                            return true;
+                        }
+                    }
+                }
+
+                if (connection->closing) {
+                    return false;
+                }
+                Watch(connection, socket_helper::Poller::READABLE);
+                return true;
+            }
+
+            // append the next chunk of the streamed response to sendBuffer, the stream is done after the last one
+            void WriteChunk(Connection* connection) {
+                auto serializing = ors_metrics::Clock::now();
+                bool last = server->Read(reader, connection->stream->board, connection->stream->window, [&](const auto& ranking) { return WriteRankingChunk(ranking, connection->stream.get(), &connection->sendBuffer); });
+                server->metrics.Record(Stage::SERIALIZE, serializing);
+                if (last) {
+                    connection->stream.reset();
+                }
+            }
+
+            void Watch(Connection* connection, std::uint32_t events) {
+                if (connection->watching != events) {
+                    poller.Modify(connection->sock, events);
+                    connection->watching = events;
+                }
+            }
+
+            void CloseConnection(SOCKET sock) {
+                server->metrics.Add(Counter::CONNECTIONS_CLOSED);
+                poller.Remove(sock);
+                connections.erase(sock);
+                // WSAStartup was not called for accepted sockets
+                socket_helper::Close(&sock, false);
+            }
+
+            void CloseIdleConnections() {
+                auto expired = std::chrono::steady_clock::now() - std::chrono::milliseconds(KEEP_ALIVE_TIME_OUT_MS);
+                std::vector<SOCKET> idle;
+                for (const auto& [sock, connection] : connections) {
+                    if (connection->lastActive < expired) {
+                        idle.push_back(sock);
+                    }
+                }
+                for (SOCKET sock : idle) {
+                    CloseConnection(sock);
+                }
+            }
+
+            Response App(const HttpRequestParser& request) {
+
+                // scrape of the metrics
+                if (request.GetMethod() == "GET" && request.GetPath() == METRICS_PATH) {
+                    return MakeResponse("200 OK", server->FormatMetrics(), "text/plain; version=0.0.4; charset=utf-8");
+                }
+
+                // GET
+                if (request.GetMethod() == "GET") {
+                    ordered_json res;
+                    auto query_string = request.GetQueryString();
+                    auto board_id     = GetQueryParameter(query_string, "board");
+                    if (board_id && !IsValidBoardId(*board_id)) {
+                        return MakeResponse("400 Bad Request");
+                    }
+                    std::string board = board_id ? std::move(*board_id) : std::string(DEFAULT_BOARD);
+                    auto window_name  = GetQueryParameter(query_string, "window");
+                    auto window       = RankingWindow::ALL;
+                    if (window_name && !ParseRankingWindow(*window_name, &window)) {
+                        return MakeResponse("400 Bad Request");
+                    }
+                    if (!query_string.empty()) {
+                        auto uuid        = GetQueryParameter(query_string, "uuid");
+                        auto limit       = GetQueryParameter(query_string, "limit");
+                        auto around      = GetQueryParameter(query_string, "around");
+                        auto page_size   = GetQueryParameter(query_string, "page_size");
+                        auto after_score = GetQueryParameter(query_string, "after_score");
+                        auto after_uuid  = GetQueryParameter(query_string, "after_uuid");
+
+                        // limit wins if both are given, as in orsapiserver.py
+                        if (limit) {
+                            std::int64_t n = 0;
+                            if (!ParseInteger(*limit, &n)) {
+                                return MakeResponse("400 Bad Request");
+                            }
+                            return MakeRankingResponse(board, window, false, static_cast<std::size_t>(ClampLimit(n)), std::nullopt);
+                        }
+                        else if (uuid && around) {
+                            std::size_t n = 0;
+                            if (!ParseInteger(*around, &n)) {
+                                return MakeResponse("400 Bad Request");
+                            }
+                            res = server->Read(reader, board, window, [&](const auto& ranking) { return GetNeighborhood(ranking, *uuid, (std::min)(n, MAX_AROUND)); });
+                        }
+                        else if (uuid) {
+                            res = server->Read(reader, board, window, [&](const auto& ranking) { return GetMyRanking(ranking, *uuid); });
+                        }
+                        else if (page_size || after_score || after_uuid) {
+                            // a cursor needs both of its parts
+                            std::size_t  n     = DEFAULT_PAGE_SIZE;
+                            std::int64_t score = 0;
+                            if ((page_size && !ParseInteger(*page_size, &n)) || n == 0 || !after_score != !after_uuid || (after_score && !ParseInteger(*after_score, &score))) {
+                                return MakeResponse("400 Bad Request");
+                            }
+                            std::optional<RankingEntry> cursor;
+                            if (after_uuid) {
+                                cursor = RankingEntry{ {}, *after_uuid, {}, score };
+                            }
+                            return MakeRankingResponse(board, window, true, (std::min)(n, MAX_PAGE_SIZE), std::move(cursor));
+                        }
+                        else if (!board_id && !window_name) {
+                            return MakeResponse("400 Bad Request");
+                        }
+                        else {
+                            return MakeRankingResponse(board, window, true, DEFAULT_PAGE_SIZE, std::nullopt);
+                        }
+                    }
+                    else {
+                        // first page, the whole ranking is too large for one response
+                        return MakeRankingResponse(board, window, true, DEFAULT_PAGE_SIZE, std::nullopt);
+                    }
+
+                    return MakeResponse("200 OK", res.dump(-1, ' ', false, JSON_DUMP_ERROR_HANDLER), "application/json; charset=utf-8");
+                }
+
+                // POST
+                if (request.GetMethod() == "POST") {
+                    auto req = json::parse(request.GetMessageBody(), nullptr, false);
+
+                    // ranks of many players: {uuids, board, window}
+                    if (request.GetPath() == RANKS_PATH) {
+                        std::string_view              board;
+                        auto                          window = RankingWindow::ALL;
+                        std::vector<std::string_view> uuids;
+                        if (!ParseRanksRequest(req, &board, &window, &uuids)) {
+                            return MakeResponse("400 Bad Request");
+                        }
+                        auto res = server->Read(reader, board, window, [&](const auto& ranking) { return GetRanks(ranking, &uuids); });
+                        return MakeResponse("200 OK", res.dump(-1, ' ', false, JSON_DUMP_ERROR_HANDLER), "application/json; charset=utf-8");
+                    }
+
+                    // season rollover: {board, archive}
+                    if (request.GetPath() == ROLLOVER_PATH) {
+                        std::string_view board, archive;
+                        if (!req.is_object() || !req.contains("archive") || !ParseBoard(req, "board", &board) || !ParseBoard(req, "archive", &archive) || board == archive) {
+                            return MakeResponse("400 Bad Request");
+                        }
+                        return MakeResponse(server->Rollover(reader, board, archive));
+                    }
+
+                    // bulk scores: [{uuid, user_name, score}, ...]
+                    if (request.GetPath() == SCORES_PATH) {
+                        if (!req.is_array()) {
+                            return MakeResponse("400 Bad Request");
+                        }
+                        // validate everything first so that a batch is applied entirely or not at all
+                        std::vector<ScoreSubmission> scores(req.size());
+                        for (std::size_t i = 0; i < req.size(); ++i) {
+                            if (!ParseScoreSubmission(req[i], &scores[i])) {
+                                return MakeResponse("400 Bad Request");
+                            }
+                        }
+                        if (std::any_of(scores.begin(), scores.end(), [&](const auto& score) { return server->IsFrozen(score.board); })) {
+                            return MakeResponse("403 Forbidden");
+                        }
+                        // write all scores at once
+                        auto log_time = GetLogTime();
+                        for (const auto& score : scores) {
+                            WriteNewScore(score, log_time);
+                        }
+                        return MakeResponse("200 OK");
+                    }
+
+                    ScoreSubmission score;
+                    if (!ParseScoreSubmission(req, &score)) {
+                        return MakeResponse("400 Bad Request");
+                    }
+                    if (server->IsFrozen(score.board)) {
+                        return MakeResponse("403 Forbidden");
+                    }
+
+                    // write new score
+                    WriteNewScore(score, GetLogTime());
+                    return MakeResponse("200 OK");
+                }
+
+                return MakeResponse("405 Method Not Allowed");
+            }
+
+            // answer one binary request into out, returns false if it is malformed (nothing is written then)
+            bool BinaryApp(const ors_binary_protocol::Frame& frame, std::string* out) {
+                ors_binary_protocol::Reader body(frame.body);
+                switch (frame.type) {
+                case ors_binary_protocol::MessageType::SUBMIT: {
+                    auto uuid      = body.ReadUuid();
+                    auto score     = body.ReadInt<std::int64_t>();
+                    auto user_name = body.ReadBytes(body.ReadInt<std::uint16_t>());
+                    auto board     = ReadBinaryBoard(&body);
+                    // names end up in JSON responses, the HTTP path gets them through json::parse, which wants UTF-8
+                    if (!body.IsComplete() || user_name.empty() || !IsValidUtf8(user_name) || board.empty()) {
+                        return false;
+                    }
+                    if (server->IsFrozen(board)) {
+                        server->metrics.Add(Counter::CLIENT_ERRORS);
+                        ors_binary_protocol::WriteEmpty(ors_binary_protocol::MessageType::FORBIDDEN, out);
+                        return true;
+                    }
+                    stagedScores.push_back({ std::string(board), { GetLogTime(), ors_binary_protocol::FormatUuid(uuid), std::string(user_name), score } });
+                    ors_binary_protocol::WriteEmpty(ors_binary_protocol::MessageType::OK, out);
+                    return true;
+                }
+                case ors_binary_protocol::MessageType::RANK: {
+                    auto uuid  = body.ReadUuid();
+                    auto board = ReadBinaryBoard(&body);
+                    if (!body.IsComplete() || board.empty()) {
+                        return false;
+                    }
+                    server->Read(reader, board, [&](const auto& ranking) { WriteMyRanking(ranking, ors_binary_protocol::FormatUuid(uuid), out); });
+                    return true;
+                }
+                case ors_binary_protocol::MessageType::TOP: {
+                    auto limit = body.ReadInt<std::uint32_t>();
+                    auto board = ReadBinaryBoard(&body);
+                    if (!body.IsComplete() || board.empty()) {
+                        return false;
+                    }
+                    auto n = ClampLimit(limit == ors_binary_protocol::ALL_ENTRIES ? std::int64_t(-1) : std::int64_t(limit));
+                    server->Read(reader, board, [&](const auto& ranking) { WriteTopRanking(ranking, n, out); });
+                    return true;
+                }
+                default:
+                    return false;
+                }
+            }
+
+            // stage a score for CommitScores
+            void WriteNewScore(const ScoreSubmission& score, const std::string& log_time) {
+                stagedScores.push_back({ std::string(score.board), { log_time, *score.uuid, *score.userName, score.score } });
+            }
+
+            // the board of a binary request, DEFAULT_BOARD without one and empty if it is not valid
+            static std::string_view ReadBinaryBoard(ors_binary_protocol::Reader* body) {
+                auto board = ors_binary_protocol::ReadBoard(body);
+                if (board.empty()) {
+                    return body->IsComplete() ? DEFAULT_BOARD : std::string_view();
+                }
+                return IsValidBoardId(board) ? board : std::string_view();
+            }
+
+            OrsApiServer*                                           server;
+            // slot of this thread for lock-free reads of the ranking
+            std::size_t                                             reader;
+            SOCKET                                                  listenSock;
+            SOCKET                                                  binaryListenSock;
+            socket_helper::Poller                                   poller;
+            std::unordered_map<SOCKET, std::unique_ptr<Connection>> connections;
+            // scores of this round that are not committed yet, and the connections waiting for them
+            std::vector<BoardUpdate>                                stagedScores;
+            std::vector<SOCKET>                                     committingConnections;
+            // the batch handed to the ranking writers, applied is set on a writer thread
+            std::vector<SOCKET>                                     applyingConnections;
+            bool                                                    applying = false;
+            std::atomic<bool>                                       applied  = false;
+
+        };
+
+        // a non-blocking listening socket on port for every worker
+        // without SO_REUSEPORT the workers share one and race to accept
+        std::vector<SOCKET> ListenAll(socket_helper::PORT listen_port) {
+            socket_helper::AddressList addr_list;
+            if (!socket_helper::GetAddrInfo(host, listen_port, &addr_list)) {
+                assert::ExceptionThrow(std::format("Cannot resolve {}:{}", host, listen_port));
+            }
+
+            std::vector<SOCKET> listen_socks;
+            SOCKET shared_listen_sock = INVALID_SOCKET;
+            for (std::size_t i = 0; i < workerCount; ++i) {
+                SOCKET listen_sock = shared_listen_sock;
+                if (listen_sock == INVALID_SOCKET) {
+                    listen_sock = socket_helper::Create();
+                    bool reuse_port = socket_helper::SetReusePort(&listen_sock);
+                    socket_helper::Bind(&listen_sock, *addr_list);
+                    socket_helper::Listen(&listen_sock, SOMAXCONN);
+                    socket_helper::SetNonBlocking(&listen_sock);
+                    if (!reuse_port) {
+                        shared_listen_sock = listen_sock;
+                    }
+                }
+                listen_socks.push_back(listen_sock);
+            }
+            return listen_socks;
+        }
+
+        void RunWorker(Worker* worker) {
+            try {
+                worker->Run();
+            }
+            catch (...) {
+                Stop(std::current_exception());
+            }
+        }
+
+        // make every worker return, the first failure is rethrown by Start
+        void Stop(std::exception_ptr exception) {
+            std::lock_guard lock(stopMutex);
+            if (!failure) {
+                failure = exception;
+            }
+            stopping = true;
+            for (auto& worker : workers) {
+                worker->Wakeup();
+            }
+        }
+
+        // restore the boards from their snapshots and the log on another thread, the snapshots are served meanwhile
+        void StartWarmUp() {
+            for (const auto& [board, window] : scoreLog->GetSnapshots()) {
+                if (!snapshots[board][static_cast<std::size_t>(window)].Open(scoreLog->GetSnapshotPath(board, window))) {
+                    assert::ExceptionThrow(std::format("Cannot open the ranking snapshot of {}", board));
+                }
+            }
+            auto frozen = std::make_shared<FrozenBoards>();
+            for (const auto& board : scoreLog->GetFrozenBoards()) {
+                auto snapshot = std::make_shared<RankingSnapshot>();
+                if (!snapshot->Open(scoreLog->GetFrozenPath(board))) {
+                    assert::ExceptionThrow(std::format("Cannot open the frozen board {}", board));
+                }
+                frozen->emplace(board, std::move(snapshot));
+            }
+            frozenBoards.store(std::move(frozen));
+
+            warmThread = std::thread([this] {
+                try {
+                    for (const auto& [board, windows] : snapshots) {
+                        for (std::size_t i = 0; i < WINDOW_COUNT; ++i) {
+                            windows[i].ForEachTop(-1, [&](const RankingEntryView& entry) {
+                                ranking->Load(board, static_cast<RankingWindow>(i), entry.uuid, entry.userName, entry.score, entry.logTime);
+                            });
+                        }
+                    }
+                    if (!scoreLog->Replay([&](const BoardUpdate& update) {
+                        if (update.reset) {
+                            ranking->Clear(update.board);
+                            return;
+                        }
+                        const auto& entry = update.entry;
+                        ranking->Load(update.board, entry.uuid, entry.userName, entry.score, entry.logTime);
+                    })) {
+                        assert::ExceptionThrow("Cannot replay the score log");
+                    }
+                    // scores committed in the meantime are waiting in the writer queues
+                    ranking->Start();
+                    warmed = true;
+                    // no reader is left on the snapshots after a grace period
+                    ranking->Synchronize();
+                    for (auto& [board, windows] : snapshots) {
+                        for (auto& snapshot : windows) {
+                            snapshot.Close();
+                        }
+                    }
+                }
+                catch (...) {
+                    Stop(std::current_exception());
+                }
+            });
+        }
+
+        // call function with what readers see of board: the snapshot of a frozen board, the snapshot during the
+        // warm-up, the ranking afterwards
+        template<class Function>
+        std::invoke_result_t<Function&, const ShardedRanking::View&> Read(std::size_t reader, std::string_view board, Function&& function) const {
+            return Read(reader, board, RankingWindow::ALL, std::forward<Function>(function));
+        }
+
+        // the same for window of board in the bucket of the current time
+        template<class Function>
+        std::invoke_result_t<Function&, const ShardedRanking::View&> Read(std::size_t reader, std::string_view board, RankingWindow window, Function&& function) const {
+            auto bucket = window == RankingWindow::ALL ? 0 : GetWindowBucket(window, GetLocalTime());
+            auto frozen = frozenBoards.load();
+            if (auto it = frozen->find(board); it != frozen->end()) {
+                return function(window == RankingWindow::ALL ? *it->second : emptySnapshot);
+            }
+            return ranking->Read(reader, board, window, bucket, [&](const ShardedRanking::View& view) {
+                if (warmed.load()) {
+                    return function(view);
+                }
+                auto it = snapshots.find(board);
+                if (it == snapshots.end()) {
+                    return function(emptySnapshot);
+                }
+                const auto& snapshot = it->second[static_cast<std::size_t>(window)];
+                return function(IsOfBucket(snapshot, window, bucket) ? snapshot : emptySnapshot);
+            });
+        }
+
+        // whether the snapshot of window holds the scores of bucket, all of its entries are of the same one
+        static bool IsOfBucket(const RankingSnapshot& snapshot, RankingWindow window, std::int64_t bucket) {
+            bool of_bucket = window == RankingWindow::ALL;
+            snapshot.ForEachTop(1, [&](const RankingEntryView& entry) {
+                of_bucket = GetWindowBucket(window, entry.logTime) == bucket;
+            });
+            return of_bucket;
+        }
+
+        bool IsFrozen(std::string_view board) const {
+            return frozenBoards.load()->contains(board);
+        }
+
+        // log updates and hand them to the ranking writers, returns true if on_applied is going to be called
+        // during the warm-up nobody reads the ranking yet, the scores are done once they are logged
+        bool Commit(std::vector<BoardUpdate>* updates, std::function<void()> on_applied) {
+            // the log and the writer queues get the batches of all workers in the same order
+            std::lock_guard lock(logMutex);
+            // scores staged before their board was frozen are dropped, the season is over
+            std::erase_if(*updates, [&](const BoardUpdate& update) { return IsFrozen(update.board); });
+            if (scoreLog) {
+                auto appending = ors_metrics::Clock::now();
+                if (!scoreLog->Append(*updates)) {
+                    assert::ExceptionThrow("Cannot write the score log");
+                }
+                metrics.Record(Stage::LOG_APPEND, appending);
+            }
+            metrics.Add(Counter::SCORES, updates->size());
+            bool wait = warmed.load();
+            if (!wait) {
+                on_applied = nullptr;
+            }
+            else {
+                // called on the writer thread of the last shard that applied the batch
+                on_applied = [this, on_applied = std::move(on_applied), submitted = ors_metrics::Clock::now()] {
+                    metrics.Record(Stage::INDEX_UPDATE, submitted);
+                    on_applied();
+                };
+            }
+            ranking->Submit(std::move(*updates), std::move(on_applied));
+            updates->clear();
+            return wait;
+        }
+
+        // freeze board as it is now into the new board archive and empty it, returns the status of the response
+        // blocks the calling worker and the commits of the others like a compaction. Scores of board that are not
+        // committed yet count for its next season. A crash before the reset is logged leaves the board as it was
+        // next to the archive
+        std::string_view Rollover(std::size_t reader, std::string_view board, std::string_view archive) {
+            // the frozen boards are files next to the log
+            if (!scoreLog) {
+                return "501 Not Implemented";
+            }
+            if (!warmed.load()) {
+                return "503 Service Unavailable";
+            }
+            std::lock_guard lock(logMutex);
+            if (IsFrozen(board)) {
+                return "403 Forbidden";
+            }
+            if (IsFrozen(archive) || ranking->Read(reader, archive, [](const ShardedRanking::View& view) { return view.Size() != 0; })) {
+                return "409 Conflict";
+            }
+
+            // the archive has to contain everything that was acknowledged for the board
+            ranking->Drain();
+            auto snapshot = std::make_shared<RankingSnapshot>();
+            if (!ranking->Read(reader, board, [&](const ShardedRanking::View& view) { return scoreLog->Freeze(archive, view); })
+                || !snapshot->Open(scoreLog->GetFrozenPath(archive))) {
+                assert::ShowWarning(ASSERT_FILE_LINE, "Cannot freeze the board");
+                return "500 Internal Server Error";
+            }
+
+            std::vector<BoardUpdate> reset{ { std::string(board), {}, true } };
+            if (!scoreLog->Append(reset)) {
+                assert::ExceptionThrow("Cannot write the score log");
+            }
+            ranking->Submit(std::move(reset));
+            ranking->Drain();
+
+            auto frozen = std::make_shared<FrozenBoards>(*frozenBoards.load());
+            frozen->emplace(archive, std::move(snapshot));
+            frozenBoards.store(std::move(frozen));
+            return "200 OK";
+        }
+
+        // compaction blocks the calling worker and the commits of the others, it only runs once the log has grown large
+        // every worker calls this after its commits: the size is checked without logMutex first
+        void CompactScoreLog(std::size_t reader) {
+            if (!scoreLog || !warmed.load() || scoreLog->GetLogSize() < COMPACT_LOG_SIZE || ors_metrics::Clock::now() < nextCompaction.load()) {
+                return;
+            }
+            std::lock_guard lock(logMutex);
+            // another worker may have compacted in the meantime
+            if (scoreLog->GetLogSize() < COMPACT_LOG_SIZE) {
+                return;
+            }
+            // the snapshots have to contain everything the log does
+            auto compacting = ors_metrics::Clock::now();
+            ranking->Drain();
+            // windows are written in their current bucket, an expired one loses its snapshot
+            if (!ranking->ReadBoards(reader, GetLocalTime(), [&](const std::vector<ShardedRanking::View>& boards) { return scoreLog->Compact(boards); })) {
+                assert::ShowWarning(ASSERT_FILE_LINE, "Cannot compact the score log");
+                nextCompaction = ors_metrics::Clock::now() + std::chrono::milliseconds(COMPACT_RETRY_INTERVAL_MS);
+            }
+            metrics.Record(Stage::COMPACTION, compacting);
+            metrics.Add(Counter::COMPACTIONS);
+        }
+
+        // body of a /metrics response: the ors_<counter>_total counters, the ors_stage_seconds histogram
+        // and the state of the server as gauges
+        std::string FormatMetrics() const {
+            std::string out;
+            ors_metrics::AppendPrometheus(metrics.GetSnapshot(), "ors", COUNTER_NAMES, STAGE_NAMES, &out);
+            out += std::format("# TYPE ors_warmed gauge\nors_warmed {}\n", warmed.load() ? 1 : 0);
+            out += std::format("# TYPE ors_frozen_boards gauge\nors_frozen_boards {}\n", frozenBoards.load()->size());
+            return out;
+        }
+
+        // {rank: {log_time, uuid, user_name, score}}, or {} if uuid is not ranked
+        template<class Ranking>
+        static ordered_json GetMyRanking(const Ranking& ranking_source, std::string_view uuid) {
+            ordered_json ranking = ordered_json::object();
+            if (auto entry = ranking_source.Find(uuid)) {
+                ranking[std::to_string(ranking_source.GetRank(entry->score))] = ToJson(*entry);
+            }
+            return ranking;
+        }
+
+        // append the next chunk of stream to out, returns true if it was the last one (the empty chunk included)
+        // the top ranking is {ranking: {log_time, uuid, user_name, score}, ...} numbered from 1, a page is
+        // {entries: [{rank, log_time, uuid, user_name, score}, ...], next: {score, uuid}} with next null on the
+        // last page. Every chunk is a seek in the ordered index: O(log n + CHUNK_ENTRIES)
+        // Ranking is a ShardedRanking::View or a RankingSnapshot
+        template<class Ranking>
+        static bool WriteRankingChunk(const Ranking& ranking_source, RankingStream* stream, std::string* out) {
+            auto chunk = BeginChunk(out);
+            if (stream->written == 0) {
+                *out += stream->page ? "{\"entries\":[" : "{";
+            }
+
+            auto count    = (std::min)(stream->remaining, CHUNK_ENTRIES);
+            bool has_next = false;
+            std::size_t      visited  = 0;
+            std::size_t      rank     = 0;
+            std::size_t      position = 0;
+            std::string_view last_uuid;
+            std::int64_t     last_score = 0;
+            auto write = [&](const auto& entry) {
+                // the entry after the page
+                if (++visited == stream->remaining && stream->page) {
+                    has_next = true;
+                    return;
+                }
+                if (stream->written) {
+                    *out += ',';
+                }
+                if (stream->page) {
+                    // equal scores share the rank of the first of them, as in RankEntries
+                    if (last_uuid.empty()) {
+                        rank     = ranking_source.GetRank(entry.score);
+                        position = ranking_source.GetPosition(entry);
+                    }
+                    else if (entry.score != last_score) {
+                        rank = position;
+                    }
+                    ++position;
+                    WriteEntryJson(rank, entry, out);
+                }
+                else {
+                    *out += '"';
+                    AppendJsonInt(static_cast<std::int64_t>(stream->written + 1), out);
+                    *out += "\":";
+                    WriteEntryJson(0, entry, out);
+                }
+                ++stream->written;
+                last_uuid  = entry.uuid;
+                last_score = entry.score;
+            };
+            if (stream->cursor) {
+                ranking_source.ForEachBelow(*stream->cursor, count, write);
+            }
+            else {
+                ranking_source.ForEachTop(static_cast<std::int64_t>(count), write);
+            }
+
+            // the views point into the ranking, which may change once this read is over
+            if (!last_uuid.empty()) {
+                stream->cursor = RankingEntry{ {}, std::string(last_uuid), {}, last_score };
+            }
+            // the ranking ends before the response
+            stream->remaining = visited < count ? 0 : stream->remaining - visited;
+
+            if (stream->remaining == 0) {
+                if (stream->page) {
+                    // the cursor of the next page is the last entry of this one
+                    *out += "],\"next\":";
+                    if (has_next) {
+                        *out += "{\"score\":";
+                        AppendJsonInt(stream->cursor->score, out);
+                        *out += ",\"uuid\":";
+                        AppendJsonString(stream->cursor->uuid, out);
+                        *out += '}';
+                    }
+                    else {
+                        *out += "null";
+                    }
+                }
+                *out += '}';
+            }
+            EndChunk(chunk, out);
+            if (stream->remaining) {
+                return false;
+            }
+            *out += "0\r\n\r\n";
+            return true;
+        }
+
+        // ToJson(entry).dump() with "rank" in front unless rank is 0, without building the json
+        // the user names of the index are escaped already
+        template<class Entry>
+        static void WriteEntryJson(std::size_t rank, const Entry& entry, std::string* out) {
+            *out += '{';
+            if (rank) {
+                *out += "\"rank\":";
+                AppendJsonInt(static_cast<std::int64_t>(rank), out);
+                *out += ',';
+            }
+            *out += "\"log_time\":";
+            AppendJsonString(entry.logTime, out);
+            *out += ",\"uuid\":";
+            AppendJsonString(entry.uuid, out);
+            *out += ",\"user_name\":";
+            if constexpr (std::is_same_v<Entry, RankingEntry>) {
+                if (!entry.userNameJson.empty()) {
+                    *out += entry.userNameJson;
+                }
+                else {
+                    AppendJsonString(entry.userName, out);
+                }
+            }
+            else {
+                AppendJsonString(entry.userName, out);
+            }
+            *out += ",\"score\":";
+            AppendJsonInt(entry.score, out);
+            *out += '}';
+        }
+
+        static std::size_t BeginChunk(std::string* out) {
+            auto pos = out->size();
+            *out += CHUNK_SIZE_PLACEHOLDER;
+            return pos;
+        }
+
+        // an empty chunk would end the body, it is dropped
+        static void EndChunk(std::size_t pos, std::string* out) {
+            auto data_size = out->size() - pos - (sizeof(CHUNK_SIZE_PLACEHOLDER) - 1);
+            if (data_size == 0) {
+                out->resize(pos);
+                return;
+            }
+            std::format_to_n(out->data() + pos, CHUNK_SIZE_DIGITS, "{:08x}", data_size);
+            *out += "\r\n";
+        }
+
+        // {rank, percentile, total, entries: [...]} of uuid and the around entries above and below it, or {} if
+        // uuid is not ranked. percentile is the share of the players ranked at or below it. O(log n + around)
+        // for a ShardedRanking::View (per shard) and a RankingSnapshot
+        template<class Ranking>
+        static ordered_json GetNeighborhood(const Ranking& ranking_source, std::string_view uuid, std::size_t around) {
+            ordered_json neighborhood = ordered_json::object();
+            auto entry = ranking_source.Find(uuid);
+            if (!entry) {
+                return neighborhood;
+            }
+
+            // the entries in ranking order, the ones above are visited nearest first
+            std::vector<ordered_json> entries;
+            ranking_source.ForEachAbove(*entry, around, [&](const auto& above) {
+                entries.push_back(ToJson(above));
+            });
+            std::reverse(entries.begin(), entries.end());
+            auto above_count = entries.size();
+            entries.push_back(ToJson(*entry));
+            ranking_source.ForEachBelow(*entry, around, [&](const auto& below) {
+                entries.push_back(ToJson(below));
+            });
+
+            RankEntries(ranking_source, ranking_source.GetPosition(*entry) - above_count, &entries);
+
+            auto total   = ranking_source.Size();
+            auto my_rank = entries[above_count]["rank"].get<std::size_t>();
+            neighborhood["rank"]       = my_rank;
+            neighborhood["percentile"] = 100.0 * static_cast<double>(total - my_rank + 1) / static_cast<double>(total);
+            neighborhood["total"]      = total;
+            neighborhood["entries"]    = std::move(entries);
+            return neighborhood;
+        }
+
+        // {entries: [{rank, log_time, uuid, user_name, score}, ...]} of the ranked ones of uuids in ranking order
+        // uuids are sorted and probed once each, the ranks are counted in ranking order so that equal scores share
+        // one GetRank: O(k log k + k log n) for k uuids, instead of a request per uuid. uuids is sorted in place
+        template<class Ranking>
+        static ordered_json GetRanks(const Ranking& ranking_source, std::vector<std::string_view>* uuids) {
+            std::sort(uuids->begin(), uuids->end());
+            uuids->erase(std::unique(uuids->begin(), uuids->end()), uuids->end());
+
+            // a RankingEntry pointer or a RankingEntryView, valid as long as ranking_source is
+            std::vector<decltype(ranking_source.Find(std::string_view()))> found;
+            for (auto uuid : *uuids) {
+                if (auto entry = ranking_source.Find(uuid)) {
+                    found.push_back(std::move(entry));
+                }
+            }
+            std::sort(found.begin(), found.end(), [](const auto& lhs, const auto& rhs) {
+                return lhs->score != rhs->score ? lhs->score > rhs->score : lhs->uuid < rhs->uuid;
+            });
+
+            ordered_json entries = ordered_json::array();
+            std::size_t  rank    = 0;
+            for (std::size_t i = 0; i < found.size(); ++i) {
+                if (i == 0 || found[i]->score != found[i - 1]->score) {
+                    rank = ranking_source.GetRank(found[i]->score);
+                }
+                ordered_json entry;
+                entry["rank"] = rank;
+                entry.update(ToJson(*found[i]));
+                entries.push_back(std::move(entry));
+            }
+
+            ordered_json ranks;
+            ranks["entries"] = std::move(entries);
+            return ranks;
+        }
+
+        // put the rank in front of consecutive entries in ranking order, the first of them at position
+        // equal scores share the rank of the first of them, as in GetRank
+        template<class Ranking>
+        static void RankEntries(const Ranking& ranking_source, std::size_t position, std::vector<ordered_json>* entries) {
+            std::size_t rank = 0;
+            for (std::size_t i = 0; i < entries->size(); ++i, ++position) {
+                auto& entry = (*entries)[i];
+                auto  score = entry["score"].get<std::int64_t>();
+                if (i == 0) {
+                    rank = ranking_source.GetRank(score);
+                }
+                else if (score != (*entries)[i - 1]["score"].get<std::int64_t>()) {
+                    rank = position;
+                }
+                ordered_json ranked;
+                ranked["rank"] = rank;
+                ranked.update(entry);
+                entry = std::move(ranked);
+            }
+        }
+
+        // a negative or too large limit is MAX_PAGE_SIZE
+        static std::int64_t ClampLimit(std::int64_t limit) {
+            return limit < 0 ? static_cast<std::int64_t>(MAX_PAGE_SIZE) : (std::min)(limit, static_cast<std::int64_t>(MAX_PAGE_SIZE));
+        }
+
+        // ENTRIES frame of the top ranking
+        template<class Ranking>
+        static void WriteTopRanking(const Ranking& ranking, std::int64_t limit, std::string* out) {
+            auto pos = ors_binary_protocol::BeginEntries(out);
+            std::uint32_t count = 0;
+            ranking.ForEachTop(limit, [&](const auto& entry) {
+                ++count;
+                ors_binary_protocol::WriteEntry(count, entry.score, entry.uuid, entry.userName, entry.logTime, out);
+            });
+            ors_binary_protocol::EndEntries(pos, count, out);
+        }
+
+        // ENTRIES frame of GetMyRanking
+        template<class Ranking>
+        static void WriteMyRanking(const Ranking& ranking, std::string_view uuid, std::string* out) {
+            auto pos = ors_binary_protocol::BeginEntries(out);
+            std::uint32_t count = 0;
+            if (auto entry = ranking.Find(uuid)) {
+                ++count;
+                ors_binary_protocol::WriteEntry(ranking.GetRank(entry->score), entry->score, entry->uuid, entry->userName, entry->logTime, out);
+            }
+            ors_binary_protocol::EndEntries(pos, count, out);
+        }
+
+        // Entry is a RankingEntry or a RankingEntryView
+        template<class Entry>
+        static ordered_json ToJson(const Entry& entry) {
+            ordered_json j;
+            j["log_time"]  = entry.logTime;
+            j["uuid"]      = entry.uuid;
+            j["user_name"] = entry.userName;
+            j["score"]     = entry.score;
+            return j;
+        }
+
+        // the optional board id member key of req, DEFAULT_BOARD without it. Returns false if it is not a valid id
+        static bool ParseBoard(const json& req, const char* key, std::string_view* board) {
+            auto it = req.find(key);
+            if (it == req.end()) {
+                *board = DEFAULT_BOARD;
+                return true;
+            }
+            if (!it->is_string() || !IsValidBoardId(it->get_ref<const std::string&>())) {
+                return false;
+            }
+            *board = it->get_ref<const std::string&>();
+            return true;
+        }
+
+        // {uuids: [<uuid>, ...], board, window} of /ranks, the uuids view req
+        static bool ParseRanksRequest(const json& req, std::string_view* board, RankingWindow* window, std::vector<std::string_view>* uuids) {
+            if (!req.is_object() || !ParseBoard(req, "board", board)) {
+                return false;
+            }
+            if (auto it = req.find("window"); it != req.end() && (!it->is_string() || !ParseRankingWindow(it->get_ref<const std::string&>(), window))) {
+                return false;
+            }
+            auto it = req.find("uuids");
+            if (it == req.end() || !it->is_array() || it->size() > MAX_PAGE_SIZE) {
+                return false;
+            }
+            for (const auto& uuid : *it) {
+                if (!uuid.is_string()) {
+                    return false;
+                }
+                uuids->push_back(uuid.get_ref<const std::string&>());
+            }
+            return true;
+        }
+
+        static bool ParseScoreSubmission(const json& req, ScoreSubmission* submission) {
+            if (!req.is_object()) {
+                return false;
+            }
+
+            auto uuid      = req.find("uuid");
+            auto user_name = req.find("user_name");
+            auto score     = req.find("score");
+            if (uuid == req.end() || user_name == req.end() || score == req.end()) {
+                return false;
+            }
+            if (!uuid->is_string() || !user_name->is_string() || uuid->get_ref<const std::string&>().empty() || user_name->get_ref<const std::string&>().empty()) {
+                return false;
+            }
+            // longer strings do not fit into a ScoreLog record
+            if (uuid->get_ref<const std::string&>().size() > ScoreLog::MAX_FIELD_SIZE || user_name->get_ref<const std::string&>().size() > ScoreLog::MAX_FIELD_SIZE) {
+                return false;
+            }
+
+            submission->uuid     = &uuid->get_ref<const std::string&>();
+            submission->userName = &user_name->get_ref<const std::string&>();
+            return ParseBoard(req, "board", &submission->board) && ParseScore(*score, &submission->score);
+        }
+
+        // scores are integers, numeric strings are accepted as well (orsapiserverrqestmethod.py sends them)
+        static bool ParseScore(const json& score, std::int64_t* value) {
+            if (score.is_number_integer()) {
+                *value = score.get<std::int64_t>();
+                return true;
+            }
+            if (score.is_string()) {
+                return ParseInteger(score.get_ref<const std::string&>(), value);
+            }
+            return false;
+        }
+
+        // first non-empty value of name in an application/x-www-form-urlencoded query string
+        static std::optional<std::string> GetQueryParameter(std::string_view query_string, std::string_view name) {
+            while (!query_string.empty()) {
+                auto amp   = query_string.find('&');
+                auto param = query_string.substr(0, amp);
+                auto eq    = param.find('=');
+                if (eq != std::string_view::npos && UrlDecode(param.substr(0, eq)) == name) {
+                    if (auto value = UrlDecode(param.substr(eq + 1)); !value.empty()) {
+                        return value;
+                    }
+                }
+                if (amp == std::string_view::npos) {
+                    break;
+                }
+                query_string.remove_prefix(amp + 1);
+            }
+            return std::nullopt;
+        }
+
+        // the whole of str as a decimal integer
+        template<class T>
+        static bool ParseInteger(const std::string& str, T* value) {
+            auto [ptr, ec] = std::from_chars(str.data(), str.data() + str.size(), *value);
+            return ec == std::errc() && ptr == str.data() + str.size();
+        }
+
+        static std::string UrlDecode(std::string_view str) {
+            std::string decoded;
+            decoded.reserve(str.size());
+            for (std::size_t i = 0; i < str.size(); ++i) {
+                if (str[i] == '+') {
+                    decoded += ' ';
+                }
+                else if (str[i] == '%' && i + 2 < str.size() && std::isxdigit(static_cast<unsigned char>(str[i + 1])) && std::isxdigit(static_cast<unsigned char>(str[i + 2]))) {
+                    int c = 0;
+                    std::from_chars(str.data() + i + 1, str.data() + i + 3, c, 16);
+                    decoded += static_cast<char>(c);
+                    i += 2;
+                }
+                else {
+                    decoded += str[i];
+                }
+            }
+            return decoded;
+        }
+
+        static Response MakeResponse(std::string_view status, std::string body = {}, std::string_view content_type = {}) {
+            return Response{ status, std::move(body), content_type };
+        }
+
+        // streamed response of count entries of the top ranking of window of board, or a page of count entries after cursor
+        static Response MakeRankingResponse(std::string board, RankingWindow window, bool page, std::size_t count, std::optional<RankingEntry> cursor) {
+            auto response = MakeResponse("200 OK", {}, "application/json; charset=utf-8");
+            response.stream = std::make_unique<RankingStream>();
+            response.stream->board     = std::move(board);
+            response.stream->window    = window;
+            response.stream->page      = page;
+            response.stream->remaining = page ? count + 1 : count;
+            response.stream->cursor    = std::move(cursor);
+            return response;
+        }
+
+        // append the response message to out, HTTP/1.1 connections stay open unless keep_alive is false
+        static void WriteResponse(const Response& response, bool keep_alive, std::string* out) {
+            *out += std::format("HTTP/1.1 {}\r\n", response.status);
+            *out += "Access-Control-Allow-Origin: *\r\n";
+            *out += "Access-Control-Allow-Headers: Content-Type\r\n";
+            *out += "Access-Control-Allow-Methods: GET, POST\r\n";
+            if (!response.contentType.empty()) {
+                *out += std::format("Content-Type: {}\r\n", response.contentType);
+            }
+            if (response.stream) {
+                *out += "Transfer-Encoding: chunked\r\n";
+            }
+            else {
+                *out += std::format("Content-Length: {}\r\n", response.body.size());
+            }
+            if (!keep_alive) {
+                *out += "Connection: close\r\n";
+            }
+            *out += "\r\n";
+            *out += response.body;
+        }
+
+        // the local time now, the offset of the time zone is looked up again only when it changes
+        static std::chrono::local_seconds GetLocalTime() {
+            static const std::chrono::time_zone* zone = std::chrono::current_zone();
+            thread_local std::chrono::sys_info   info;
+            auto now = std::chrono::floor<std::chrono::seconds>(std::chrono::system_clock::now());
+            if (now < info.begin || now >= info.end) {
+                info = zone->get_info(now);
+            }
+            return std::chrono::local_seconds((now + info.offset).time_since_epoch());
+        }
+
+        // log time of a score submitted now, only formatted when a score is stored
+        static std::string GetLogTime() {
+            return std::format("{:%Y-%m-%d %H:%M:%S}", GetLocalTime());
+        }
+        ShardedRanking*                      ranking;
+        ScoreLog*                            scoreLog;
+        std::string                          host;
+        socket_helper::PORT                  port;
+        socket_helper::PORT                  binaryPort;
+        std::size_t                          workerCount;
+        std::vector<std::unique_ptr<Worker>> workers;
+        std::atomic<bool>                    stopping = false;
+        // guards workers and failure against Stop from other threads
+        std::mutex                           stopMutex;
+        std::exception_ptr                   failure;
+        // serializes appends to the log and submissions to the ranking
+        std::mutex                           logMutex;
+        // no compaction is started before this, set after a failed one
+        std::atomic<ors_metrics::Clock::time_point> nextCompaction{};
+        Metrics                              metrics;
+        // warm-up: readers use the snapshots of the boards (by window) until warmed is set
+        std::map<std::string, std::array<RankingSnapshot, WINDOW_COUNT>, std::less<>> snapshots;
+        RankingSnapshot                      emptySnapshot;
+        std::thread                          warmThread;
+        std::atomic<bool>                    warmed   = false;
+        // never null, changed under logMutex
+        std::atomic<std::shared_ptr<const FrozenBoards>> frozenBoards{ std::make_shared<const FrozenBoards>() };
+
+    };
+};
@@ -0,0 +1,10 @@
+﻿#pragma once
+
+#include "common/Assert.h"
+#include "common/Convert.h"
+#include "common/Macro.h"
+#include "common/SocketHelper.h"
+#include "common/StdC++.h"
+
+#include "nlohmann/json.hpp"
+using json = nlohmann::json;
@@ -0,0 +1,371 @@
+﻿#pragma once
+
+#include "JsonWriter.h"
+
+namespace ors_api_server
+{
+    // one row of the ranking, same columns as the ors table of orsapiserver.py
+    struct RankingEntry
+    {
+        std::string  logTime;
+        std::string  uuid;
+        std::string  userName;
+        std::int64_t score = 0;
+        // userName as a JSON string literal, escaped once when the entry is ranked so that responses
+        // copy it as is (user_name never changes after that), empty for entries outside the index
+        std::string  userNameJson;
+    };
+
+    // board of the requests that do not name one, the single ranking of the earlier versions
+    inline constexpr std::string_view DEFAULT_BOARD     = "ors";
+    inline constexpr std::size_t      MAX_BOARD_ID_SIZE = 64;
+
+    // board ids are [A-Za-z0-9_-], they are used in file names
+    inline bool IsValidBoardId(std::string_view board) {
+        if (board.empty() || board.size() > MAX_BOARD_ID_SIZE) {
+            return false;
+        }
+        return std::all_of(board.begin(), board.end(), [](char c) {
+            return ('a' <= c && c <= 'z') || ('A' <= c && c <= 'Z') || ('0' <= c && c <= '9') || c == '_' || c == '-';
+        });
+    }
+
+    // a score for one board, or with reset the end of the board's season: the board is emptied
+    struct BoardUpdate
+    {
+        std::string  board;
+        RankingEntry entry;
+        bool         reset = false;
+    };
+
+    // time windows of a board: the all-time ranking and the rankings of the current hour, day and week
+    // a windowed ranking holds the best score of every player among the scores of its current bucket, the
+    // calendar hour, day or week (from Monday) of log_time. It starts empty when the next bucket begins
+    enum class RankingWindow : std::uint8_t {
+        ALL,
+        HOUR,
+        DAY,
+        WEEK,
+    };
+
+    inline constexpr std::size_t WINDOW_COUNT = 4;
+    // the window query parameter, in the order of RankingWindow
+    inline constexpr std::array<std::string_view, WINDOW_COUNT> WINDOW_NAMES = { "all", "hour", "day", "week" };
+    // bucket of a log time that cannot be parsed, ordered before every other one
+    inline constexpr std::int64_t NO_BUCKET = (std::numeric_limits<std::int64_t>::min)();
+
+    inline bool ParseRankingWindow(std::string_view name, RankingWindow* window) {
+        auto it = std::find(WINDOW_NAMES.begin(), WINDOW_NAMES.end(), name);
+        if (it == WINDOW_NAMES.end()) {
+            return false;
+        }
+        *window = static_cast<RankingWindow>(it - WINDOW_NAMES.begin());
+        return true;
+    }
+
+    // bucket of the hour of the day (days since 1970-01-01) in window: the hours, days or weeks since 1970-01-01,
+    // always 0 for ALL. Later buckets are greater
+    inline std::int64_t GetWindowBucket(RankingWindow window, std::int64_t days, std::int64_t hour) {
+        switch (window) {
+        case RankingWindow::ALL:
+            return 0;
+        case RankingWindow::HOUR:
+            return days * 24 + hour;
+        case RankingWindow::DAY:
+            return days;
+        default:
+            // 1970-01-01 was a Thursday, weeks start on the Monday 3 days before
+            return days + 3 >= 0 ? (days + 3) / 7 : (days + 3 - 6) / 7;
+        }
+    }
+
+    // bucket of a local time in window, the same as that of its log time
+    inline std::int64_t GetWindowBucket(RankingWindow window, std::chrono::local_seconds time) {
+        auto days = std::chrono::floor<std::chrono::days>(time);
+        return GetWindowBucket(window, days.time_since_epoch().count(), std::chrono::floor<std::chrono::hours>(time - days).count());
+    }
+
+    // bucket of log_time ("YYYY-MM-DD HH:MM:SS", local time) in window, NO_BUCKET if log_time is not in that form
+    inline std::int64_t GetWindowBucket(RankingWindow window, std::string_view log_time) {
+        if (window == RankingWindow::ALL) {
+            return 0;
+        }
+        auto parse = [&](std::size_t pos, std::size_t size, auto* value) {
+            auto [ptr, ec] = std::from_chars(log_time.data() + pos, log_time.data() + pos + size, *value);
+            return ec == std::errc() && ptr == log_time.data() + pos + size;
+        };
+        int      year  = 0;
+        unsigned month = 0, day = 0, hour = 0;
+        if (log_time.size() < 13 || log_time[4] != '-' || log_time[7] != '-' || log_time[10] != ' '
+            || !parse(0, 4, &year) || !parse(5, 2, &month) || !parse(8, 2, &day) || !parse(11, 2, &hour) || hour > 23) {
+            return NO_BUCKET;
+        }
+        std::chrono::year_month_day date{ std::chrono::year(year), std::chrono::month(month), std::chrono::day(day) };
+        if (!date.ok()) {
+            return NO_BUCKET;
+        }
+        return GetWindowBucket(window, std::chrono::sys_days(date).time_since_epoch().count(), hour);
+    }
+
+    // in-memory ranking ordered by score (descending) and uuid, with a uuid hash index
+    // implemented as a treap whose nodes know the size of their subtree (order-statistic tree),
+    // so that updates and rank queries are O(log n), and the top-K and the K neighbors of an entry are O(log n + K)
+    class RankingIndex
+    {
+    public:
+
+        RankingIndex() = default;
+        RankingIndex(const RankingIndex&) = delete;
+        RankingIndex& operator=(const RankingIndex&) = delete;
+
+        // same rules as ORSDB.write_new_score:
+        // a new uuid is inserted, an existing one is updated only if the score is not lower
+        // returns true if the ranking changed
+        bool WriteNewScore(std::string_view uuid, std::string_view user_name, std::int64_t score, std::string_view log_time) {
+            if (auto it = uuidIndex.find(uuid); it != uuidIndex.end()) {
+                Node* node = it->second;
+                if (node->entry.score > score) {
+                    return false;
+                }
+                // detach, change the key and put it back at its new position
+                auto detached = Erase(&root, node->entry);
+                detached->entry.logTime = log_time;
+                detached->entry.score   = score;
+                Insert(&root, std::move(detached));
+                return true;
+            }
+
+            auto node = std::make_unique<Node>();
+            node->entry.logTime  = log_time;
+            node->entry.uuid     = uuid;
+            node->entry.userName = user_name;
+            node->entry.score    = score;
+            AppendJsonString(user_name, &node->entry.userNameJson);
+            node->priority       = NextPriority();
+            uuidIndex.emplace(node->entry.uuid, node.get());
+            Insert(&root, std::move(node));
+            return true;
+        }
+
+        // entry of uuid, nullptr if it is not ranked
+        const RankingEntry* Find(std::string_view uuid) const {
+            if (auto it = uuidIndex.find(uuid); it != uuidIndex.end()) {
+                return &it->second->entry;
+            }
+            return nullptr;
+        }
+
+        // rank of a score with the same semantics as RANK() OVER(ORDER BY score DESC):
+        // 1 + number of entries with a strictly higher score, equal scores share a rank
+        std::size_t GetRank(std::int64_t score) const {
+            std::size_t higher = 0;
+            const Node* node = root.get();
+            while (node) {
+                if (node->entry.score > score) {
+                    higher += Size(node->left.get()) + 1;
+                    node = node->right.get();
+                }
+                else {
+                    node = node->left.get();
+                }
+            }
+            return higher + 1;
+        }
+
+        // visit the first limit entries in ranking order, a negative limit visits all
+        template<class Visitor>
+        void ForEachTop(std::int64_t limit, Visitor&& visitor) const {
+            std::size_t count = limit < 0 ? Size(root.get()) : static_cast<std::size_t>(limit);
+
+            // in-order traversal with an explicit stack, stops after count entries
+            std::vector<const Node*> stack;
+            const Node* node = root.get();
+            while (count && (node || !stack.empty())) {
+                while (node) {
+                    stack.push_back(node);
+                    node = node->left.get();
+                }
+                node = stack.back();
+                stack.pop_back();
+                visitor(node->entry);
+                --count;
+                node = node->right.get();
+            }
+        }
+
+        // 1 + number of entries ordered before entry, entry does not have to be in the index
+        std::size_t GetPosition(const RankingEntry& entry) const {
+            std::size_t before = 0;
+            const Node* node = root.get();
+            while (node) {
+                if (Less(node->entry, entry)) {
+                    before += Size(node->left.get()) + 1;
+                    node = node->right.get();
+                }
+                else {
+                    node = node->left.get();
+                }
+            }
+            return before + 1;
+        }
+
+        // visit up to count entries ordered before entry (higher in the ranking), nearest first
+        template<class Visitor>
+        void ForEachAbove(const RankingEntry& entry, std::size_t count, Visitor&& visitor) const {
+            // the stack holds the path to the predecessor of entry, each node followed by the right spine
+            // of its left subtree is the reverse in-order traversal from there
+            std::vector<const Node*> stack;
+            const Node* node = root.get();
+            while (node) {
+                if (Less(node->entry, entry)) {
+                    stack.push_back(node);
+                    node = node->right.get();
+                }
+                else {
+                    node = node->left.get();
+                }
+            }
+            while (count && !stack.empty()) {
+                node = stack.back();
+                stack.pop_back();
+                visitor(node->entry);
+                --count;
+                for (node = node->left.get(); node; node = node->right.get()) {
+                    stack.push_back(node);
+                }
+            }
+        }
+
+        // visit up to count entries ordered after entry (lower in the ranking), nearest first
+        template<class Visitor>
+        void ForEachBelow(const RankingEntry& entry, std::size_t count, Visitor&& visitor) const {
+            // mirror image of ForEachAbove
+            std::vector<const Node*> stack;
+            const Node* node = root.get();
+            while (node) {
+                if (Less(entry, node->entry)) {
+                    stack.push_back(node);
+                    node = node->left.get();
+                }
+                else {
+                    node = node->right.get();
+                }
+            }
+            while (count && !stack.empty()) {
+                node = stack.back();
+                stack.pop_back();
+                visitor(node->entry);
+                --count;
+                for (node = node->right.get(); node; node = node->left.get()) {
+                    stack.push_back(node);
+                }
+            }
+        }
+
+        std::size_t Size() const {
+            return Size(root.get());
+        }
+
+        void Clear() {
+            uuidIndex.clear();
+            root.reset();
+        }
+
+    private:
+
+        struct Node
+        {
+            RankingEntry          entry;
+            std::uint32_t         priority = 0;
+            std::size_t           size     = 1;
+            std::unique_ptr<Node> left;
+            std::unique_ptr<Node> right;
+        };
+
+        // ranking order: higher score first, uuid breaks ties
+        static bool Less(const RankingEntry& lhs, const RankingEntry& rhs) {
+            if (lhs.score != rhs.score) {
+                return lhs.score > rhs.score;
+            }
+            return lhs.uuid < rhs.uuid;
+        }
+
+        static std::size_t Size(const Node* node) {
+            return node ? node->size : 0;
+        }
+
+        static void Update(Node* node) {
+            node->size = Size(node->left.get()) + Size(node->right.get()) + 1;
+        }
+
+        // split into entries ordered before key (left) and the rest (right)
+        static void Split(std::unique_ptr<Node> node, const RankingEntry& key, std::unique_ptr<Node>* left, std::unique_ptr<Node>* right) {
+            if (!node) {
+                left->reset();
+                right->reset();
+                return;
+            }
+            if (Less(node->entry, key)) {
+                Split(std::move(node->right), key, &node->right, right);
+                Update(node.get());
+                *left = std::move(node);
+            }
+            else {
+                Split(std::move(node->left), key, left, &node->left);
+                Update(node.get());
+                *right = std::move(node);
+            }
+        }
+
+        // concatenate two treaps, every entry of left is ordered before every entry of right
+        static std::unique_ptr<Node> Merge(std::unique_ptr<Node> left, std::unique_ptr<Node> right) {
+            if (!left) {
+                return right;
+            }
+            if (!right) {
+                return left;
+            }
+            if (left->priority > right->priority) {
+                left->right = Merge(std::move(left->right), std::move(right));
+                Update(left.get());
+                return left;
+            }
+            right->left = Merge(std::move(left), std::move(right->left));
+            Update(right.get());
+            return right;
+        }
+
+        static void Insert(std::unique_ptr<Node>* node, std::unique_ptr<Node> new_node) {
+            // descend while the priorities keep the heap order, then split the subtree around the new node
+            while (*node && (*node)->priority > new_node->priority) {
+                ++(*node)->size;
+                node = Less(new_node->entry, (*node)->entry) ? &(*node)->left : &(*node)->right;
+            }
+            Split(std::move(*node), new_node->entry, &new_node->left, &new_node->right);
+            Update(new_node.get());
+            *node = std::move(new_node);
+        }
+
+        static std::unique_ptr<Node> Erase(std::unique_ptr<Node>* node, const RankingEntry& key) {
+            // the key exists, so every node on the way loses one descendant
+            while (&(*node)->entry != &key) {
+                --(*node)->size;
+                node = Less(key, (*node)->entry) ? &(*node)->left : &(*node)->right;
+            }
+            auto erased = std::move(*node);
+            *node = Merge(std::move(erased->left), std::move(erased->right));
+            erased->size = 1;
+            return erased;
+        }
+
+        std::uint32_t NextPriority() {
+            return static_cast<std::uint32_t>(engine());
+        }
+
+        std::unique_ptr<Node>                    root;
+        // keys view the uuid stored in the node, nodes never move
+        std::unordered_map<std::string_view, Node*> uuidIndex;
+        std::mt19937                             engine{ std::random_device()() };
+
+    };
+};
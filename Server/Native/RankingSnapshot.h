@@ -0,0 +1,380 @@
+﻿#pragma once
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "RankingIndex.h"
+
+namespace ors_api_server
+{
+    // flush the stdio buffer and the operating system cache of file
+    inline bool SyncFile(std::FILE* file) {
+        if (std::fflush(file) != 0) {
+            return false;
+        }
+#ifdef _WIN32
+        return _commit(_fileno(file)) == 0;
+#else
+        return fsync(fileno(file)) == 0;
+#endif
+    }
+
+    // read-only memory mapping of a whole file
+    class MappedFile
+    {
+    public:
+
+        MappedFile() = default;
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        ~MappedFile() {
+            Close();
+        }
+
+        bool Open(const std::string& path) {
+            Close();
+#ifdef _WIN32
+            HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+            if (file == INVALID_HANDLE_VALUE) {
+                return false;
+            }
+            LARGE_INTEGER file_size{};
+            if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0) {
+                CloseHandle(file);
+                return false;
+            }
+            HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+            CloseHandle(file);
+            if (!mapping) {
+                return false;
+            }
+            // the view keeps the mapping alive
+            void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+            CloseHandle(mapping);
+            if (!view) {
+                return false;
+            }
+            data = static_cast<const char*>(view);
+            size = static_cast<std::size_t>(file_size.QuadPart);
+#else
+            int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd == -1) {
+                return false;
+            }
+            struct stat st{};
+            if (fstat(fd, &st) == -1 || st.st_size == 0) {
+                close(fd);
+                return false;
+            }
+            // the mapping stays valid after the descriptor is closed
+            void* view = mmap(nullptr, static_cast<std::size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+            close(fd);
+            if (view == MAP_FAILED) {
+                return false;
+            }
+            data = static_cast<const char*>(view);
+            size = static_cast<std::size_t>(st.st_size);
+#endif
+            return true;
+        }
+
+        void Close() {
+            if (!data) {
+                return;
+            }
+#ifdef _WIN32
+            UnmapViewOfFile(data);
+#else
+            munmap(const_cast<char*>(data), size);
+#endif
+            data = nullptr;
+            size = 0;
+        }
+
+        std::string_view Data() const {
+            return std::string_view(data, size);
+        }
+
+    private:
+
+        const char* data = nullptr;
+        std::size_t size = 0;
+
+    };
+
+    // RankingEntry whose strings point into a RankingSnapshot
+    struct RankingEntryView
+    {
+        std::string_view logTime;
+        std::string_view uuid;
+        std::string_view userName;
+        std::int64_t     score = 0;
+    };
+
+    // versioned binary snapshot of a RankingIndex, queried in place through a memory mapping
+    // so that a restarted server can answer right away instead of rebuilding its index first
+    //
+    // layout, integers little endian, offsets from the start of the file:
+    //   header:  u32 magic, u32 version, u64 entry count, u64 records offset, u64 uuid order offset,
+    //            u64 strings offset, u64 strings size
+    //   records: entry count fixed-width records in ranking order (score descending, uuid ascending)
+    //            i64 score, u32 uuid, u32 user_name, u32 log_time (offsets into strings),
+    //            u16 uuid size, u16 user_name size, u16 log_time size, u16 reserved, u32 reserved
+    //   uuid order: entry count u32 record indices sorted by uuid
+    //   strings: uuids, and each distinct user_name and log_time once
+    // the records array is the ranking itself: the rank of a score is found by binary search,
+    // the top-K are the first K records
+    class RankingSnapshot
+    {
+    public:
+
+        static constexpr std::uint32_t MAGIC   = 0x5053524F; // "ORSP"
+        static constexpr std::uint32_t VERSION = 1;
+
+        // write index to path, returns false on I/O errors
+        // Ranking is anything with Size and ForEachTop of RankingEntry, a RankingIndex or a ShardedRanking::View
+        template<class Ranking>
+        static bool Write(const std::string& path, const Ranking& index) {
+            std::vector<Record>                                 records;
+            std::string                                         strings;
+            std::unordered_map<std::string_view, std::uint32_t> interned;
+            records.reserve(index.Size());
+
+            auto add_string = [&](std::string_view str) {
+                auto offset = static_cast<std::uint32_t>(strings.size());
+                strings += str;
+                return offset;
+            };
+            auto intern_string = [&](std::string_view str) {
+                if (auto it = interned.find(str); it != interned.end()) {
+                    return it->second;
+                }
+                auto offset = add_string(str);
+                interned.emplace(str, offset);
+                return offset;
+            };
+
+            bool ok = true;
+            index.ForEachTop(-1, [&](const RankingEntry& entry) {
+                Record record{};
+                record.score        = entry.score;
+                record.uuid         = add_string(entry.uuid);
+                record.userName     = intern_string(entry.userName);
+                record.logTime      = intern_string(entry.logTime);
+                record.uuidSize     = static_cast<std::uint16_t>(entry.uuid.size());
+                record.userNameSize = static_cast<std::uint16_t>(entry.userName.size());
+                record.logTimeSize  = static_cast<std::uint16_t>(entry.logTime.size());
+                records.push_back(record);
+                // offsets are 32 bit
+                ok = ok && strings.size() <= UINT32_MAX;
+            });
+            if (!ok) {
+                return false;
+            }
+
+            std::vector<std::uint32_t> uuid_order(records.size());
+            std::iota(uuid_order.begin(), uuid_order.end(), 0);
+            std::sort(uuid_order.begin(), uuid_order.end(), [&](std::uint32_t lhs, std::uint32_t rhs) {
+                return GetString(strings, records[lhs].uuid, records[lhs].uuidSize) < GetString(strings, records[rhs].uuid, records[rhs].uuidSize);
+            });
+
+            Header header{};
+            header.magic           = MAGIC;
+            header.version         = VERSION;
+            header.entryCount      = records.size();
+            header.recordsOffset   = sizeof(Header);
+            header.uuidOrderOffset = header.recordsOffset + records.size() * sizeof(Record);
+            header.stringsOffset   = header.uuidOrderOffset + uuid_order.size() * sizeof(std::uint32_t);
+            header.stringsSize     = strings.size();
+
+            std::FILE* file = std::fopen(path.c_str(), "wb");
+            if (!file) {
+                return false;
+            }
+            ok = std::fwrite(&header, sizeof(header), 1, file) == 1
+                && std::fwrite(records.data(), sizeof(Record), records.size(), file) == records.size()
+                && std::fwrite(uuid_order.data(), sizeof(std::uint32_t), uuid_order.size(), file) == uuid_order.size()
+                && std::fwrite(strings.data(), 1, strings.size(), file) == strings.size()
+                && SyncFile(file);
+            std::fclose(file);
+            return ok;
+        }
+
+        // map the snapshot at path, a missing file is an empty snapshot
+        // returns false if the file exists but is not a valid snapshot
+        bool Open(const std::string& path) {
+            Close();
+            if (!std::filesystem::exists(path)) {
+                return true;
+            }
+            if (!file.Open(path)) {
+                return false;
+            }
+
+            auto data = file.Data();
+            if (data.size() < sizeof(Header)) {
+                Close();
+                return false;
+            }
+            std::memcpy(&header, data.data(), sizeof(Header));
+            // every array has to lie inside the file
+            bool valid = header.magic == MAGIC && header.version == VERSION
+                && header.entryCount <= UINT32_MAX
+                && header.recordsOffset == sizeof(Header)
+                && header.uuidOrderOffset == header.recordsOffset + header.entryCount * sizeof(Record)
+                && header.stringsOffset == header.uuidOrderOffset + header.entryCount * sizeof(std::uint32_t)
+                && header.stringsOffset + header.stringsSize == data.size();
+            if (!valid) {
+                Close();
+                return false;
+            }
+
+            records   = reinterpret_cast<const Record*>(data.data() + header.recordsOffset);
+            uuidOrder = reinterpret_cast<const std::uint32_t*>(data.data() + header.uuidOrderOffset);
+            strings   = data.substr(header.stringsOffset);
+            return true;
+        }
+
+        void Close() {
+            file.Close();
+            header    = Header{};
+            records   = nullptr;
+            uuidOrder = nullptr;
+            strings   = {};
+        }
+
+        std::size_t Size() const {
+            return static_cast<std::size_t>(header.entryCount);
+        }
+
+        // entry of uuid, nullopt if it is not ranked
+        std::optional<RankingEntryView> Find(std::string_view uuid) const {
+            auto first = uuidOrder;
+            auto last  = uuidOrder + Size();
+            auto it = std::lower_bound(first, last, uuid, [&](std::uint32_t index, std::string_view value) {
+                return index < Size() && GetString(strings, records[index].uuid, records[index].uuidSize) < value;
+            });
+            if (it == last || *it >= Size() || GetEntry(*it).uuid != uuid) {
+                return std::nullopt;
+            }
+            return GetEntry(*it);
+        }
+
+        // same semantics as RankingIndex::GetRank
+        std::size_t GetRank(std::int64_t score) const {
+            auto higher = std::partition_point(records, records + Size(), [&](const Record& record) {
+                return record.score > score;
+            });
+            return static_cast<std::size_t>(higher - records) + 1;
+        }
+
+        // visit the first limit entries in ranking order, a negative limit visits all
+        template<class Visitor>
+        void ForEachTop(std::int64_t limit, Visitor&& visitor) const {
+            std::size_t count = limit < 0 ? Size() : (std::min)(static_cast<std::size_t>(limit), Size());
+            for (std::size_t i = 0; i < count; ++i) {
+                visitor(GetEntry(i));
+            }
+        }
+
+        // same semantics as RankingIndex::GetPosition
+        // Entry is a RankingEntryView or a RankingEntry, only its score and uuid are used
+        template<class Entry>
+        std::size_t GetPosition(const Entry& entry) const {
+            return GetLowerBound(entry) + 1;
+        }
+
+        // same semantics as RankingIndex::ForEachAbove
+        template<class Entry, class Visitor>
+        void ForEachAbove(const Entry& entry, std::size_t count, Visitor&& visitor) const {
+            for (auto i = GetLowerBound(entry); i > 0 && count; --i, --count) {
+                visitor(GetEntry(i - 1));
+            }
+        }
+
+        // same semantics as RankingIndex::ForEachBelow
+        template<class Entry, class Visitor>
+        void ForEachBelow(const Entry& entry, std::size_t count, Visitor&& visitor) const {
+            auto i = GetLowerBound(entry);
+            if (i < Size() && records[i].score == entry.score && GetEntry(i).uuid == entry.uuid) {
+                ++i;
+            }
+            for (; i < Size() && count; ++i, --count) {
+                visitor(GetEntry(i));
+            }
+        }
+
+    private:
+
+        struct Header
+        {
+            std::uint32_t magic;
+            std::uint32_t version;
+            std::uint64_t entryCount;
+            std::uint64_t recordsOffset;
+            std::uint64_t uuidOrderOffset;
+            std::uint64_t stringsOffset;
+            std::uint64_t stringsSize;
+        };
+
+        struct Record
+        {
+            std::int64_t  score;
+            std::uint32_t uuid;
+            std::uint32_t userName;
+            std::uint32_t logTime;
+            std::uint16_t uuidSize;
+            std::uint16_t userNameSize;
+            std::uint16_t logTimeSize;
+            std::uint16_t reserved0;
+            std::uint32_t reserved1;
+        };
+
+        static_assert(std::endian::native == std::endian::little, "the file format is little endian");
+        static_assert(sizeof(Header) == 48 && sizeof(Record) == 32, "the file format has fixed-width structures");
+
+        // strings out of range read as empty instead of past the mapping
+        static std::string_view GetString(std::string_view strings, std::uint32_t offset, std::uint16_t size) {
+            if (offset > strings.size() || size > strings.size() - offset) {
+                return {};
+            }
+            return strings.substr(offset, size);
+        }
+
+        RankingEntryView GetEntry(std::size_t index) const {
+            const auto& record = records[index];
+            RankingEntryView entry;
+            entry.logTime  = GetString(strings, record.logTime, record.logTimeSize);
+            entry.uuid     = GetString(strings, record.uuid, record.uuidSize);
+            entry.userName = GetString(strings, record.userName, record.userNameSize);
+            entry.score    = record.score;
+            return entry;
+        }
+
+        // index of the first record that is not ordered before entry
+        template<class Entry>
+        std::size_t GetLowerBound(const Entry& entry) const {
+            auto first = std::partition_point(records, records + Size(), [&](const Record& record) {
+                if (record.score != entry.score) {
+                    return record.score > entry.score;
+                }
+                return GetString(strings, record.uuid, record.uuidSize) < entry.uuid;
+            });
+            return static_cast<std::size_t>(first - records);
+        }
+
+        MappedFile           file;
+        Header               header{};
+        const Record*        records   = nullptr;
+        const std::uint32_t* uuidOrder = nullptr;
+        std::string_view     strings;
+
+    };
+};
@@ -0,0 +1,421 @@
+﻿#pragma once
+
+#include "RankingIndex.h"
+#include "RankingSnapshot.h"
+
+namespace ors_api_server
+{
+    // durable storage of the ranking: an append-only write-ahead log of score submissions and a snapshot per board
+    //
+    // every submission is appended to the log before it is applied to the index, a batch of submissions is
+    // made durable with a single fsync (group commit). Compact writes every board into a RankingSnapshot
+    // and empties the log, the boards are restored from the snapshots followed by Replay of the log.
+    // the current bucket of a window of a board has a snapshot of its own, the all-time one has no other scores
+    // a frozen board (the last season of a board) is a RankingSnapshot of its own that never changes
+    //
+    // the log starts with a header (magic, version) followed by records:
+    //   u32 payload size, u32 crc32 of the payload,
+    //   payload: i64 score, u8 reset, u8 board size, u16 uuid size, u16 user_name size, u16 log_time size,
+    //            board, uuid, user_name, log_time
+    // a reset record empties its board and has no uuid. Integers are little endian. A record that is cut off
+    // or fails its checksum ends the file, it is what remains of an append that was interrupted by a crash and
+    // is truncated away. The records of a version 1 log have no reset and board, they belong to DEFAULT_BOARD.
+    class ScoreLog
+    {
+    public:
+
+        static constexpr std::uint32_t LOG_MAGIC              = 0x4C53524F; // "ORSL"
+        static constexpr std::uint32_t VERSION                = 2;
+        static constexpr std::size_t   HEADER_SIZE            = 8;
+        static constexpr std::size_t   RECORD_HEADER_SIZE     = 8;
+        static constexpr std::size_t   PAYLOAD_HEADER_SIZE    = 16;
+        static constexpr std::size_t   PAYLOAD_HEADER_SIZE_V1 = 14;
+        // strings are stored with a 16 bit size
+        static constexpr std::size_t   MAX_FIELD_SIZE         = 0xFFFF;
+        static constexpr char          SNAPSHOT_SUFFIX[]      = ".snapshot";
+        static constexpr char          FROZEN_SUFFIX[]        = ".frozen";
+
+        // a ranking that has a snapshot: a board or one of its windows
+        struct SnapshotId
+        {
+            std::string   board;
+            RankingWindow window = RankingWindow::ALL;
+
+            auto operator<=>(const SnapshotId&) const = default;
+        };
+
+        explicit ScoreLog(std::string_view path)
+            : logPath(path)
+        {}
+
+        ScoreLog(const ScoreLog&) = delete;
+        ScoreLog& operator=(const ScoreLog&) = delete;
+
+        ~ScoreLog() {
+            if (logFile) {
+                std::fclose(logFile);
+            }
+        }
+
+        // check the log, cut off the torn tail of an interrupted append and open it for appending
+        // returns false if the log cannot be read or written
+        bool Open() {
+            std::size_t valid_size = 0;
+            if (std::filesystem::exists(logPath)) {
+                std::uint32_t version = VERSION;
+                if (!ReadLog(logPath, (std::numeric_limits<std::size_t>::max)(), [](const BoardUpdate&) {}, &valid_size, &version)) {
+                    return false;
+                }
+                if (valid_size < std::filesystem::file_size(logPath)) {
+                    std::filesystem::resize_file(logPath, valid_size);
+                }
+                // records are only appended in the current format
+                if (version != VERSION && !Upgrade(&valid_size)) {
+                    return false;
+                }
+            }
+            replaySize = valid_size;
+            return OpenLog(valid_size == 0);
+        }
+
+        // pass the updates that were in the log when it was opened to visitor(const BoardUpdate&) in order
+        // can run on another thread while new submissions are appended
+        template<class Visitor>
+        bool Replay(Visitor&& visitor) const {
+            std::size_t   valid_size = 0;
+            std::uint32_t version    = VERSION;
+            return replaySize == 0 || ReadLog(logPath, replaySize, visitor, &valid_size, &version);
+        }
+
+        // <log>.snapshot for DEFAULT_BOARD, as before there were boards, <log>.<board>.snapshot for the others
+        // and <log>.<board>@<window>.snapshot for a window, the @ keeps it apart from the board ids
+        std::string GetSnapshotPath(std::string_view board = DEFAULT_BOARD, RankingWindow window = RankingWindow::ALL) const {
+            if (window != RankingWindow::ALL) {
+                return std::format("{}.{}@{}{}", logPath, board, WINDOW_NAMES[static_cast<std::size_t>(window)], SNAPSHOT_SUFFIX);
+            }
+            return board == DEFAULT_BOARD ? logPath + SNAPSHOT_SUFFIX : std::format("{}.{}{}", logPath, board, SNAPSHOT_SUFFIX);
+        }
+
+        // <log>.<board>.frozen
+        std::string GetFrozenPath(std::string_view board) const {
+            return std::format("{}.{}{}", logPath, board, FROZEN_SUFFIX);
+        }
+
+        // boards and windows that have a snapshot next to the log
+        std::vector<SnapshotId> GetSnapshots() const {
+            return FindSnapshots(SNAPSHOT_SUFFIX);
+        }
+
+        // frozen boards have no windows
+        std::vector<std::string> GetFrozenBoards() const {
+            std::vector<std::string> boards;
+            for (auto& snapshot : FindSnapshots(FROZEN_SUFFIX)) {
+                if (snapshot.window == RankingWindow::ALL) {
+                    boards.push_back(std::move(snapshot.board));
+                }
+            }
+            return boards;
+        }
+
+        // append updates and wait until they are on disk, one fsync for the whole batch
+        bool Append(std::span<const BoardUpdate> updates) {
+            if (!logFile) {
+                return false;
+            }
+            writeBuffer.clear();
+            for (const auto& update : updates) {
+                WriteRecord(update, &writeBuffer);
+            }
+            if (std::fwrite(writeBuffer.data(), 1, writeBuffer.size(), logFile) != writeBuffer.size() || !SyncFile(logFile)) {
+                // cut off what was written of the batch, later records must not follow a torn one
+                std::fclose(logFile);
+                logFile = nullptr;
+                std::error_code ec;
+                std::filesystem::resize_file(logPath, GetLogSize(), ec);
+                if (!ec) {
+                    OpenLog(false);
+                }
+                return false;
+            }
+            logSize.store(logSize.load(std::memory_order_relaxed) + writeBuffer.size(), std::memory_order_relaxed);
+            return true;
+        }
+
+        // size of the log in bytes, used to decide when to compact
+        // may be read without the lock the appends are made under, e.g. to check whether that lock is needed
+        std::size_t GetLogSize() const {
+            return logSize.load(std::memory_order_relaxed);
+        }
+
+        // write every board into a new snapshot, remove the snapshots of the boards that are gone and empty the log
+        // Boards is a range of rankings with GetBoard and GetWindow, the views of ShardedRanking::ReadBoards
+        template<class Boards>
+        bool Compact(const Boards& boards) {
+            std::vector<SnapshotId> written;
+            for (const auto& board : boards) {
+                if (!WriteSnapshot(GetSnapshotPath(board.GetBoard(), board.GetWindow()), board)) {
+                    return false;
+                }
+                written.push_back({ std::string(board.GetBoard()), board.GetWindow() });
+            }
+            // a board that was reset must not come back with the snapshot of its last season, nor a window with an
+            // expired bucket
+            for (const auto& snapshot : GetSnapshots()) {
+                if (std::find(written.begin(), written.end(), snapshot) == written.end()) {
+                    std::error_code ec;
+                    std::filesystem::remove(GetSnapshotPath(snapshot.board, snapshot.window), ec);
+                    if (ec) {
+                        return false;
+                    }
+                }
+            }
+
+            // then the log is emptied, a crash before only replays records the snapshots already contain
+            if (logFile) {
+                std::fclose(logFile);
+                logFile = nullptr;
+            }
+            return OpenLog(true);
+        }
+
+        // write ranking into the snapshot of the frozen board, which must not exist yet
+        template<class Ranking>
+        bool Freeze(std::string_view board, const Ranking& ranking) {
+            return WriteSnapshot(GetFrozenPath(board), ranking);
+        }
+
+    private:
+
+        // the snapshot replaces the one at path atomically
+        template<class Ranking>
+        static bool WriteSnapshot(const std::string& path, const Ranking& ranking) {
+            auto temp_path = path + ".tmp";
+            if (!RankingSnapshot::Write(temp_path, ranking)) {
+                std::filesystem::remove(temp_path);
+                return false;
+            }
+            std::error_code ec;
+            std::filesystem::rename(temp_path, path, ec);
+            return !ec;
+        }
+
+        // rankings of the files <log>.<board>[@<window>]<suffix>, <log><suffix> is DEFAULT_BOARD
+        std::vector<SnapshotId> FindSnapshots(std::string_view suffix) const {
+            std::filesystem::path log_path(logPath);
+            auto directory = log_path.parent_path();
+            auto log_name  = log_path.filename().string();
+            auto prefix    = log_name + '.';
+
+            std::vector<SnapshotId> snapshots;
+            std::error_code ec;
+            for (const auto& file : std::filesystem::directory_iterator(directory.empty() ? std::filesystem::path(".") : directory, ec)) {
+                auto name = file.path().filename().string();
+                if (name == log_name + std::string(suffix)) {
+                    snapshots.push_back({ std::string(DEFAULT_BOARD) });
+                    continue;
+                }
+                if (name.size() <= prefix.size() + suffix.size() || !name.starts_with(prefix) || !name.ends_with(suffix)) {
+                    continue;
+                }
+                auto board  = std::string_view(name).substr(prefix.size(), name.size() - prefix.size() - suffix.size());
+                auto window = RankingWindow::ALL;
+                if (auto pos = board.find('@'); pos != std::string_view::npos) {
+                    if (!ParseRankingWindow(board.substr(pos + 1), &window) || window == RankingWindow::ALL) {
+                        continue;
+                    }
+                    board = board.substr(0, pos);
+                }
+                if (IsValidBoardId(board)) {
+                    snapshots.push_back({ std::string(board), window });
+                }
+            }
+            std::sort(snapshots.begin(), snapshots.end());
+            snapshots.erase(std::unique(snapshots.begin(), snapshots.end()), snapshots.end());
+            return snapshots;
+        }
+
+        // rewrite the records of an earlier version in the current format, valid_size becomes the new size
+        bool Upgrade(std::size_t* valid_size) {
+            std::string data;
+            WriteHeader(LOG_MAGIC, &data);
+            std::size_t   size    = 0;
+            std::uint32_t version = VERSION;
+            if (!ReadLog(logPath, (std::numeric_limits<std::size_t>::max)(), [&](const BoardUpdate& update) { WriteRecord(update, &data); }, &size, &version)) {
+                return false;
+            }
+
+            auto temp_path = logPath + ".tmp";
+            std::FILE* file = std::fopen(temp_path.c_str(), "wb");
+            if (!file) {
+                return false;
+            }
+            bool ok = std::fwrite(data.data(), 1, data.size(), file) == data.size() && SyncFile(file);
+            std::fclose(file);
+            std::error_code ec;
+            if (ok) {
+                std::filesystem::rename(temp_path, logPath, ec);
+            }
+            if (!ok || ec) {
+                std::filesystem::remove(temp_path, ec);
+                return false;
+            }
+            *valid_size = data.size();
+            return true;
+        }
+
+        bool OpenLog(bool truncate) {
+            logFile = std::fopen(logPath.c_str(), truncate ? "wb" : "ab");
+            if (!logFile) {
+                return false;
+            }
+            if (truncate) {
+                writeBuffer.clear();
+                WriteHeader(LOG_MAGIC, &writeBuffer);
+                if (std::fwrite(writeBuffer.data(), 1, writeBuffer.size(), logFile) != writeBuffer.size() || !SyncFile(logFile)) {
+                    return false;
+                }
+            }
+            logSize.store(static_cast<std::size_t>(std::filesystem::file_size(logPath)), std::memory_order_relaxed);
+            return true;
+        }
+
+        // visit the records in the first max_size bytes of the log at path, version is set to the one of the file
+        template<class Visitor>
+        static bool ReadLog(const std::string& path, std::size_t max_size, Visitor&& visitor, std::size_t* valid_size, std::uint32_t* version) {
+            std::ifstream ifs(path, std::ios::binary);
+            if (!ifs) {
+                return false;
+            }
+            std::string data((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+            data.resize((std::min)(data.size(), max_size));
+
+            // a file without a complete header has no records yet, a foreign one is left alone
+            std::size_t pos = 0;
+            if (data.size() >= HEADER_SIZE) {
+                *version = ReadInt<std::uint32_t>(data.data() + 4);
+                if (ReadInt<std::uint32_t>(data.data()) != LOG_MAGIC || *version < 1 || *version > VERSION) {
+                    return false;
+                }
+                pos = HEADER_SIZE;
+                BoardUpdate update;
+                while (auto size = ReadRecord(std::string_view(data).substr(pos), *version, &update)) {
+                    visitor(std::as_const(update));
+                    pos += size;
+                }
+            }
+            *valid_size = pos;
+            return true;
+        }
+
+        static void WriteHeader(std::uint32_t magic, std::string* out) {
+            WriteInt(magic, out);
+            WriteInt(VERSION, out);
+        }
+
+        static void WriteRecord(const BoardUpdate& update, std::string* out) {
+            const auto& entry = update.entry;
+            auto payload_size = PAYLOAD_HEADER_SIZE + update.board.size() + entry.uuid.size() + entry.userName.size() + entry.logTime.size();
+            auto record_pos   = out->size();
+            WriteInt(static_cast<std::uint32_t>(payload_size), out);
+            WriteInt(std::uint32_t(0), out);
+
+            auto payload_pos = out->size();
+            WriteInt(entry.score, out);
+            WriteInt(static_cast<std::uint8_t>(update.reset), out);
+            WriteInt(static_cast<std::uint8_t>(update.board.size()), out);
+            WriteInt(static_cast<std::uint16_t>(entry.uuid.size()), out);
+            WriteInt(static_cast<std::uint16_t>(entry.userName.size()), out);
+            WriteInt(static_cast<std::uint16_t>(entry.logTime.size()), out);
+            *out += update.board;
+            *out += entry.uuid;
+            *out += entry.userName;
+            *out += entry.logTime;
+
+            auto crc = Crc32(std::string_view(*out).substr(payload_pos));
+            std::memcpy(out->data() + record_pos + 4, &crc, sizeof(crc));
+        }
+
+        // returns the size of the record, or 0 if data does not start with a complete and intact record
+        static std::size_t ReadRecord(std::string_view data, std::uint32_t version, BoardUpdate* update) {
+            if (data.size() < RECORD_HEADER_SIZE) {
+                return 0;
+            }
+            auto header_size  = version == 1 ? PAYLOAD_HEADER_SIZE_V1 : PAYLOAD_HEADER_SIZE;
+            auto payload_size = ReadInt<std::uint32_t>(data.data());
+            auto crc          = ReadInt<std::uint32_t>(data.data() + 4);
+            if (payload_size < header_size || data.size() - RECORD_HEADER_SIZE < payload_size) {
+                return 0;
+            }
+            auto payload = data.substr(RECORD_HEADER_SIZE, payload_size);
+            if (Crc32(payload) != crc) {
+                return 0;
+            }
+
+            // the sizes follow the score, after the reset flag and the board size since version 2
+            std::uint8_t reset      = 0;
+            std::size_t  board_size = 0;
+            auto sizes = payload.data() + 8;
+            if (version != 1) {
+                reset      = ReadInt<std::uint8_t>(sizes);
+                board_size = ReadInt<std::uint8_t>(sizes + 1);
+                sizes += 2;
+            }
+            auto uuid_size      = ReadInt<std::uint16_t>(sizes);
+            auto user_name_size = ReadInt<std::uint16_t>(sizes + 2);
+            auto log_time_size  = ReadInt<std::uint16_t>(sizes + 4);
+            if (header_size + board_size + uuid_size + user_name_size + log_time_size != payload_size || reset > 1) {
+                return 0;
+            }
+            auto strings = payload.substr(header_size);
+            auto& entry = update->entry;
+            update->reset = reset != 0;
+            update->board = version == 1 ? DEFAULT_BOARD : strings.substr(0, board_size);
+            entry.score    = ReadInt<std::int64_t>(payload.data());
+            entry.uuid     = strings.substr(board_size, uuid_size);
+            entry.userName = strings.substr(board_size + uuid_size, user_name_size);
+            entry.logTime  = strings.substr(board_size + uuid_size + user_name_size, log_time_size);
+            return RECORD_HEADER_SIZE + payload_size;
+        }
+
+        template<class T>
+        static void WriteInt(T value, std::string* out) {
+            static_assert(std::endian::native == std::endian::little, "the file format is little endian");
+            out->append(reinterpret_cast<const char*>(&value), sizeof(value));
+        }
+
+        template<class T>
+        static T ReadInt(const char* data) {
+            T value;
+            std::memcpy(&value, data, sizeof(value));
+            return value;
+        }
+
+        // CRC-32 (IEEE 802.3)
+        static std::uint32_t Crc32(std::string_view data) {
+            static const auto table = [] {
+                std::array<std::uint32_t, 256> table{};
+                for (std::uint32_t i = 0; i < 256; ++i) {
+                    std::uint32_t c = i;
+                    for (int k = 0; k < 8; ++k) {
+                        c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+                    }
+                    table[i] = c;
+                }
+                return table;
+            }();
+
+            std::uint32_t crc = 0xFFFFFFFF;
+            for (unsigned char c : data) {
+                crc = table[(crc ^ c) & 0xFF] ^ (crc >> 8);
+            }
+            return crc ^ 0xFFFFFFFF;
+        }
+
+        std::string              logPath;
+        std::FILE*               logFile    = nullptr;
+        std::atomic<std::size_t> logSize    = 0;
+        std::size_t              replaySize = 0;
+        std::string              writeBuffer;
+
+    };
+};
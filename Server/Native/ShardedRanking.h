@@ -0,0 +1,550 @@
+﻿#pragma once
+
+#include "RankingIndex.h"
+
+namespace ors_api_server
+{
+    // epoch-based grace periods for readers that never lock
+    //
+    // a reader announces the epoch it entered in its own slot and clears it when it leaves. Synchronize
+    // starts a new epoch and waits until no reader is left in an older one, after that nothing that was
+    // unpublished before the call can still be in use.
+    class EpochDomain
+    {
+    public:
+
+        // upper bound of RegisterReader calls
+        static constexpr std::size_t MAX_READERS = 256;
+
+        EpochDomain() = default;
+        EpochDomain(const EpochDomain&) = delete;
+        EpochDomain& operator=(const EpochDomain&) = delete;
+
+        // slot of a new reader thread
+        std::size_t RegisterReader() {
+            auto reader = readerCount.fetch_add(1);
+            if (reader >= MAX_READERS) {
+                assert::ExceptionThrow("Too many ranking readers");
+            }
+            return reader;
+        }
+
+        void Enter(std::size_t reader) {
+            slots[reader].epoch.store(epoch.load());
+        }
+
+        void Leave(std::size_t reader) {
+            slots[reader].epoch.store(0, std::memory_order_release);
+        }
+
+        void Synchronize() {
+            auto current = epoch.fetch_add(1) + 1;
+            auto count   = (std::min)(readerCount.load(), MAX_READERS);
+            for (std::size_t i = 0; i < count; ++i) {
+                while (true) {
+                    auto entered = slots[i].epoch.load();
+                    if (entered == 0 || entered >= current) {
+                        break;
+                    }
+                    std::this_thread::yield();
+                }
+            }
+        }
+
+    private:
+
+        // one cache line per slot, readers on different cores do not share lines
+        struct alignas(64) Slot
+        {
+            std::atomic<std::uint64_t> epoch = 0;
+        };
+
+        std::atomic<std::uint64_t>    epoch       = 1;
+        std::atomic<std::size_t>      readerCount = 0;
+        std::array<Slot, MAX_READERS> slots;
+
+    };
+
+    // RankingIndex split into shards by uuid, read without locks while each shard has a single writer thread
+    //
+    // every shard keeps two copies of its index (left-right): the writer applies a batch to the copy nobody
+    // reads, publishes it, waits for a grace period of the EpochDomain and then brings the other copy up to date.
+    // readers only load the published copy, so rank and top-K queries never wait for a writer, at the cost of
+    // holding the ranking twice in memory. Ranks and the top-K are merged across shards.
+    // a copy holds one index per board, all boards share the shards, their writer threads and the grace periods.
+    // A board exists from its first score until it is reset
+    // next to its all-time index a board has one for the current bucket of every RankingWindow. A score of a later
+    // bucket rotates the window: its index is swapped for an empty one, the old one is freed after the batch was
+    // acknowledged. Readers ask for the bucket of their clock, a window nobody wrote to since it expired is empty
+    class ShardedRanking
+    {
+        struct Shard;
+
+    public:
+
+        // writes are a small part of the load, a few writer threads are enough
+        static std::size_t DefaultShardCount() {
+            return (std::max)(1u, std::thread::hardware_concurrency() / 4);
+        }
+
+        explicit ShardedRanking(std::size_t shard_count = DefaultShardCount()) {
+            shards.reserve(shard_count);
+            for (std::size_t i = 0; i < (std::max)(shard_count, std::size_t(1)); ++i) {
+                shards.push_back(std::make_unique<Shard>());
+            }
+        }
+
+        ShardedRanking(const ShardedRanking&) = delete;
+        ShardedRanking& operator=(const ShardedRanking&) = delete;
+
+        ~ShardedRanking() {
+            for (auto& shard : shards) {
+                {
+                    std::lock_guard lock(shard->queueMutex);
+                    shard->stopping = true;
+                }
+                shard->queueChanged.notify_all();
+                if (shard->writer.joinable()) {
+                    shard->writer.join();
+                }
+            }
+        }
+
+        // one board (one window of it) of the ranking as seen by one reader, only valid inside Read
+        // a board that does not exist is empty, so is a window whose current bucket is not bucket
+        // the copies published when the view is made are read for its whole life, so that the results of several
+        // calls agree even if a writer publishes in between
+        class View
+        {
+        public:
+
+            View(const ShardedRanking& ranking, std::string_view board, RankingWindow window = RankingWindow::ALL, std::int64_t bucket = 0)
+                : ranking(ranking)
+                , board(board)
+                , window(window)
+                , bucket(bucket)
+            {
+                indexes.reserve(ranking.shards.size());
+                for (const auto& shard : ranking.shards) {
+                    indexes.push_back(&GetIndex(*shard));
+                }
+            }
+
+            std::string_view GetBoard() const {
+                return board;
+            }
+
+            RankingWindow GetWindow() const {
+                return window;
+            }
+
+            // entry of uuid, nullptr if it is not ranked
+            const RankingEntry* Find(std::string_view uuid) const {
+                return indexes[ranking.GetShardIndex(uuid)]->Find(uuid);
+            }
+
+            // same semantics as RankingIndex::GetRank
+            std::size_t GetRank(std::int64_t score) const {
+                std::size_t higher = 0;
+                for (const auto* index : indexes) {
+                    higher += index->GetRank(score) - 1;
+                }
+                return higher + 1;
+            }
+
+            // visit the first limit entries in ranking order, a negative limit visits all
+            template<class Visitor>
+            void ForEachTop(std::int64_t limit, Visitor&& visitor) const {
+                // the top of the ranking is among the tops of the shards
+                std::vector<const RankingEntry*> top;
+                for (const auto* index : indexes) {
+                    index->ForEachTop(limit, [&](const RankingEntry& entry) {
+                        top.push_back(&entry);
+                    });
+                }
+                std::sort(top.begin(), top.end(), [](const RankingEntry* lhs, const RankingEntry* rhs) {
+                    return Less(*lhs, *rhs);
+                });
+                std::size_t count = limit < 0 ? top.size() : (std::min)(static_cast<std::size_t>(limit), top.size());
+                for (std::size_t i = 0; i < count; ++i) {
+                    visitor(*top[i]);
+                }
+            }
+
+            // same semantics as RankingIndex::GetPosition
+            std::size_t GetPosition(const RankingEntry& entry) const {
+                std::size_t before = 0;
+                for (const auto* index : indexes) {
+                    before += index->GetPosition(entry) - 1;
+                }
+                return before + 1;
+            }
+
+            // same semantics as RankingIndex::ForEachAbove
+            template<class Visitor>
+            void ForEachAbove(const RankingEntry& entry, std::size_t count, Visitor&& visitor) const {
+                ForEachNearest(count, visitor, [&](const RankingIndex& index, auto&& add) { index.ForEachAbove(entry, count, add); },
+                    [](const RankingEntry* lhs, const RankingEntry* rhs) { return Less(*rhs, *lhs); });
+            }
+
+            // same semantics as RankingIndex::ForEachBelow
+            template<class Visitor>
+            void ForEachBelow(const RankingEntry& entry, std::size_t count, Visitor&& visitor) const {
+                ForEachNearest(count, visitor, [&](const RankingIndex& index, auto&& add) { index.ForEachBelow(entry, count, add); },
+                    [](const RankingEntry* lhs, const RankingEntry* rhs) { return Less(*lhs, *rhs); });
+            }
+
+            std::size_t Size() const {
+                std::size_t size = 0;
+                for (const auto* index : indexes) {
+                    size += index->Size();
+                }
+                return size;
+            }
+
+        private:
+
+            // the nearest count entries are among the nearest count of every shard
+            template<class Visitor, class Collect, class Nearer>
+            void ForEachNearest(std::size_t count, Visitor& visitor, Collect&& collect, Nearer&& nearer) const {
+                std::vector<const RankingEntry*> nearest;
+                for (const auto* index : indexes) {
+                    collect(*index, [&](const RankingEntry& entry) {
+                        nearest.push_back(&entry);
+                    });
+                }
+                std::sort(nearest.begin(), nearest.end(), nearer);
+                for (std::size_t i = 0; i < (std::min)(count, nearest.size()); ++i) {
+                    visitor(*nearest[i]);
+                }
+            }
+
+            // the part of the board in shard
+            const RankingIndex& GetIndex(const Shard& shard) const {
+                static const RankingIndex empty;
+                const auto& boards = shard.Published();
+                auto it = boards.find(board);
+                if (it == boards.end()) {
+                    return empty;
+                }
+                const auto& window_index = it->second[static_cast<std::size_t>(window)];
+                return window_index.bucket == bucket ? *window_index.index : empty;
+            }
+
+            const ShardedRanking&            ranking;
+            std::string_view                 board;
+            RankingWindow                    window;
+            std::int64_t                     bucket;
+            // the part of the board in every shard, in the order of the shards
+            std::vector<const RankingIndex*> indexes;
+
+        };
+
+        std::size_t RegisterReader() {
+            return epochDomain.RegisterReader();
+        }
+
+        // call function(const View&) of board without taking a lock, reader is a slot from RegisterReader
+        // used by one thread at a time
+        template<class Function>
+        decltype(auto) Read(std::size_t reader, std::string_view board, Function&& function) const {
+            return Read(reader, board, RankingWindow::ALL, 0, std::forward<Function>(function));
+        }
+
+        // the same for window of board, bucket is GetWindowBucket of the time of the reader
+        template<class Function>
+        decltype(auto) Read(std::size_t reader, std::string_view board, RankingWindow window, std::int64_t bucket, Function&& function) const {
+            ReadGuard guard(epochDomain, reader);
+            return function(View(*this, board, window, bucket));
+        }
+
+        // call function(const std::vector<View>&) with every board that exists, ordered by board id, each one
+        // followed by its windows that are not empty in the buckets of the local time now
+        template<class Function>
+        decltype(auto) ReadBoards(std::size_t reader, std::chrono::local_seconds now, Function&& function) const {
+            ReadGuard guard(epochDomain, reader);
+            // the ids point into the published copies, which stay until the guard is released
+            std::vector<std::string_view> ids;
+            for (const auto& shard : shards) {
+                for (const auto& [board, indexes] : shard->Published()) {
+                    ids.push_back(board);
+                }
+            }
+            std::sort(ids.begin(), ids.end());
+            ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+
+            std::vector<View> boards;
+            boards.reserve(ids.size());
+            for (auto board : ids) {
+                boards.emplace_back(*this, board);
+                for (std::size_t i = 1; i < WINDOW_COUNT; ++i) {
+                    auto window = static_cast<RankingWindow>(i);
+                    if (View view(*this, board, window, GetWindowBucket(window, now)); view.Size() != 0) {
+                        boards.push_back(view);
+                    }
+                }
+            }
+            return function(std::as_const(boards));
+        }
+
+        // wait until no reader is left in a Read that began before the call
+        void Synchronize() {
+            epochDomain.Synchronize();
+        }
+
+        // insert a score into board and its windows directly, only before Start while nobody reads
+        void Load(std::string_view board, std::string_view uuid, std::string_view user_name, std::int64_t score, std::string_view log_time) {
+            for (std::size_t i = 0; i < WINDOW_COUNT; ++i) {
+                Load(board, static_cast<RankingWindow>(i), uuid, user_name, score, log_time);
+            }
+        }
+
+        // the same for one window of board, e.g. the entries of its snapshot
+        void Load(std::string_view board, RankingWindow window, std::string_view uuid, std::string_view user_name, std::int64_t score, std::string_view log_time) {
+            auto& shard = GetShard(uuid);
+            for (auto& copy : shard.copies) {
+                WriteNewScore(&GetBoard(&copy, board)[static_cast<std::size_t>(window)], window, uuid, user_name, score, log_time, &shard.retired);
+            }
+            shard.retired.clear();
+        }
+
+        // remove a board directly, only before Start while nobody reads
+        void Clear(std::string_view board) {
+            for (auto& shard : shards) {
+                for (auto& copy : shard->copies) {
+                    EraseBoard(&copy, board);
+                }
+            }
+        }
+
+        // start the writer threads, updates submitted before are applied now
+        void Start() {
+            for (auto& shard : shards) {
+                shard->writer = std::thread([this, shard = shard.get()] {
+                    RunWriter(shard);
+                });
+            }
+            started.store(true);
+        }
+
+        // queue updates on the writers of their shards, on_applied is called on a writer thread once all of
+        // them are visible to readers. Updates of one uuid are applied in the order they were submitted,
+        // a reset goes to every shard in its place among the others
+        void Submit(std::vector<BoardUpdate> updates, std::function<void()> on_applied = {}) {
+            std::vector<std::vector<BoardUpdate>> parts(shards.size());
+            for (auto& update : updates) {
+                if (update.reset) {
+                    for (auto& part : parts) {
+                        part.push_back(update);
+                    }
+                    continue;
+                }
+                parts[GetShardIndex(update.entry.uuid)].push_back(std::move(update));
+            }
+
+            auto batch = std::make_shared<Batch>();
+            batch->onApplied = std::move(on_applied);
+            batch->remaining = static_cast<std::size_t>(std::count_if(parts.begin(), parts.end(), [](const auto& part) { return !part.empty(); }));
+            if (batch->remaining == 0) {
+                if (batch->onApplied) {
+                    batch->onApplied();
+                }
+                return;
+            }
+
+            for (std::size_t i = 0; i < shards.size(); ++i) {
+                if (parts[i].empty()) {
+                    continue;
+                }
+                auto& shard = *shards[i];
+                {
+                    std::lock_guard lock(shard.queueMutex);
+                    shard.queue.push_back({ std::move(parts[i]), batch });
+                    ++shard.submitted;
+                }
+                shard.queueChanged.notify_all();
+            }
+        }
+
+        // wait until everything submitted so far has been applied, returns at once before Start
+        // must not be called inside Read, the writers wait for readers
+        void Drain() {
+            if (!started.load()) {
+                return;
+            }
+            for (auto& shard : shards) {
+                std::unique_lock lock(shard->queueMutex);
+                shard->queueChanged.wait(lock, [&] { return shard->applied == shard->submitted; });
+            }
+        }
+
+    private:
+
+        // index of the current bucket of a window, the all-time one has only bucket 0
+        struct WindowIndex
+        {
+            std::unique_ptr<RankingIndex> index  = std::make_unique<RankingIndex>();
+            std::int64_t                  bucket = NO_BUCKET;
+        };
+
+        // indexes of a board by RankingWindow
+        using BoardIndexes = std::array<WindowIndex, WINDOW_COUNT>;
+
+        // indexes of each board, looked up by a string_view of the board id
+        using Boards = std::map<std::string, BoardIndexes, std::less<>>;
+
+        // ranking order of RankingIndex
+        static bool Less(const RankingEntry& lhs, const RankingEntry& rhs) {
+            return lhs.score != rhs.score ? lhs.score > rhs.score : lhs.uuid < rhs.uuid;
+        }
+
+        // leaves the epoch a Read entered
+        struct ReadGuard
+        {
+            ReadGuard(EpochDomain& domain, std::size_t reader)
+                : domain(domain)
+                , reader(reader)
+            {
+                domain.Enter(reader);
+            }
+            ~ReadGuard() {
+                domain.Leave(reader);
+            }
+
+            EpochDomain& domain;
+            std::size_t  reader;
+        };
+
+        // updates of one Submit call, on_applied runs when the last shard has applied its part
+        struct Batch
+        {
+            std::function<void()>    onApplied;
+            std::atomic<std::size_t> remaining = 0;
+        };
+
+        struct Task
+        {
+            std::vector<BoardUpdate> updates;
+            std::shared_ptr<Batch>   batch;
+        };
+
+        struct Shard
+        {
+            const Boards& Published() const {
+                return copies[published.load()];
+            }
+
+            // copies[published] is read, the other one belongs to the writer
+            Boards                  copies[2];
+            std::atomic<int>        published = 0;
+
+            std::mutex              queueMutex;
+            std::condition_variable queueChanged;
+            std::vector<Task>       queue;
+            std::size_t             submitted = 0;
+            std::size_t             applied   = 0;
+            bool                    stopping  = false;
+            std::thread             writer;
+            // indexes of expired buckets, owned by the writer
+            std::vector<std::unique_ptr<RankingIndex>> retired;
+        };
+
+        // indexes of board in copy, created on the first score
+        static BoardIndexes& GetBoard(Boards* copy, std::string_view board) {
+            auto it = copy->find(board);
+            if (it == copy->end()) {
+                it = copy->try_emplace(std::string(board)).first;
+            }
+            return it->second;
+        }
+
+        static void EraseBoard(Boards* copy, std::string_view board) {
+            if (auto it = copy->find(board); it != copy->end()) {
+                copy->erase(it);
+            }
+        }
+
+        static void Apply(Boards* copy, const BoardUpdate& update, std::vector<std::unique_ptr<RankingIndex>>* retired) {
+            if (update.reset) {
+                EraseBoard(copy, update.board);
+                return;
+            }
+            const auto& entry   = update.entry;
+            auto&       indexes = GetBoard(copy, update.board);
+            for (std::size_t i = 0; i < WINDOW_COUNT; ++i) {
+                WriteNewScore(&indexes[i], static_cast<RankingWindow>(i), entry.uuid, entry.userName, entry.score, entry.logTime, retired);
+            }
+        }
+
+        // score of the bucket of log_time: rotates the window into a later bucket, a score of an expired one is ignored
+        static void WriteNewScore(WindowIndex* window_index, RankingWindow window, std::string_view uuid, std::string_view user_name, std::int64_t score, std::string_view log_time, std::vector<std::unique_ptr<RankingIndex>>* retired) {
+            auto bucket = GetWindowBucket(window, log_time);
+            if (bucket == NO_BUCKET || bucket < window_index->bucket) {
+                return;
+            }
+            if (bucket > window_index->bucket) {
+                // O(1), the expired index is not walked here
+                if (window_index->index->Size() != 0) {
+                    retired->push_back(std::exchange(window_index->index, std::make_unique<RankingIndex>()));
+                }
+                window_index->bucket = bucket;
+            }
+            window_index->index->WriteNewScore(uuid, user_name, score, log_time);
+        }
+
+        void RunWriter(Shard* shard) {
+            std::vector<Task> tasks;
+            while (true) {
+                {
+                    std::unique_lock lock(shard->queueMutex);
+                    shard->queueChanged.wait(lock, [&] { return shard->stopping || !shard->queue.empty(); });
+                    if (shard->queue.empty()) {
+                        return;
+                    }
+                    tasks.swap(shard->queue);
+                }
+
+                // the whole queue is applied as one batch, one grace period for all of it
+                int published = shard->published.load();
+                for (int copy : { 1 - published, published }) {
+                    for (const auto& task : tasks) {
+                        for (const auto& update : task.updates) {
+                            Apply(&shard->copies[copy], update, &shard->retired);
+                        }
+                    }
+                    if (copy != published) {
+                        shard->published.store(copy);
+                        epochDomain.Synchronize();
+                    }
+                }
+
+                for (const auto& task : tasks) {
+                    if (task.batch->remaining.fetch_sub(1) == 1 && task.batch->onApplied) {
+                        task.batch->onApplied();
+                    }
+                }
+                {
+                    std::lock_guard lock(shard->queueMutex);
+                    shard->applied += tasks.size();
+                }
+                shard->queueChanged.notify_all();
+                tasks.clear();
+                // both copies have left the expired buckets, nobody reads them anymore
+                shard->retired.clear();
+            }
+        }
+
+        std::size_t GetShardIndex(std::string_view uuid) const {
+            return std::hash<std::string_view>()(uuid) % shards.size();
+        }
+
+        Shard& GetShard(std::string_view uuid) const {
+            return *shards[GetShardIndex(uuid)];
+        }
+
+        std::vector<std::unique_ptr<Shard>> shards;
+        mutable EpochDomain                 epochDomain;
+        std::atomic<bool>                   started = false;
+
+    };
+};
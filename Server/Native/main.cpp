@@ -0,0 +1,17 @@
+﻿#include "OrsApiServer.h"
+
+int main()
+{
+    // ランキングはシャードに分けてメモリ上に保持し、スコアはログに記録する
+    ors_api_server::ShardedRanking ranking;
+    ors_api_server::ScoreLog scoreLog("ors.log");
+
+    // ログを開く。ランキングはサーバーの起動後にスナップショットとログから復元する
+    if (!scoreLog.Open()) {
+        assert::ExceptionThrow("Cannot open the score log");
+    }
+
+    // ハードウェアスレッドの数だけワーカーを起動する。5001番ポートではバイナリプロトコルを受け付ける
+    ors_api_server::OrsApiServer server(&ranking, &scoreLog, "192.168.1.15", 5000, 0, 5001);
+    server.Start();
+}
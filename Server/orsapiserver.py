@@ -1,10 +1,129 @@
 # standard
+import bisect
+import contextlib
 import datetime
 import json
-import os
+import re
+import socketserver
 import sqlite3
+import threading
+import time
+import traceback
 import urllib.parse
-from wsgiref.simple_server import make_server
+from wsgiref.simple_server import WSGIServer, make_server
+
+
+# pre-serialized top ranking responses
+## an entry is dropped only when a new score can enter its ranking, hits need no query and no json.dumps
+## readers and the score writer run on different threads: a ranking read before a committed score must not
+## be put after that score dropped the entries, put is refused if the generation changed since the read began
+class TopRankingCache:
+
+    # public
+
+    # constants
+    MAX_LIMIT = 100
+
+    def __init__(self):
+        # limit -> (response bytes, lowest score in the ranking or None if the ranking is not full)
+        self._entries = {}
+        self._generation = 0
+        self._lock = threading.Lock()
+
+    def get(self, limit: int) -> bytes:
+        entry = self._entries.get(limit)
+        return entry[0] if entry else None
+
+    def get_generation(self) -> int:
+        return self._generation
+
+    def put(self, limit: int, ranking: dict, res: bytes, generation: int) -> None:
+        if 0 < limit <= self.MAX_LIMIT:
+            threshold = ranking[limit]['score'] if len(ranking) == limit else None
+            with self._lock:
+                if generation == self._generation:
+                    self._entries[limit] = (res, threshold)
+
+    def on_new_score(self, score) -> None:
+        # scores may arrive as numeric strings, anything else cannot be compared
+        try:
+            score = int(score)
+        except (TypeError, ValueError):
+            self.clear()
+            return
+        # a score equal to the lowest one can still change the ranking (log_time, order of ties)
+        with self._lock:
+            self._generation += 1
+            self._entries = {
+                limit: (res, threshold) for limit, (res, threshold) in self._entries.items()
+                if threshold is not None and score < threshold
+            }
+
+    def clear(self) -> None:
+        with self._lock:
+            self._generation += 1
+            self._entries = {}
+
+
+# request counters and stage latencies, served in the Prometheus text format on /metrics
+## the same names and buckets as the native server, requests and the score writer update them on their own threads
+class ORSMetrics:
+
+    # public
+
+    # constants
+    # upper bounds of the latency buckets in seconds, the last bucket has none (+Inf)
+    BUCKETS = (0.000025, 0.00005, 0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1.0, 5.0)
+    STAGES = ('parse', 'index_update', 'serialize')
+    COUNTERS = ('http_requests', 'client_errors', 'server_errors', 'scores')
+    CONTENT_TYPE = 'text/plain; version=0.0.4; charset=utf-8'
+
+    def __init__(self):
+        self._counters = dict.fromkeys(self.COUNTERS, 0)
+        # stage -> [count per bucket, count, sum of the seconds]
+        self._stages = {stage: [[0] * (len(self.BUCKETS) + 1), 0, 0.0] for stage in self.STAGES}
+        self._lock = threading.Lock()
+
+    def add(self, counter: str, value: int = 1) -> None:
+        with self._lock:
+            self._counters[counter] += value
+
+    def record(self, stage: str, seconds: float) -> None:
+        with self._lock:
+            histogram = self._stages[stage]
+            histogram[0][bisect.bisect_left(self.BUCKETS, seconds)] += 1
+            histogram[1] += 1
+            histogram[2] += seconds
+
+    @contextlib.contextmanager
+    def timer(self, stage: str):
+        start = time.perf_counter()
+        try:
+            yield
+        finally:
+            self.record(stage, time.perf_counter() - start)
+
+    def format(self, gauges: dict = None) -> bytes:
+        # gauges: name -> value, the state of the server as ors_<name>
+        with self._lock:
+            counters = dict(self._counters)
+            stages = {stage: (list(buckets), count, total) for stage, (buckets, count, total) in self._stages.items()}
+        lines = []
+        for counter, value in counters.items():
+            lines.append(f'# TYPE ors_{counter}_total counter')
+            lines.append(f'ors_{counter}_total {value}')
+        for gauge, value in (gauges or {}).items():
+            lines.append(f'# TYPE ors_{gauge} gauge')
+            lines.append(f'ors_{gauge} {value}')
+        lines.append('# TYPE ors_stage_seconds histogram')
+        for stage, (buckets, count, total) in stages.items():
+            cumulative = 0
+            for bound, bucket in zip(self.BUCKETS + ('+Inf',), buckets):
+                cumulative += bucket
+                lines.append(f'ors_stage_seconds_bucket{{stage="{stage}",le="{bound}"}} {cumulative}')
+            lines.append(f'ors_stage_seconds_sum{{stage="{stage}"}} {total}')
+            lines.append(f'ors_stage_seconds_count{{stage="{stage}"}} {count}')
+        return ('\n'.join(lines) + '\n').encode('utf-8')
 
 
 # online ranking system database
@@ -16,31 +135,111 @@ class ORSDB:
     DB_NAME = 'ors.db'
     TABLE_NAME = 'ors'
     KEY_LIST = ['log_time', 'uuid', 'user_name', 'score']
-    # queries
-    CREATE_NEW_TABLE       = f'CREATE TABLE {TABLE_NAME}(log_time TEXT, uuid TEXT, user_name TEXT, score INTEGER)'
-    INSERT_NEW_SCORE       = f'INSERT INTO {TABLE_NAME}(log_time, uuid, user_name, score) VALUES (?, ?, ?, ?)'
-    UPDATE_SCORE           = f'UPDATE {TABLE_NAME} SET log_time = (?), score = (?) WHERE uuid = (?)'
-    SEARCH_BY_UUID         = f'SELECT * FROM {TABLE_NAME} WHERE uuid = (?)'
-    COMPARE_SCORES_BY_UUID = f'SELECT * FROM {TABLE_NAME} WHERE score <= (?) AND uuid = (?)'
-    TOP_RANKING            = f'SELECT * FROM {TABLE_NAME} ORDER BY score DESC LIMIT (?)'
-    MY_RANKING             = f'SELECT * FROM(SELECT *, RANK() OVER(ORDER BY score DESC) AS ranking FROM {TABLE_NAME}) WHERE uuid = (?)'
-
-    def write_new_score(self, uuid: str, user_name: str, score: int) -> None:
-        # get log time
-        log_time = self._get_log_time()
-        # check if uuid exists
-        if (self._execute(self.SEARCH_BY_UUID, [uuid])):
-            # check if score is higher than the previous one
-            if (self._execute(self.COMPARE_SCORES_BY_UUID, [score, uuid])):
-                # update score
-                self._execute(self.UPDATE_SCORE, [log_time, score, uuid])
-        else:
-            # insert new score
-            self._execute(self.INSERT_NEW_SCORE, [log_time, uuid, user_name, score])
-
-    def get_top_ranking(self, limit: int) -> dict:
+    # every board has a table of its own, the board of requests that do not name one is in TABLE_NAME
+    ## the others are in TABLE_NAME_<board>, ids are restricted so that they can be put into queries
+    DEFAULT_BOARD = TABLE_NAME
+    BOARD_ID = re.compile(r'[A-Za-z0-9_-]{1,64}')
+    # boards frozen by a season rollover, they do not take scores anymore
+    FROZEN_TABLE_NAME = 'frozen_boards'
+    # time windows of a board, the all-time ranking and the rankings of the current hour, day and week (from Monday)
+    ## a window keeps the best score of every player in its bucket, bucket of a datetime -> part of the table name
+    ALL_WINDOW = 'all'
+    WINDOW_BUCKETS = {
+        'hour': lambda now: now.strftime('%Y%m%d%H'),
+        'day': lambda now: now.strftime('%Y%m%d'),
+        'week': lambda now: (now - datetime.timedelta(days=now.weekday())).strftime('%Y%m%d'),
+    }
+    # larger around values of a neighborhood query are clamped
+    MAX_AROUND = 100
+    # no response holds more entries than that, the whole ranking is read page by page
+    MAX_PAGE_SIZE = 1000
+    DEFAULT_PAGE_SIZE = 100
+    # queries, {table} is the table of the board
+    CREATE_NEW_TABLE       = 'CREATE TABLE IF NOT EXISTS "{table}"(log_time TEXT, uuid TEXT, user_name TEXT, score INTEGER)'
+    INSERT_NEW_SCORE       = 'INSERT INTO "{table}"(log_time, uuid, user_name, score) VALUES (?, ?, ?, ?)'
+    UPDATE_SCORE           = 'UPDATE "{table}" SET log_time = (?), score = (?) WHERE uuid = (?)'
+    SEARCH_BY_UUID         = 'SELECT * FROM "{table}" WHERE uuid = (?)'
+    COMPARE_SCORES_BY_UUID = 'SELECT * FROM "{table}" WHERE score <= (?) AND uuid = (?)'
+    TOP_RANKING            = 'SELECT * FROM "{table}" ORDER BY score DESC LIMIT (?)'
+    MY_RANKING             = 'SELECT * FROM(SELECT *, RANK() OVER(ORDER BY score DESC) AS ranking FROM "{table}") WHERE uuid = (?)'
+    # ranking order (score descending, uuid) and uuid lookups without a table scan
+    ## index names have a '.', which no table name has
+    CREATE_RANKING_INDEX   = 'CREATE INDEX IF NOT EXISTS "{table}.ranking" ON "{table}"(score DESC, uuid)'
+    CREATE_UUID_INDEX      = 'CREATE INDEX IF NOT EXISTS "{table}.uuid" ON "{table}"(uuid)'
+    COUNT_ALL              = 'SELECT COUNT(*) FROM "{table}"'
+    COUNT_HIGHER_SCORES    = 'SELECT COUNT(*) FROM "{table}" WHERE score > (?)'
+    COUNT_TIED_BEFORE      = 'SELECT COUNT(*) FROM "{table}" WHERE score = (?) AND uuid < (?)'
+    # neighbors nearest first, each one a range of the ranking index
+    TIED_ABOVE             = 'SELECT * FROM "{table}" WHERE score = (?) AND uuid < (?) ORDER BY uuid DESC LIMIT (?)'
+    HIGHER_ABOVE           = 'SELECT * FROM "{table}" WHERE score > (?) ORDER BY score ASC, uuid DESC LIMIT (?)'
+    TIED_BELOW             = 'SELECT * FROM "{table}" WHERE score = (?) AND uuid > (?) ORDER BY uuid ASC LIMIT (?)'
+    LOWER_BELOW            = 'SELECT * FROM "{table}" WHERE score < (?) ORDER BY score DESC, uuid ASC LIMIT (?)'
+    FIRST_PAGE             = 'SELECT * FROM "{table}" ORDER BY score DESC, uuid ASC LIMIT (?)'
+    # rows of many uuids in ranking order, the uuids are put into a temporary table of the connection first
+    CREATE_FIND_UUIDS      = 'CREATE TEMP TABLE find_uuids(uuid TEXT PRIMARY KEY)'
+    INSERT_FIND_UUID       = 'INSERT OR IGNORE INTO find_uuids(uuid) VALUES (?)'
+    FIND_BY_UUIDS          = 'SELECT * FROM "{table}" WHERE uuid IN (SELECT uuid FROM find_uuids) ORDER BY score DESC, uuid ASC'
+    # boards
+    TABLE_EXISTS           = "SELECT 1 FROM sqlite_master WHERE type = 'table' AND name = (?)"
+    FIND_TABLES            = "SELECT name FROM sqlite_master WHERE type = 'table' AND name GLOB (?)"
+    DROP_TABLE             = 'DROP TABLE IF EXISTS "{table}"'
+    COPY_TABLE             = 'CREATE TABLE "{table}" AS SELECT * FROM "{source}"'
+    DELETE_ALL             = 'DELETE FROM "{table}"'
+    CREATE_FROZEN_TABLE    = f'CREATE TABLE IF NOT EXISTS {FROZEN_TABLE_NAME}(board TEXT PRIMARY KEY)'
+    FREEZE_BOARD           = f'INSERT INTO {FROZEN_TABLE_NAME}(board) VALUES (?)'
+    UNFREEZE_BOARD         = f'DELETE FROM {FROZEN_TABLE_NAME} WHERE board = (?)'
+    IS_FROZEN              = f'SELECT 1 FROM {FROZEN_TABLE_NAME} WHERE board = (?)'
+    # readers see the last commit while the score writer writes the next one instead of waiting for it
+    JOURNAL_MODE_WAL       = 'PRAGMA journal_mode=WAL'
+
+    def __init__(self):
+        # table -> TopRankingCache
+        self.top_ranking_caches = {}
+        self._execute(self.JOURNAL_MODE_WAL)
+        self._execute(self.CREATE_FROZEN_TABLE)
+
+    def is_valid_board(self, board) -> bool:
+        return isinstance(board, str) and self.BOARD_ID.fullmatch(board) is not None
+
+    def is_valid_window(self, window) -> bool:
+        return isinstance(window, str) and (window == self.ALL_WINDOW or window in self.WINDOW_BUCKETS)
+
+    def has_board(self, board: str) -> bool:
+        return self._has_table(self._table_name(board))
+
+    def is_frozen(self, board: str) -> bool:
+        return bool(self._execute(self.IS_FROZEN, [board]))
+
+    def write_new_score(self, uuid: str, user_name: str, score: int, board: str = DEFAULT_BOARD) -> None:
+        self.write_new_scores([(uuid, user_name, score, board)])
+
+    def write_new_scores(self, scores: list) -> None:
+        # get log time, every score of the batch is in the same buckets
+        now = datetime.datetime.now()
+        log_time = self._get_log_time(now)
+        # apply all scores in a single transaction
+        with sqlite3.connect(self.DB_NAME) as conn:
+            cur = conn.cursor()
+            tables = {board: self._score_tables(cur, board, now) for board in {board for _, _, _, board in scores}}
+            for uuid, user_name, score, board in scores:
+                for table in tables[board]:
+                    self._write_new_score(cur, table, log_time, uuid, user_name, score)
+            conn.commit()
+        # drop cached rankings the scores may enter, once they can be read
+        for _, _, score, board in scores:
+            for table in tables[board]:
+                self._top_ranking_cache(table).on_new_score(score)
+
+    def get_top_ranking(self, limit: int, board: str = DEFAULT_BOARD, window: str = ALL_WINDOW) -> dict:
+        # a negative or too large limit is MAX_PAGE_SIZE
+        if limit < 0 or limit > self.MAX_PAGE_SIZE:
+            limit = self.MAX_PAGE_SIZE
+        # a board without scores (a window without scores in its bucket) has no table
+        table = self._table_name(board, window)
+        if not self._has_table(table):
+            return {}
         # get ranking
-        ranking = self._execute(self.TOP_RANKING, [limit])
+        ranking = self._execute(self._query(self.TOP_RANKING, table), [limit])
 
         # convert list to dict
         ## (log_time, uuid, user_name, score) -> {ranking: {log_time, uuid, user_name, score}}
@@ -52,8 +251,23 @@ class ORSDB:
 
         return {}
 
-    def get_my_ranking(self, uuid: str) -> dict:
-        ranking = self._execute(self.MY_RANKING, [uuid])
+    def get_top_ranking_response(self, limit: int, board: str = DEFAULT_BOARD, window: str = ALL_WINDOW) -> bytes:
+        # serve from the cache if possible, the cache of a window is the one of its current bucket
+        cache = self._top_ranking_cache(self._table_name(board, window))
+        res = cache.get(limit)
+        if res is None:
+            generation = cache.get_generation()
+            ranking = self.get_top_ranking(limit, board, window)
+            res = json.dumps(ranking).encode('utf-8')
+            cache.put(limit, ranking, res, generation)
+
+        return res
+
+    def get_my_ranking(self, uuid: str, board: str = DEFAULT_BOARD, window: str = ALL_WINDOW) -> dict:
+        table = self._table_name(board, window)
+        if not self._has_table(table):
+            return {}
+        ranking = self._execute(self._query(self.MY_RANKING, table), [uuid])
 
         # convert list to dict
         ## (log_time, uuid, user_name, score, ranking) -> {ranking: {log_time, uuid, user_name, score}}
@@ -62,14 +276,108 @@ class ORSDB:
 
         return {}
 
-    def reset_ranking(self) -> None:
-        # delete database file
-        try:
-            os.remove(self.DB_NAME)
-        except FileNotFoundError:
-            pass
-        # create new table
-        self._execute(self.CREATE_NEW_TABLE)
+    def get_ranks(self, uuids: list, board: str = DEFAULT_BOARD, window: str = ALL_WINDOW) -> dict:
+        # {entries: [{rank, log_time, uuid, user_name, score}, ...]} of the ranked ones of uuids, in ranking order
+        ## one query probes the uuid index for every uuid once, equal scores share one rank query
+        table = self._table_name(board, window)
+        if not self._has_table(table):
+            return {'entries': []}
+        with sqlite3.connect(self.DB_NAME) as conn:
+            cur = conn.cursor()
+            cur.execute(self.CREATE_FIND_UUIDS)
+            cur.executemany(self.INSERT_FIND_UUID, [(uuid,) for uuid in uuids])
+            rows = cur.execute(self._query(self.FIND_BY_UUIDS, table)).fetchall()
+            entries = []
+            for i, e in enumerate(rows):
+                if not i or e[3] != rows[i - 1][3]:
+                    rank = cur.execute(self._query(self.COUNT_HIGHER_SCORES, table), [e[3]]).fetchone()[0] + 1
+                entries.append({'rank': rank, **dict(zip(self.KEY_LIST, e))})
+
+        return {'entries': entries}
+
+    def get_neighborhood(self, uuid: str, around: int, board: str = DEFAULT_BOARD, window: str = ALL_WINDOW) -> dict:
+        around = max(0, min(around, self.MAX_AROUND))
+        table = self._table_name(board, window)
+        if not self._has_table(table):
+            return {}
+        with sqlite3.connect(self.DB_NAME) as conn:
+            cur = conn.cursor()
+            me = cur.execute(self._query(self.SEARCH_BY_UUID, table), [uuid]).fetchone()
+            if not me:
+                return {}
+            score = me[3]
+
+            # the entries above are fetched nearest first, ties are ordered by uuid
+            above = cur.execute(self._query(self.TIED_ABOVE, table), [score, uuid, around]).fetchall()
+            if len(above) < around:
+                above += cur.execute(self._query(self.HIGHER_ABOVE, table), [score, around - len(above)]).fetchall()
+            below = cur.execute(self._query(self.TIED_BELOW, table), [score, uuid, around]).fetchall()
+            if len(below) < around:
+                below += cur.execute(self._query(self.LOWER_BELOW, table), [score, around - len(below)]).fetchall()
+            neighbors = self._rank_entries(cur, table, above[::-1] + [me] + below)
+            total = cur.execute(self._query(self.COUNT_ALL, table)).fetchone()[0]
+
+        my_rank = neighbors[len(above)]['rank']
+
+        return {
+            'rank': my_rank,
+            'percentile': 100.0 * (total - my_rank + 1) / total,
+            'total': total,
+            'entries': neighbors,
+        }
+
+    def get_ranking_page(self, page_size: int, after_score=None, after_uuid=None, board: str = DEFAULT_BOARD, window: str = ALL_WINDOW) -> dict:
+        page_size = max(1, min(page_size, self.MAX_PAGE_SIZE))
+        table = self._table_name(board, window)
+        if not self._has_table(table):
+            return {'entries': [], 'next': None}
+        with sqlite3.connect(self.DB_NAME) as conn:
+            cur = conn.cursor()
+            # the page is a seek in the ranking index, one entry more tells whether there is a next page
+            if after_uuid is None:
+                entries = cur.execute(self._query(self.FIRST_PAGE, table), [page_size + 1]).fetchall()
+            else:
+                entries = cur.execute(self._query(self.TIED_BELOW, table), [after_score, after_uuid, page_size + 1]).fetchall()
+                if len(entries) <= page_size:
+                    entries += cur.execute(self._query(self.LOWER_BELOW, table), [after_score, page_size + 1 - len(entries)]).fetchall()
+            has_next = len(entries) > page_size
+            entries = self._rank_entries(cur, table, entries[:page_size])
+
+        # the cursor of the next page is the last entry of this one
+        return {
+            'entries': entries,
+            'next': {'score': entries[-1]['score'], 'uuid': entries[-1]['uuid']} if has_next else None,
+        }
+
+    def reset_ranking(self, board: str = DEFAULT_BOARD) -> None:
+        # drop the tables of the board and its windows (their indexes go with them), the other boards are kept
+        table = self._table_name(board)
+        with sqlite3.connect(self.DB_NAME) as conn:
+            cur = conn.cursor()
+            cur.execute(self._query(self.DROP_TABLE, table))
+            self._drop_tables(cur, f'{table}@*')
+            cur.execute(self.UNFREEZE_BOARD, [board])
+            # create new table
+            self._create_table(cur, table)
+            conn.commit()
+        # forget cached rankings
+        self.top_ranking_caches.clear()
+
+    def rollover(self, board: str, archive: str) -> None:
+        # end the season of board: its ranking is kept as the frozen board archive and board starts empty
+        ## one transaction, a request sees either the old season or the new one. The archive has no windows
+        table = self._table_name(board)
+        archive_table = self._table_name(archive)
+        with sqlite3.connect(self.DB_NAME) as conn:
+            cur = conn.cursor()
+            self._create_table(cur, table)
+            cur.execute(self.COPY_TABLE.format(table=archive_table, source=table))
+            self._create_table(cur, archive_table)
+            cur.execute(self._query(self.DELETE_ALL, table))
+            self._drop_tables(cur, f'{table}@*')
+            cur.execute(self.FREEZE_BOARD, [archive])
+            conn.commit()
+        self.top_ranking_caches.clear()
 
     # private
 
@@ -82,8 +390,182 @@ class ORSDB:
 
         return res
 
-    def _get_log_time(self) -> str:
-        return datetime.datetime.now().strftime('%Y-%m-%d %H:%M:%S')
+    def _table_name(self, board: str, window: str = ALL_WINDOW, now=None) -> str:
+        # TABLE_NAME, TABLE_NAME_<board> or the table of the current bucket of a window, <table>@<window>:<bucket>
+        table = self.TABLE_NAME if board == self.DEFAULT_BOARD else f'{self.TABLE_NAME}_{board}'
+        if window == self.ALL_WINDOW:
+            return table
+        bucket = self.WINDOW_BUCKETS[window](now or datetime.datetime.now())
+        return f'{table}@{window}:{bucket}'
+
+    def _has_table(self, table: str) -> bool:
+        return bool(self._execute(self.TABLE_EXISTS, [table]))
+
+    def _query(self, query: str, table: str) -> str:
+        return query.format(table=table)
+
+    def _create_table(self, cur, table: str) -> None:
+        cur.execute(self._query(self.CREATE_NEW_TABLE, table))
+        cur.execute(self._query(self.CREATE_RANKING_INDEX, table))
+        cur.execute(self._query(self.CREATE_UUID_INDEX, table))
+
+    def _drop_tables(self, cur, pattern: str, keep: str = None) -> None:
+        for table, in cur.execute(self.FIND_TABLES, [pattern]).fetchall():
+            if table != keep:
+                cur.execute(self._query(self.DROP_TABLE, table))
+                self.top_ranking_caches.pop(table, None)
+
+    def _score_tables(self, cur, board: str, now) -> list:
+        # the all-time table of board and the tables of the buckets of now, created on their first score
+        ## a window rotates when the table of its next bucket is created: the one of the expired bucket is dropped,
+        ## none of the history is scanned
+        tables = [self._table_name(board)]
+        for window in self.WINDOW_BUCKETS:
+            table = self._table_name(board, window, now)
+            if not cur.execute(self.TABLE_EXISTS, [table]).fetchall():
+                self._drop_tables(cur, f'{tables[0]}@{window}:*', keep=table)
+            tables.append(table)
+        for table in tables:
+            self._create_table(cur, table)
+
+        return tables
+
+    def _top_ranking_cache(self, table: str) -> TopRankingCache:
+        return self.top_ranking_caches.setdefault(table, TopRankingCache())
+
+    def _write_new_score(self, cur, table: str, log_time: str, uuid: str, user_name: str, score: int) -> None:
+        # check if uuid exists
+        if (cur.execute(self._query(self.SEARCH_BY_UUID, table), [uuid]).fetchall()):
+            # check if score is higher than the previous one
+            if (cur.execute(self._query(self.COMPARE_SCORES_BY_UUID, table), [score, uuid]).fetchall()):
+                # update score
+                cur.execute(self._query(self.UPDATE_SCORE, table), [log_time, score, uuid])
+        else:
+            # insert new score
+            cur.execute(self._query(self.INSERT_NEW_SCORE, table), [log_time, uuid, user_name, score])
+
+    def _rank_entries(self, cur, table: str, entries: list) -> list:
+        # consecutive rows in ranking order, equal scores share the rank of the first of them as in MY_RANKING
+        ## (log_time, uuid, user_name, score) -> {rank, log_time, uuid, user_name, score}
+        ranked = []
+        if entries:
+            _, uuid, _, score = entries[0]
+            rank = cur.execute(self._query(self.COUNT_HIGHER_SCORES, table), [score]).fetchone()[0] + 1
+            position = rank + cur.execute(self._query(self.COUNT_TIED_BEFORE, table), [score, uuid]).fetchone()[0]
+            for i, e in enumerate(entries):
+                if i and e[3] != entries[i - 1][3]:
+                    rank = position + i
+                ranked.append({'rank': rank, **dict(zip(self.KEY_LIST, e))})
+
+        return ranked
+
+    def _get_log_time(self, now) -> str:
+        return now.strftime('%Y-%m-%d %H:%M:%S')
+
+
+# bounded queue of submitted scores, written to the database by a dedicated writer thread
+## submissions wait for the batch they are in instead of writing themselves, so a slow write holds up the
+## submissions of the next batch but no reader. Scores of the same uuid and board in a batch are coalesced into
+## the highest one (with the user name of the first, as the database keeps it), a full batch turns submissions away
+class ScoreIngestQueue:
+
+    # public
+
+    # constants
+    # the most scores (after coalescing) a batch holds while the previous one is written
+    MAX_PENDING = 10000
+    # the writer waits that long after the first score of a batch for more of them
+    FLUSH_INTERVAL = 0.01
+    # seconds a turned away client is asked to wait, the Retry-After of the response
+    RETRY_AFTER = 1
+
+    def __init__(self, orsdb: ORSDB, metrics: ORSMetrics):
+        self.orsdb = orsdb
+        self.metrics = metrics
+        self._condition = threading.Condition()
+        self._batch = self._Batch()
+        # the batch the writer is writing, None when it waits
+        self._writing = None
+        self._thread = None
+
+    def start(self) -> None:
+        self._thread = threading.Thread(target=self._write, name='score-writer', daemon=True)
+        self._thread.start()
+
+    def submit(self, scores: list):
+        # add [(uuid, user_name, score, board), ...] to the next batch, all or none of them
+        ## returns the batch to wait for, None if it has no room left
+        with self._condition:
+            batch = self._batch
+            keys = {(board, uuid) for uuid, _, _, board in scores}
+            if len(batch.scores) + len(keys - batch.scores.keys()) > self.MAX_PENDING:
+                return None
+            for uuid, user_name, score, board in scores:
+                pending = batch.scores.get((board, uuid))
+                if pending is None:
+                    batch.scores[(board, uuid)] = (uuid, user_name, score, board)
+                elif self._is_higher(score, pending[2]):
+                    batch.scores[(board, uuid)] = (uuid, pending[1], score, board)
+            self._condition.notify()
+            return batch
+
+    def wait(self, batch) -> bool:
+        # block until batch is written, returns False if the write failed
+        batch.done.wait()
+        return batch.error is None
+
+    def flush(self) -> None:
+        # block until every score submitted so far is written, e.g. before a rollover freezes a board
+        with self._condition:
+            batches = [self._writing, self._batch]
+        for batch in batches:
+            if batch and batch.scores:
+                batch.done.wait()
+
+    def get_pending(self) -> int:
+        return len(self._batch.scores)
+
+    # private
+
+    class _Batch:
+
+        def __init__(self):
+            # (board, uuid) -> (uuid, user_name, score, board)
+            self.scores = {}
+            self.done = threading.Event()
+            self.error = None
+
+    @staticmethod
+    def _is_higher(score, pending) -> bool:
+        # scores may arrive as numeric strings, the later one of scores that cannot be compared wins
+        try:
+            return int(score) > int(pending)
+        except (TypeError, ValueError):
+            return True
+
+    def _write(self) -> None:
+        while True:
+            with self._condition:
+                self._condition.wait_for(lambda: self._batch.scores)
+            # give the submissions arriving right behind the first one the chance to join the batch
+            time.sleep(self.FLUSH_INTERVAL)
+            with self._condition:
+                batch = self._writing = self._batch
+                self._batch = self._Batch()
+            try:
+                with self.metrics.timer('index_update'):
+                    self.orsdb.write_new_scores(list(batch.scores.values()))
+            except Exception as e:
+                traceback.print_exc()
+                batch.error = e
+            batch.done.set()
+            with self._condition:
+                self._writing = None
+
+
+# a thread for every connection, readers are not held up by submissions waiting for the score writer
+class ThreadingWSGIServer(socketserver.ThreadingMixIn, WSGIServer):
+    daemon_threads = True
 
 
 # online ranking system api server
@@ -91,19 +573,37 @@ class ORSAPIServer:
 
     # public
 
+    # constants
+    SCORES_PATH = '/scores'
+    RANKS_PATH = '/ranks'
+    ROLLOVER_PATH = '/rollover'
+    METRICS_PATH = '/metrics'
+
     def __init__(self, orsdb: ORSDB, host: str = 'localhost', port: int = 5000):
         self.orsdb = orsdb
         self.host = host
         self.port = port
+        self.metrics = ORSMetrics()
+        self.ingest_queue = ScoreIngestQueue(orsdb, self.metrics)
 
     def start(self) -> None:
-        with make_server(self.host, self.port, self._app) as httpd:
+        self.ingest_queue.start()
+        with make_server(self.host, self.port, self._app, server_class=ThreadingWSGIServer) as httpd:
             print(f'Serving on {self.host}:{self.port}...')
             httpd.serve_forever()
 
     # private
 
-    def _app(self, environ, response) -> list:
+    def _app(self, environ, start_response) -> list:
+
+        # count every response by its status
+        def response(status, header):
+            self.metrics.add('http_requests')
+            if status.startswith('4'):
+                self.metrics.add('client_errors')
+            elif status.startswith('5'):
+                self.metrics.add('server_errors')
+            return start_response(status, header)
 
         header = [
             ('Access-Control-Allow-Origin', '*'),
@@ -113,29 +613,65 @@ class ORSAPIServer:
 
         request_method = environ.get('REQUEST_METHOD')
 
+        # scrape of the metrics, not counted itself
+        if request_method == 'GET' and environ.get('PATH_INFO') == self.METRICS_PATH:
+            res = self.metrics.format({'ingest_pending': self.ingest_queue.get_pending()})
+            header.append(('Content-Type', ORSMetrics.CONTENT_TYPE))
+            header.append(('Content-Length', str(len(res))))
+            start_response('200 OK', header)
+            return [res]
+
         # GET
         if request_method == 'GET':
             query_string = environ.get('QUERY_STRING')
-            if query_string:
-                # parse query string
-                qs = urllib.parse.parse_qs(query_string)
-
-                # get my ranking
+            # parse query string
+            with self.metrics.timer('parse'):
+                qs = urllib.parse.parse_qs(query_string) if query_string else {}
+            # every query is about one board, the default one if not named
+            board = qs.get('board', [self.orsdb.DEFAULT_BOARD])[0]
+            # and one of its windows, the all-time ranking if not named
+            window = qs.get('window', [self.orsdb.ALL_WINDOW])[0]
+            if not self.orsdb.is_valid_board(board) or not self.orsdb.is_valid_window(window):
+                response('400 Bad Request', header)
+                return []
+            if qs.keys() - {'board', 'window'}:
+                # get my ranking, with the players around if asked for
                 uuid = qs.get('uuid')
                 if uuid:
-                    res = self.orsdb.get_my_ranking(uuid[0])
+                    around = qs.get('around')
+                    if around:
+                        res = self.orsdb.get_neighborhood(uuid[0], int(around[0]), board, window)
+                    else:
+                        res = self.orsdb.get_my_ranking(uuid[0], board, window)
+
+                # get a page of the ranking, after the cursor (score and uuid of the last entry seen) if given
+                page_size = qs.get('page_size')
+                after_score = qs.get('after_score')
+                after_uuid = qs.get('after_uuid')
+                if not uuid and (page_size or after_score or after_uuid):
+                    # a cursor needs both of its parts
+                    if bool(after_score) != bool(after_uuid):
+                        response('400 Bad Request', header)
+                        return []
+                    page_size = int(page_size[0]) if page_size else self.orsdb.DEFAULT_PAGE_SIZE
+                    if after_uuid:
+                        res = self.orsdb.get_ranking_page(page_size, int(after_score[0]), after_uuid[0], board, window)
+                    else:
+                        res = self.orsdb.get_ranking_page(page_size, board=board, window=window)
 
                 # get top ranking
                 limit = qs.get('limit')
                 if limit:
-                    # get top ranking
-                    res = self.orsdb.get_top_ranking(int(limit[0]))
+                    # get top ranking, already serialized
+                    res = self.orsdb.get_top_ranking_response(int(limit[0]), board, window)
             else:
-                # get all ranking
-                res = self.orsdb.get_top_ranking(-1)
+                # first page, the whole ranking is too large for one response
+                res = self.orsdb.get_ranking_page(self.orsdb.DEFAULT_PAGE_SIZE, board=board, window=window)
 
             # convert dict to json
-            res = json.dumps(res).encode('utf-8')
+            if not isinstance(res, bytes):
+                with self.metrics.timer('serialize'):
+                    res = json.dumps(res).encode('utf-8')
             # set header
             header.append(('Content-Type', 'application/json; charset=utf-8'))
             header.append(('Content-Length', str(len(res))))
@@ -154,20 +690,98 @@ class ORSAPIServer:
                 return []
 
             # parse request body
-            req = json.loads(wsgi_input.read(int(environ.get('CONTENT_LENGTH', 0))).decode('utf-8'))
+            body = wsgi_input.read(int(environ.get('CONTENT_LENGTH', 0)))
+            with self.metrics.timer('parse'):
+                req = json.loads(body.decode('utf-8'))
+
+            # ranks of many players: {uuids, board, window}, at most MAX_PAGE_SIZE of them
+            if environ.get('PATH_INFO') == self.RANKS_PATH:
+                if isinstance(req, dict):
+                    uuids = req.get('uuids')
+                    board = req.get('board', self.orsdb.DEFAULT_BOARD)
+                    window = req.get('window', self.orsdb.ALL_WINDOW)
+                    if isinstance(uuids, list) and len(uuids) <= self.orsdb.MAX_PAGE_SIZE and all(isinstance(uuid, str) for uuid in uuids) and self.orsdb.is_valid_board(board) and self.orsdb.is_valid_window(window):
+                        res = self.orsdb.get_ranks(uuids, board, window)
+                        with self.metrics.timer('serialize'):
+                            res = json.dumps(res).encode('utf-8')
+                        header.append(('Content-Type', 'application/json; charset=utf-8'))
+                        header.append(('Content-Length', str(len(res))))
+                        response('200 OK', header)
+                        return [res]
+
+                response('400 Bad Request', header)
+                return []
+
+            # end of a season: {board, archive}, the ranking of board becomes the frozen board archive
+            if environ.get('PATH_INFO') == self.ROLLOVER_PATH:
+                if isinstance(req, dict):
+                    board = req.get('board', self.orsdb.DEFAULT_BOARD)
+                    archive = req.get('archive')
+                    if self.orsdb.is_valid_board(board) and self.orsdb.is_valid_board(archive) and board != archive:
+                        if self.orsdb.is_frozen(board):
+                            response('403 Forbidden', header)
+                            return []
+                        # an archive is never overwritten
+                        # the archive has to contain every score that was acknowledged for the board
+                        self.ingest_queue.flush()
+                        if self.orsdb.has_board(archive) or self.orsdb.is_frozen(archive):
+                            response('409 Conflict', header)
+                            return []
+                        self.orsdb.rollover(board, archive)
+                        response('200 OK', header)
+                        return []
+
+                response('400 Bad Request', header)
+                return []
+
+            # bulk scores: [{uuid, user_name, score[, board]}, ...]
+            if environ.get('PATH_INFO') == self.SCORES_PATH:
+                if isinstance(req, list):
+                    scores = [(e.get('uuid'), e.get('user_name'), e.get('score'), e.get('board', self.orsdb.DEFAULT_BOARD)) for e in req if isinstance(e, dict)]
+                    if len(scores) == len(req) and all(uuid and user_name and score and self.orsdb.is_valid_board(board) for uuid, user_name, score, board in scores):
+                        # frozen boards do not take scores, the batch is rejected as a whole
+                        if any(self.orsdb.is_frozen(board) for board in {board for _, _, _, board in scores}):
+                            response('403 Forbidden', header)
+                            return []
+                        # write all scores at once
+                        return self._submit_scores(scores, response, header)
+
+                response('400 Bad Request', header)
+                return []
+
             if req:
                 uuid = req.get('uuid')
                 user_name = req.get('user_name')
                 score = req.get('score')
-                if uuid and user_name and score:
+                board = req.get('board', self.orsdb.DEFAULT_BOARD)
+                if uuid and user_name and score and self.orsdb.is_valid_board(board):
+                    if self.orsdb.is_frozen(board):
+                        response('403 Forbidden', header)
+                        return []
                     # write new score
-                    self.orsdb.write_new_score(uuid, user_name, score)
-                    response('200 OK', header)
-                    return []
+                    return self._submit_scores([(uuid, user_name, score, board)], response, header)
 
             response('400 Bad Request', header)
             return []
 
+    def _submit_scores(self, scores: list, response, header) -> list:
+        # acknowledged once the batch of the scores is written, turned away if the ingest queue is full
+        ## nothing to write is done right away, the writer does not wake up for an empty batch
+        if not scores:
+            response('200 OK', header)
+            return []
+        batch = self.ingest_queue.submit(scores)
+        if batch is None:
+            header.append(('Retry-After', str(ScoreIngestQueue.RETRY_AFTER)))
+            response('429 Too Many Requests', header)
+            return []
+        if not self.ingest_queue.wait(batch):
+            response('500 Internal Server Error', header)
+            return []
+        self.metrics.add('scores', len(scores))
+        response('200 OK', header)
+        return []
+
 
 def main():
 